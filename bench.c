@@ -0,0 +1,455 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "tinyjson.h"
+
+// 粗略的吞吐量对比，结果只在同一台机器上有意义
+
+static double now_ms()
+{
+  return clock() * 1000.0 / CLOCKS_PER_SEC;
+}
+
+typedef struct
+{
+  char *json;
+  size_t len, cap;
+} bench_buffer;
+
+static void bench_puts(bench_buffer *b, const char *s)
+{
+  size_t len = strlen(s);
+  if (b->len + len + 1 > b->cap)
+  {
+    while (b->len + len + 1 > b->cap)
+      b->cap = b->cap == 0 ? 256 : b->cap * 2;
+    b->json = (char *) realloc(b->json, b->cap);
+  }
+  memcpy(b->json + b->len, s, len + 1);
+  b->len += len;
+}
+
+// [[[...{"k":[1,"x"]}...]]]
+static char *bench_deep_json(size_t depth)
+{
+  bench_buffer b = {NULL, 0, 0};
+  size_t i;
+  for (i = 0; i < depth; i++)
+    bench_puts(&b, "[");
+  bench_puts(&b, "{\"k\":[1,\"x\"]}");
+  for (i = 0; i < depth; i++)
+    bench_puts(&b, "]");
+  return b.json;
+}
+
+// [{"id":0,"name":"item","tags":["a","b"],"score":1.5,"ok":true}, ...]
+static char *bench_wide_json(size_t count)
+{
+  bench_buffer b = {NULL, 0, 0};
+  char item[128];
+  size_t i;
+  bench_puts(&b, "[");
+  for (i = 0; i < count; i++)
+  {
+    sprintf(item, "%s{\"id\":%lu,\"name\":\"item\",\"tags\":[\"a\",\"b\"],\"score\":1.5,\"ok\":true}", i > 0 ? "," : "", (unsigned long) i);
+    bench_puts(&b, item);
+  }
+  bench_puts(&b, "]");
+  return b.json;
+}
+
+// ["Lorem ipsum ... 0", ...]，字符串占大头，偶尔有需要转义的字符
+static char *bench_text_json(size_t count)
+{
+  bench_buffer b = {NULL, 0, 0};
+  char item[256];
+  size_t i;
+  bench_puts(&b, "[");
+  for (i = 0; i < count; i++)
+  {
+    sprintf(item, "%s\"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt%s %lu\"", i > 0 ? "," : "",
+            i % 16 == 0 ? "\\n\\\"quoted\\\"" : "", (unsigned long) i);
+    bench_puts(&b, item);
+  }
+  bench_puts(&b, "]");
+  return b.json;
+}
+
+static void bench_tree(const char *name, const char *json, int rounds)
+{
+  tiny_value v, copy, compact;
+  double t_parse = 0, t_copy = 0, t_compact = 0, t_equal = 0, t_hash = 0, t_free = 0, t;
+  int i, equal = 1;
+  for (i = 0; i < rounds; i++)
+  {
+    tiny_init(&v);
+    tiny_init(&copy);
+    tiny_init(&compact);
+    t = now_ms();
+    if (tiny_parse(&v, json) != TINY_PARSE_OK)
+    {
+      fprintf(stderr, "%s: parse failed\n", name);
+      exit(1);
+    }
+    t_parse += now_ms() - t;
+    t = now_ms();
+    tiny_copy(&copy, &v);
+    t_copy += now_ms() - t;
+    t = now_ms();
+    tiny_copy_compact(&compact, &v);
+    t_compact += now_ms() - t;
+    tiny_free(&compact);
+    t = now_ms();
+    equal &= tiny_is_equal(&v, &copy);
+    t_equal += now_ms() - t;
+    t = now_ms();
+    equal &= tiny_hash(&v) == tiny_hash(&copy);
+    t_hash += (now_ms() - t) / 2;
+    t = now_ms();
+    tiny_free(&v);
+    tiny_free(&copy);
+    t_free += (now_ms() - t) / 2;
+  }
+  printf("%-6s %8lu bytes  parse %8.3f  copy %8.3f  compact %8.3f  equal %8.3f  hash %8.3f  free %8.3f  ms%s\n", name, (unsigned long) strlen(json),
+         t_parse / rounds, t_copy / rounds, t_compact / rounds, t_equal / rounds, t_hash / rounds, t_free / rounds, equal ? "" : "  (copy differs!)");
+}
+
+// 同一份文档的文本和 MessagePack 两种表示，各自编码/解码的耗时
+static void bench_codec(const char *name, const char *json, int rounds)
+{
+  tiny_value v, w;
+  char *text, *bin;
+  size_t text_len, bin_len;
+  double t_parse = 0, t_stringify = 0, t_decode = 0, t_encode = 0, t;
+  int i;
+  tiny_init(&v);
+  if (tiny_parse(&v, json) != TINY_PARSE_OK)
+  {
+    fprintf(stderr, "%s: parse failed\n", name);
+    exit(1);
+  }
+  text = tiny_stringify(&v, &text_len);
+  bin = tiny_encode_msgpack(&v, &bin_len);
+  for (i = 0; i < rounds; i++)
+  {
+    char *out;
+    size_t len;
+    tiny_init(&w);
+    t = now_ms();
+    tiny_parse(&w, text);
+    t_parse += now_ms() - t;
+    tiny_free(&w);
+    t = now_ms();
+    tiny_decode_msgpack(&w, bin, bin_len);
+    t_decode += now_ms() - t;
+    tiny_free(&w);
+    t = now_ms();
+    out = tiny_stringify(&v, &len);
+    t_stringify += now_ms() - t;
+    free(out);
+    t = now_ms();
+    out = tiny_encode_msgpack(&v, &len);
+    t_encode += now_ms() - t;
+    free(out);
+  }
+  printf("%-6s json %8lu bytes  parse %8.3f  stringify %8.3f  |  msgpack %8lu bytes  decode %8.3f  encode %8.3f  ms\n", name, (unsigned long) text_len,
+         t_parse / rounds, t_stringify / rounds, (unsigned long) bin_len, t_decode / rounds, t_encode / rounds);
+  free(text);
+  free(bin);
+  tiny_free(&v);
+}
+
+// 转发场景：解析后原样输出，数字立即转换、惰性转换、再加上字符串借用输入的对比
+static void bench_lazy(const char *name, const char *json, int rounds)
+{
+  tiny_parser p;
+  tiny_value v;
+  double t_eager = 0, t_lazy = 0, t_borrow = 0, t;
+  size_t len;
+  int i;
+  tiny_parser_init(&p, NULL);
+  for (i = 0; i < rounds; i++)
+  {
+    tiny_parser_set_flags(&p, 0);
+    t = now_ms();
+    tiny_parser_parse(&p, &v, json);
+    free(tiny_stringify(&v, &len));
+    t_eager += now_ms() - t;
+    tiny_free(&v);
+    tiny_parser_set_flags(&p, TINY_PARSER_LAZY_NUMBERS);
+    t = now_ms();
+    tiny_parser_parse(&p, &v, json);
+    free(tiny_stringify(&v, &len));
+    t_lazy += now_ms() - t;
+    tiny_free(&v);
+    tiny_parser_set_flags(&p, TINY_PARSER_LAZY_NUMBERS | TINY_PARSER_BORROW_STRINGS);
+    t = now_ms();
+    tiny_parser_parse(&p, &v, json);
+    free(tiny_stringify(&v, &len));
+    t_borrow += now_ms() - t;
+    tiny_free(&v);
+  }
+  tiny_parser_destroy(&p);
+  printf("%-6s parse+stringify  eager %8.3f  lazy numbers %8.3f  + borrowed strings %8.3f  ms\n", name, t_eager / rounds, t_lazy / rounds,
+         t_borrow / rounds);
+}
+
+// UTF-8 校验的额外开销
+static void bench_utf8(const char *name, const char *json, int rounds)
+{
+  tiny_parser p;
+  tiny_value v;
+  double t_plain = 0, t_strict = 0, t;
+  int i;
+  tiny_parser_init(&p, NULL);
+  for (i = 0; i < rounds; i++)
+  {
+    tiny_parser_set_flags(&p, 0);
+    t = now_ms();
+    tiny_parser_parse(&p, &v, json);
+    t_plain += now_ms() - t;
+    tiny_free(&v);
+    tiny_parser_set_flags(&p, TINY_PARSER_VALIDATE_UTF8);
+    t = now_ms();
+    tiny_parser_parse(&p, &v, json);
+    t_strict += now_ms() - t;
+    tiny_free(&v);
+  }
+  tiny_parser_destroy(&p);
+  printf("%-6s parse %8.3f  validating UTF-8 %8.3f  ms\n", name, t_plain / rounds, t_strict / rounds);
+}
+
+// 同一份输入反复到来：每次重新解析，和命中缓存后拿共享文档或整块拷贝的对比
+static void bench_cache(const char *name, const char *json, int rounds)
+{
+  tiny_parse_cache *c = tiny_parse_cache_create((size_t) 1 << 30, NULL);
+  tiny_value v;
+  double t_parse = 0, t_get = 0, t_copy = 0, t;
+  int i;
+  tiny_init(&v);
+  tiny_parse_cache_get(c, json, NULL);
+  for (i = 0; i < rounds; i++)
+  {
+    t = now_ms();
+    tiny_parse(&v, json);
+    t_parse += now_ms() - t;
+    tiny_free(&v);
+    t = now_ms();
+    tiny_parse_cache_get(c, json, NULL);
+    t_get += now_ms() - t;
+    t = now_ms();
+    tiny_parse_cache_parse(c, &v, json);
+    t_copy += now_ms() - t;
+    tiny_free(&v);
+  }
+  tiny_parse_cache_destroy(c);
+  printf("%-6s parse %8.3f  cache hit %8.3f  hit + copy %8.3f  ms\n", name, t_parse / rounds, t_get / rounds, t_copy / rounds);
+}
+
+static int bench_count_document(void *ud, tiny_value *v, int ret, size_t begin, size_t end)
+{
+  (void) v;
+  (void) begin;
+  (void) end;
+  *(size_t *) ud += ret == TINY_PARSE_OK;
+  return 0;
+}
+
+// 一批首尾相接的小文档：一次 tiny_parse_many()，和切开后逐个 tiny_parse() 的对比
+static void bench_batch(const char *name, size_t count, int rounds)
+{
+  bench_buffer b = {NULL, 0, 0};
+  char item[128], **docs = (char **) malloc(count * sizeof(char *));
+  tiny_value v;
+  double t_each = 0, t_many = 0, t;
+  size_t i, ok;
+  int r;
+  for (i = 0; i < count; i++)
+  {
+    sprintf(item, "{\"id\":%lu,\"type\":\"click\",\"tags\":[\"a\"]}\n", (unsigned long) i);
+    bench_puts(&b, item);
+    docs[i] = (char *) malloc(strlen(item) + 1);
+    strcpy(docs[i], item);
+  }
+  tiny_init(&v);
+  for (r = 0; r < rounds; r++)
+  {
+    t = now_ms();
+    for (i = 0; i < count; i++)
+    {
+      tiny_parse(&v, docs[i]);
+      tiny_free(&v);
+    }
+    t_each += now_ms() - t;
+    ok = 0;
+    t = now_ms();
+    tiny_parse_many(b.json, b.len, bench_count_document, &ok);
+    t_many += now_ms() - t;
+  }
+  for (i = 0; i < count; i++)
+    free(docs[i]);
+  free(docs);
+  free(b.json);
+  printf("%-6s %lu documents  one by one %8.3f  parse_many %8.3f  ms\n", name, (unsigned long) count, t_each / rounds, t_many / rounds);
+}
+
+// 只要每条记录里的一两个字段：整份解析和按选择器过滤解析的对比
+static void bench_filter(const char *name, const char *json, int rounds)
+{
+  const char *every[] = {"$[*].id", "$[*].tags[0]"}, *one[] = {"$[1000].name"};
+  tiny_filter f, g;
+  tiny_value v;
+  double t_parse = 0, t_every = 0, t_one = 0, t;
+  int i;
+  tiny_filter_init(&f, every, 2);
+  tiny_filter_init(&g, one, 1);
+  for (i = 0; i < rounds; i++)
+  {
+    t = now_ms();
+    tiny_parse(&v, json);
+    t_parse += now_ms() - t;
+    tiny_free(&v);
+    t = now_ms();
+    tiny_parse_filtered(&v, &f, json);
+    t_every += now_ms() - t;
+    tiny_free(&v);
+    t = now_ms();
+    tiny_parse_filtered(&v, &g, json);
+    t_one += now_ms() - t;
+    tiny_free(&v);
+  }
+  tiny_filter_destroy(&f);
+  tiny_filter_destroy(&g);
+  printf("%-6s parse %8.3f  filtered: 2 fields of every record %8.3f  1 field of 1 record %8.3f  ms\n", name, t_parse / rounds, t_every / rounds,
+         t_one / rounds);
+}
+
+// 启动时的两种做法：重新解析文本，或者打开快照直接读
+static void bench_snapshot(const char *name, const char *json, int rounds)
+{
+  const char *path = "tinyjson_bench.snap";
+  tiny_value v;
+  tiny_snapshot *s;
+  double t_parse = 0, t_open = 0, t;
+  int i;
+  tiny_init(&v);
+  if (tiny_parse(&v, json) != TINY_PARSE_OK || tiny_snapshot_write(&v, path) != 0)
+  {
+    fprintf(stderr, "%s: snapshot failed\n", name);
+    exit(1);
+  }
+  tiny_free(&v);
+  for (i = 0; i < rounds; i++)
+  {
+    t = now_ms();
+    tiny_parse(&v, json);
+    t_parse += now_ms() - t;
+    tiny_free(&v);
+    t = now_ms();
+    s = tiny_snapshot_open(path);
+    tiny_snap_get_array_size(tiny_snapshot_root(s));
+    t_open += now_ms() - t;
+    tiny_snapshot_close(s);
+  }
+  remove(path);
+  printf("%-6s parse %8.3f  snapshot open %8.3f  ms\n", name, t_parse / rounds, t_open / rounds);
+}
+
+// 保留多个版本，每个版本改一个字段：整份拷贝和共享存储的对比
+static void bench_versions(const char *name, const char *json, int rounds)
+{
+  tiny_value base, v[16];
+  double t_copy = 0, t_share = 0, t;
+  int i, j;
+  tiny_init(&base);
+  if (tiny_parse(&base, json) != TINY_PARSE_OK)
+  {
+    fprintf(stderr, "%s: parse failed\n", name);
+    exit(1);
+  }
+  for (j = 0; j < 16; j++)
+    tiny_init(&v[j]);
+  for (i = 0; i < rounds; i++)
+  {
+    t = now_ms();
+    tiny_copy(&v[0], &base);
+    for (j = 1; j < 16; j++)
+    {
+      tiny_copy(&v[j], &v[j - 1]);
+      tiny_set_number(tiny_find_pointer(&v[j], "/1000/score", 11), j);
+    }
+    t_copy += now_ms() - t;
+    for (j = 0; j < 16; j++)
+      tiny_free(&v[j]);
+    t = now_ms();
+    tiny_share(&v[0], &base);
+    for (j = 1; j < 16; j++)
+    {
+      tiny_share(&v[j], &v[j - 1]);
+      tiny_set_number(tiny_set_object_value(tiny_edit_array_element(&v[j], 1000), "score", 5), j);
+    }
+    t_share += now_ms() - t;
+    for (j = 0; j < 16; j++)
+      tiny_free(&v[j]);
+  }
+  tiny_free(&base);
+  printf("%-6s 16 versions  copy %8.3f  share %8.3f  ms\n", name, t_copy / rounds, t_share / rounds);
+}
+
+// 改动一个成员之后，发送 diff 和发送整份文档的大小对比
+static void bench_diff(const char *name, const char *json, int rounds)
+{
+  tiny_value a, b, patch;
+  char *text;
+  size_t text_len, patch_len;
+  double t_diff = 0, t;
+  int i;
+  tiny_init(&a);
+  tiny_init(&b);
+  tiny_init(&patch);
+  if (tiny_parse(&a, json) != TINY_PARSE_OK)
+  {
+    fprintf(stderr, "%s: parse failed\n", name);
+    exit(1);
+  }
+  tiny_copy(&b, &a);
+  tiny_set_number(tiny_find_pointer(&b, "/1000/score", 11), 2.5);
+  for (i = 0; i < rounds; i++)
+  {
+    t = now_ms();
+    tiny_diff(&patch, &a, &b);
+    t_diff += now_ms() - t;
+  }
+  text = tiny_stringify(&b, &text_len);
+  free(text);
+  text = tiny_stringify(&patch, &patch_len);
+  free(text);
+  printf("%-6s diff %8.3f ms  patch %8lu bytes  document %8lu bytes\n", name, t_diff / rounds, (unsigned long) patch_len, (unsigned long) text_len);
+  tiny_free(&a);
+  tiny_free(&b);
+  tiny_free(&patch);
+}
+
+int main()
+{
+  char *deep = bench_deep_json(200000);
+  char *wide = bench_wide_json(200000);
+  char *text = bench_text_json(200000);
+  bench_tree("deep", deep, 10);
+  bench_tree("wide", wide, 10);
+  bench_codec("wide", wide, 10);
+  bench_codec("text", text, 10);
+  bench_lazy("wide", wide, 10);
+  bench_utf8("wide", wide, 10);
+  bench_cache("wide", wide, 10);
+  bench_batch("events", 200000, 10);
+  bench_filter("wide", wide, 10);
+  bench_snapshot("wide", wide, 10);
+  bench_versions("wide", wide, 10);
+  bench_diff("wide", wide, 10);
+  free(deep);
+  free(wide);
+  free(text);
+  return 0;
+}
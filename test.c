@@ -356,6 +356,314 @@ static void test_parse_miss_comma_or_square_bracket()
 #endif
 }
 
+#define TEST_PATCH(error, expect, json, patch)           \
+  do                                                     \
+  {                                                      \
+    tiny_value v, p;                                     \
+    char *json2;                                         \
+    size_t length;                                       \
+    tiny_init(&v);                                       \
+    tiny_init(&p);                                       \
+    EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v, json));  \
+    EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&p, patch)); \
+    EXPECT_EQ_INT(error, tiny_apply_patch(&v, &p));      \
+    json2 = tiny_stringify(&v, &length);                 \
+    EXPECT_EQ_STRING(expect, json2, length);             \
+    free(json2);                                         \
+    tiny_free(&v);                                       \
+    tiny_free(&p);                                       \
+  } while (0)
+
+#define TEST_MERGE_PATCH(expect, json, patch)            \
+  do                                                     \
+  {                                                      \
+    tiny_value v, p;                                     \
+    char *json2;                                         \
+    size_t length;                                       \
+    tiny_init(&v);                                       \
+    tiny_init(&p);                                       \
+    EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v, json));  \
+    EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&p, patch)); \
+    tiny_apply_merge_patch(&v, &p);                      \
+    json2 = tiny_stringify(&v, &length);                 \
+    EXPECT_EQ_STRING(expect, json2, length);             \
+    free(json2);                                         \
+    tiny_free(&v);                                       \
+    tiny_free(&p);                                       \
+  } while (0)
+
+static void test_pointer()
+{
+  tiny_value v;
+  tiny_init(&v);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v, "{\"foo\":[\"bar\",\"baz\"],\"\":0,\"a/b\":1,\"m~n\":8,\" \":7}"));
+  EXPECT_TRUE(tiny_find_pointer(&v, "", 0) == &v);
+  EXPECT_EQ_STRING("baz", tiny_get_string(tiny_find_pointer(&v, "/foo/1", 6)), 3);
+  EXPECT_EQ_DOUBLE(0.0, tiny_get_number(tiny_find_pointer(&v, "/", 1)));
+  EXPECT_EQ_DOUBLE(1.0, tiny_get_number(tiny_find_pointer(&v, "/a~1b", 5)));
+  EXPECT_EQ_DOUBLE(8.0, tiny_get_number(tiny_find_pointer(&v, "/m~0n", 5)));
+  EXPECT_EQ_DOUBLE(7.0, tiny_get_number(tiny_find_pointer(&v, "/ ", 2)));
+  EXPECT_TRUE(tiny_find_pointer(&v, "/foo/2", 6) == NULL);
+  EXPECT_TRUE(tiny_find_pointer(&v, "/foo/01", 7) == NULL);
+  EXPECT_TRUE(tiny_find_pointer(&v, "/foo/-", 6) == NULL);
+  EXPECT_TRUE(tiny_find_pointer(&v, "/m~2n", 5) == NULL);
+  EXPECT_TRUE(tiny_find_pointer(&v, "foo", 3) == NULL);
+  tiny_free(&v);
+}
+
+/* EXPECT_EQ_STRING() needs the expected text as a literal */
+#define PATCH_DOC "{\"a\":[1,2,3],\"b\":{\"c\":\"d\",\"e\":\"f\"},\"g\":null}"
+
+static void test_patch()
+{
+  tiny_value v, c, p, t;
+  char *json;
+  size_t length;
+
+  /* RFC 6902 appendix A */
+  TEST_PATCH(TINY_PARSE_OK, "{\"foo\":\"bar\",\"baz\":\"qux\"}", "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz\",\"value\":\"qux\"}]");
+  TEST_PATCH(TINY_PARSE_OK, "{\"foo\":[\"bar\",\"qux\",\"baz\"]}", "{\"foo\":[\"bar\",\"baz\"]}", "[{\"op\":\"add\",\"path\":\"/foo/1\",\"value\":\"qux\"}]");
+  TEST_PATCH(TINY_PARSE_OK, "{\"foo\":\"bar\"}", "{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"remove\",\"path\":\"/baz\"}]");
+  TEST_PATCH(TINY_PARSE_OK, "{\"foo\":[\"bar\",\"baz\"]}", "{\"foo\":[\"bar\",\"qux\",\"baz\"]}", "[{\"op\":\"remove\",\"path\":\"/foo/1\"}]");
+  TEST_PATCH(TINY_PARSE_OK, "{\"baz\":\"boo\",\"foo\":\"bar\"}", "{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"replace\",\"path\":\"/baz\",\"value\":\"boo\"}]");
+  TEST_PATCH(TINY_PARSE_OK, "{\"foo\":{\"bar\":\"baz\"},\"qux\":{\"corge\":\"grault\",\"thud\":\"fred\"}}",
+             "{\"foo\":{\"bar\":\"baz\",\"waldo\":\"fred\"},\"qux\":{\"corge\":\"grault\"}}", "[{\"op\":\"move\",\"from\":\"/foo/waldo\",\"path\":\"/qux/thud\"}]");
+  TEST_PATCH(TINY_PARSE_OK, "{\"foo\":[\"all\",\"cows\",\"eat\",\"grass\"]}", "{\"foo\":[\"all\",\"grass\",\"cows\",\"eat\"]}",
+             "[{\"op\":\"move\",\"from\":\"/foo/1\",\"path\":\"/foo/3\"}]");
+  TEST_PATCH(TINY_PARSE_OK, "{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}", "{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}",
+             "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"qux\"},{\"op\":\"test\",\"path\":\"/foo/1\",\"value\":2}]");
+  TEST_PATCH(TINY_PATCH_TEST_FAILED, "{\"baz\":\"qux\"}", "{\"baz\":\"qux\"}", "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"bar\"}]");
+  TEST_PATCH(TINY_PARSE_OK, "{\"foo\":\"bar\",\"child\":{\"grandchild\":{}}}", "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/child\",\"value\":{\"grandchild\":{}}}]");
+  TEST_PATCH(TINY_PATCH_PATH_NOT_FOUND, "{\"foo\":\"bar\"}", "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz/bat\",\"value\":\"qux\"}]");
+  TEST_PATCH(TINY_PARSE_OK, "{\"/\":9,\"~1\":10}", "{\"/\":9,\"~1\":10}", "[{\"op\":\"test\",\"path\":\"/~01\",\"value\":10}]");
+  TEST_PATCH(TINY_PARSE_OK, "{\"foo\":[\"bar\",[\"abc\",\"def\"]]}", "{\"foo\":[\"bar\"]}", "[{\"op\":\"add\",\"path\":\"/foo/-\",\"value\":[\"abc\",\"def\"]}]");
+
+  /* root and copy */
+  TEST_PATCH(TINY_PARSE_OK, "[1]", "{\"a\":1}", "[{\"op\":\"replace\",\"path\":\"\",\"value\":[1]}]");
+  TEST_PATCH(TINY_PARSE_OK, "{\"x\":{\"a\":1}}", "{\"a\":1}", "[{\"op\":\"add\",\"path\":\"\",\"value\":{}},{\"op\":\"add\",\"path\":\"/x\",\"value\":{\"a\":1}}]");
+  TEST_PATCH(TINY_PARSE_OK, "[3]", "{\"a\":[3]}", "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"\"}]");
+  TEST_PATCH(TINY_PARSE_OK, "{\"a\":[1,[2]],\"b\":[2]}", "{\"a\":[1,[2]]}", "[{\"op\":\"copy\",\"from\":\"/a/1\",\"path\":\"/b\"}]");
+
+  /* a failing operation rolls back everything before it */
+  TEST_PATCH(TINY_PATCH_PATH_NOT_FOUND, PATCH_DOC, PATCH_DOC,
+             "[{\"op\":\"remove\",\"path\":\"/a/0\"},{\"op\":\"add\",\"path\":\"/b/x\",\"value\":1},{\"op\":\"replace\",\"path\":\"/b/c\",\"value\":\"z\"},"
+             "{\"op\":\"move\",\"from\":\"/b/e\",\"path\":\"/a/1\"},{\"op\":\"copy\",\"from\":\"/g\",\"path\":\"/h\"},{\"op\":\"remove\",\"path\":\"/b/c\"},"
+             "{\"op\":\"add\",\"path\":\"/a/-\",\"value\":{\"k\":[]}},{\"op\":\"move\",\"from\":\"/b\",\"path\":\"/a/0\"},{\"op\":\"remove\",\"path\":\"/nope\"}]");
+  TEST_PATCH(TINY_PATCH_PATH_NOT_FOUND, PATCH_DOC, PATCH_DOC, "[{\"op\":\"move\",\"from\":\"/b/c\",\"path\":\"/b/e\"},{\"op\":\"move\",\"from\":\"/b/e\",\"path\":\"/z/q\"}]");
+  TEST_PATCH(TINY_PATCH_TEST_FAILED, PATCH_DOC, PATCH_DOC, "[{\"op\":\"replace\",\"path\":\"\",\"value\":[]},{\"op\":\"add\",\"path\":\"/0\",\"value\":1},{\"op\":\"test\",\"path\":\"/0\",\"value\":2}]");
+  TEST_PATCH(TINY_PATCH_PATH_NOT_FOUND, PATCH_DOC, PATCH_DOC, "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"\"},{\"op\":\"remove\",\"path\":\"/3\"}]");
+
+  TEST_PATCH(TINY_PATCH_INVALID_OPERATION, PATCH_DOC, PATCH_DOC, "[{\"op\":\"remove\",\"path\":\"/g\"},{\"op\":\"frobnicate\",\"path\":\"/a\"}]");
+  TEST_PATCH(TINY_PATCH_INVALID_OPERATION, PATCH_DOC, PATCH_DOC, "[{\"op\":\"add\",\"path\":\"/x\"}]");
+  TEST_PATCH(TINY_PATCH_INVALID_OPERATION, PATCH_DOC, PATCH_DOC, "[{\"op\":\"move\",\"path\":\"/x\"}]");
+  TEST_PATCH(TINY_PATCH_INVALID_OPERATION, PATCH_DOC, PATCH_DOC, "[{\"op\":\"add\",\"path\":\"a\",\"value\":1}]");
+  TEST_PATCH(TINY_PATCH_INVALID_OPERATION, PATCH_DOC, PATCH_DOC, "[{\"op\":\"move\",\"from\":\"/b\",\"path\":\"/b/x\"}]");
+  TEST_PATCH(TINY_PATCH_INVALID_OPERATION, PATCH_DOC, PATCH_DOC, "[{\"op\":\"remove\",\"path\":\"\"}]");
+  TEST_PATCH(TINY_PATCH_INVALID_OPERATION, PATCH_DOC, PATCH_DOC, "{\"op\":\"remove\",\"path\":\"/a\"}");
+  TEST_PATCH(TINY_PATCH_INVALID_OPERATION, PATCH_DOC, PATCH_DOC, "[1]");
+  TEST_PATCH(TINY_PATCH_PATH_NOT_FOUND, PATCH_DOC, PATCH_DOC, "[{\"op\":\"add\",\"path\":\"/a/4\",\"value\":1}]");
+  TEST_PATCH(TINY_PATCH_PATH_NOT_FOUND, PATCH_DOC, PATCH_DOC, "[{\"op\":\"add\",\"path\":\"/a/01\",\"value\":1}]");
+  TEST_PATCH(TINY_PATCH_PATH_NOT_FOUND, PATCH_DOC, PATCH_DOC, "[{\"op\":\"remove\",\"path\":\"/a/-\"}]");
+  TEST_PATCH(TINY_PATCH_PATH_NOT_FOUND, PATCH_DOC, PATCH_DOC, "[{\"op\":\"replace\",\"path\":\"/x\",\"value\":1}]");
+  TEST_PATCH(TINY_PATCH_PATH_NOT_FOUND, PATCH_DOC, PATCH_DOC, "[{\"op\":\"add\",\"path\":\"/g/x\",\"value\":1}]");
+  TEST_PATCH(TINY_PATCH_PATH_NOT_FOUND, PATCH_DOC, PATCH_DOC, "[{\"op\":\"move\",\"from\":\"/x\",\"path\":\"/x\"}]");
+
+  /* compact clones are patched and rolled back like any other tree */
+  tiny_init(&v);
+  tiny_init(&c);
+  tiny_init(&p);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v, PATCH_DOC));
+  tiny_copy_compact(&c, &v);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&p, "[{\"op\":\"remove\",\"path\":\"/b/c\"},{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/b/a\"},{\"op\":\"test\",\"path\":\"/g\",\"value\":0}]"));
+  EXPECT_EQ_INT(TINY_PATCH_TEST_FAILED, tiny_apply_patch(&c, &p));
+  EXPECT_TRUE(tiny_is_equal(&v, &c));
+  tiny_free(&p);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&p, "[{\"op\":\"remove\",\"path\":\"/b/c\"},{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/b/a\"}]"));
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_apply_patch(&c, &p));
+  json = tiny_stringify(&c, &length);
+  EXPECT_EQ_STRING("{\"b\":{\"e\":\"f\",\"a\":[1,2,3]},\"g\":null}", json, length);
+  free(json);
+  tiny_free(&v);
+  tiny_free(&c);
+  tiny_free(&p);
+
+  /* a compact clone below the root: earlier steps are logged before it is copied out */
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v, "{\"r\":{\"a\":[\"xxxxxxxxxxxxxxxx\",{\"k\":\"yyyy\"}],\"b\":1}}"));
+  tiny_init(&t);
+  tiny_set_object(&t, 1);
+  tiny_copy_compact(tiny_set_object_value(&t, "r", 1), tiny_find_object_value(&v, "r", 1));
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&p, "[{\"op\":\"replace\",\"path\":\"/r/a\",\"value\":0},{\"op\":\"add\",\"path\":\"/r/z\",\"value\":1},{\"op\":\"test\",\"path\":\"/r/b\",\"value\":2}]"));
+  EXPECT_EQ_INT(TINY_PATCH_TEST_FAILED, tiny_apply_patch(&t, &p));
+  EXPECT_TRUE(tiny_is_equal(&v, &t));
+  tiny_free(&p);
+  tiny_copy_compact(tiny_set_object_value(&t, "r", 1), tiny_find_object_value(&v, "r", 1));
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&p, "[{\"op\":\"replace\",\"path\":\"/r/a\",\"value\":0},{\"op\":\"add\",\"path\":\"/r/z\",\"value\":1}]"));
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_apply_patch(&t, &p));
+  json = tiny_stringify(&t, &length);
+  EXPECT_EQ_STRING("{\"r\":{\"a\":0,\"b\":1,\"z\":1}}", json, length);
+  free(json);
+  tiny_free(&v);
+  tiny_free(&t);
+  tiny_free(&p);
+}
+
+static void test_merge_patch()
+{
+  /* RFC 7386 appendix A */
+  TEST_MERGE_PATCH("{\"a\":\"c\"}", "{\"a\":\"b\"}", "{\"a\":\"c\"}");
+  TEST_MERGE_PATCH("{\"a\":\"b\",\"b\":\"c\"}", "{\"a\":\"b\"}", "{\"b\":\"c\"}");
+  TEST_MERGE_PATCH("{}", "{\"a\":\"b\"}", "{\"a\":null}");
+  TEST_MERGE_PATCH("{\"b\":\"c\"}", "{\"a\":\"b\",\"b\":\"c\"}", "{\"a\":null}");
+  TEST_MERGE_PATCH("{\"a\":\"c\"}", "{\"a\":[\"b\"]}", "{\"a\":\"c\"}");
+  TEST_MERGE_PATCH("{\"a\":[\"b\"]}", "{\"a\":\"c\"}", "{\"a\":[\"b\"]}");
+  TEST_MERGE_PATCH("{\"a\":{\"b\":\"d\"}}", "{\"a\":{\"b\":\"c\"}}", "{\"a\":{\"b\":\"d\",\"c\":null}}");
+  TEST_MERGE_PATCH("{\"a\":[1]}", "{\"a\":[{\"b\":\"c\"}]}", "{\"a\":[1]}");
+  TEST_MERGE_PATCH("[\"c\",\"d\"]", "[\"a\",\"b\"]", "[\"c\",\"d\"]");
+  TEST_MERGE_PATCH("[\"c\"]", "{\"a\":\"b\"}", "[\"c\"]");
+  TEST_MERGE_PATCH("null", "{\"a\":\"foo\"}", "null");
+  TEST_MERGE_PATCH("\"bar\"", "{\"a\":\"foo\"}", "\"bar\"");
+  TEST_MERGE_PATCH("{\"e\":null,\"a\":1}", "{\"e\":null}", "{\"a\":1}");
+  TEST_MERGE_PATCH("{\"a\":\"b\"}", "[1,2]", "{\"a\":\"b\",\"c\":null}");
+  TEST_MERGE_PATCH("{\"a\":{\"bb\":{}}}", "{}", "{\"a\":{\"bb\":{\"ccc\":null}}}");
+
+  /* sibling members added while nested objects are still pending */
+  TEST_MERGE_PATCH("{\"x\":{\"y\":{\"z\":1,\"w\":2}},\"n\":{\"m\":true},\"a\":1,\"b\":2,\"c\":3}", "{\"x\":{\"y\":{\"z\":0}}}",
+                   "{\"x\":{\"y\":{\"z\":1,\"w\":2}},\"n\":{\"m\":true},\"a\":1,\"b\":2,\"c\":3}");
+}
+
+/* the patch must turn a into b */
+static void test_diff_apply(const char *ja, const char *jb)
+{
+  tiny_value a, b, patch;
+  tiny_init(&a);
+  tiny_init(&b);
+  tiny_init(&patch);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&a, ja));
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&b, jb));
+  tiny_diff(&patch, &a, &b);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_apply_patch(&a, &patch));
+  EXPECT_TRUE(tiny_is_equal(&a, &b));
+  tiny_free(&a);
+  tiny_free(&b);
+  tiny_free(&patch);
+}
+
+#define TEST_DIFF(expect, ja, jb)                     \
+  do                                                  \
+  {                                                   \
+    tiny_value a, b, patch;                           \
+    char *json;                                       \
+    size_t length;                                    \
+    tiny_init(&a);                                    \
+    tiny_init(&b);                                    \
+    tiny_init(&patch);                                \
+    EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&a, ja)); \
+    EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&b, jb)); \
+    tiny_diff(&patch, &a, &b);                        \
+    json = tiny_stringify(&patch, &length);           \
+    EXPECT_EQ_STRING(expect, json, length);           \
+    free(json);                                       \
+    tiny_free(&a);                                    \
+    tiny_free(&b);                                    \
+    tiny_free(&patch);                                \
+    test_diff_apply(ja, jb);                          \
+  } while (0)
+
+static void test_diff()
+{
+  tiny_value a, b, patch;
+  char *ja, *jb;
+  size_t i, n;
+
+  TEST_DIFF("[]", "{\"a\":[1,{\"b\":null}]}", "{\"a\":[1,{\"b\":null}]}");
+  TEST_DIFF("[{\"op\":\"replace\",\"path\":\"\",\"value\":{\"x\":1}}]", "[1]", "{\"x\":1}");
+  TEST_DIFF("[{\"op\":\"replace\",\"path\":\"\",\"value\":2}]", "1", "2");
+  TEST_DIFF("[{\"op\":\"remove\",\"path\":\"/a\"}]", "{\"a\":1,\"b\":2}", "{\"b\":2}");
+  TEST_DIFF("[{\"op\":\"add\",\"path\":\"/x\",\"value\":null},{\"op\":\"replace\",\"path\":\"/c/d\",\"value\":\"f\"},{\"op\":\"remove\",\"path\":\"/b/1\"},"
+            "{\"op\":\"add\",\"path\":\"/b/2\",\"value\":4}]",
+            "{\"a\":1,\"b\":[1,2,3],\"c\":{\"d\":\"e\"}}", "{\"a\":1,\"b\":[1,3,4],\"c\":{\"d\":\"f\"},\"x\":null}");
+  TEST_DIFF("[{\"op\":\"replace\",\"path\":\"/a~1b/m~0n\",\"value\":2}]", "{\"a/b\":{\"m~n\":1}}", "{\"a/b\":{\"m~n\":2}}");
+  TEST_DIFF("[{\"op\":\"replace\",\"path\":\"/1/v\",\"value\":3}]", "[{\"id\":1,\"v\":1},{\"id\":2,\"v\":2}]", "[{\"id\":1,\"v\":1},{\"id\":2,\"v\":3}]");
+  TEST_DIFF("[{\"op\":\"add\",\"path\":\"/0\",\"value\":0}]", "[1,2,3]", "[0,1,2,3]");
+  TEST_DIFF("[{\"op\":\"remove\",\"path\":\"/2\"}]", "[1,2,3,4]", "[1,2,4]");
+  TEST_DIFF("[{\"op\":\"replace\",\"path\":\"/0\",\"value\":\"x\"}]", "[[1],2]", "[\"x\",2]");
+  /* duplicate keys in a are removed down to the last one */
+  TEST_DIFF("[{\"op\":\"remove\",\"path\":\"/a\"},{\"op\":\"replace\",\"path\":\"/a\",\"value\":1}]", "{\"a\":1,\"a\":2}", "{\"a\":1}");
+  TEST_DIFF("[{\"op\":\"remove\",\"path\":\"/a\"},{\"op\":\"add\",\"path\":\"/b\",\"value\":2}]", "{\"a\":1,\"a\":1}", "{\"a\":1,\"b\":2}");
+
+  test_diff_apply("[1,2,3,4,5,6]", "[6,5,4,3,2,1]");
+  test_diff_apply("[1,[2,[3]],{\"a\":[4,5]},6]", "[0,[2,[3,4]],7,{\"a\":[5]},6,6]");
+  test_diff_apply("{\"a\":{\"b\":{\"c\":[1,2]}},\"d\":[{\"e\":1},{\"f\":2}]}", "{\"a\":{\"b\":{\"c\":[2,1],\"g\":{}}},\"d\":[{\"f\":2},{\"e\":1,\"h\":[]}]}");
+  test_diff_apply("[]", "[[],{},null]");
+  test_diff_apply("{\"a\":[]}", "{}");
+  test_diff_apply("{\"\":[\"\"]}", "{\"\":[\"\",\"\"],\"~\":\"/\"}");
+  test_diff_apply("{\"a\":[1],\"b\":0,\"a\":[2],\"c\":1,\"c\":2}", "{\"a\":[2,3],\"b\":0}");
+
+  /* wide objects use the key index, long arrays fall back to positional matching */
+  for (n = 20; n <= 600; n += 580)
+  {
+    ja = (char *) malloc(n * 16 + 16);
+    jb = (char *) malloc(n * 16 + 16);
+    strcpy(ja, "{");
+    strcpy(jb, "{");
+    for (i = 0; i < n; i++)
+    {
+      sprintf(ja + strlen(ja), "%s\"k%d\":%d", i > 0 ? "," : "", (int) i, (int) i);
+      sprintf(jb + strlen(jb), "%s\"k%d\":%d", i > 0 ? "," : "", (int) (i * 7 % n), (int) (i % 5 == 0 ? i + 1 : i));
+    }
+    strcat(ja, "}");
+    strcat(jb, "}");
+    test_diff_apply(ja, jb);
+    strcpy(ja, "{");
+    for (i = 0; i < n; i++)
+      sprintf(ja + strlen(ja), "%s\"k%d\":[%d]", i > 0 ? "," : "", (int) (i % 8), (int) i);
+    strcat(ja, "}");
+    strcpy(jb, "{\"k1\":[17,0],\"k3\":0,\"x\":1}");
+    test_diff_apply(ja, jb); /* duplicate keys through the key index */
+    sprintf(ja, "[");
+    sprintf(jb, "[");
+    for (i = 0; i < n; i++)
+    {
+      sprintf(ja + strlen(ja), "%s%d", i > 0 ? "," : "", (int) (i % 13));
+      sprintf(jb + strlen(jb), "%s%d", i > 0 ? "," : "", (int) (i % 11));
+    }
+    strcat(ja, "]");
+    strcat(jb, "]");
+    test_diff_apply(ja, jb);
+    free(ja);
+    free(jb);
+  }
+
+  /* one change at the bottom of a deep chain gives one op with the full path */
+  n = 5000;
+  ja = (char *) malloc(n * 6 + 6);
+  jb = (char *) malloc(n * 6 + 6);
+  for (i = 0; i < n; i++)
+  {
+    memcpy(ja + i * 5, "{\"a\":", 5);
+    ja[n * 5 + 5 + i] = '}';
+  }
+  memcpy(ja + n * 5, "[1,2]", 5);
+  ja[n * 6 + 5] = '\0';
+  strcpy(jb, ja);
+  jb[n * 5 + 3] = '3';
+  tiny_init(&a);
+  tiny_init(&b);
+  tiny_init(&patch);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&a, ja));
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&b, jb));
+  tiny_diff(&patch, &a, &b);
+  EXPECT_EQ_SIZE_T(1, tiny_get_array_size(&patch));
+  EXPECT_EQ_SIZE_T(n * 2 + 2, tiny_get_string_length(tiny_find_pointer(&patch, "/0/path", 7)));
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_apply_patch(&a, &patch));
+  EXPECT_TRUE(tiny_is_equal(&a, &b));
+  tiny_free(&a);
+  tiny_free(&b);
+  tiny_free(&patch);
+  free(ja);
+  free(jb);
+}
+
 static void test_access_null()
 {
   tiny_value v;
@@ -425,6 +733,40 @@ static void test_parse_miss_comma_or_curly_bracket()
   TEST_ERROR(TINY_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":{}");
 }
 
+static void test_parse_depth()
+{
+  tiny_parser p;
+  tiny_value v;
+  char *json;
+  size_t i, n = 100000;
+
+  /* deep nesting must not recurse */
+  json = (char *) malloc(2 * n + 1);
+  for (i = 0; i < n; i++)
+  {
+    json[i] = '[';
+    json[n + i] = ']';
+  }
+  json[2 * n] = '\0';
+  tiny_init(&v);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v, json));
+  EXPECT_EQ_INT(TINY_ARRAY, tiny_get_type(&v));
+  EXPECT_EQ_SIZE_T(1, tiny_get_array_size(&v));
+  tiny_free(&v);
+  free(json);
+
+  tiny_parser_init(&p, NULL);
+  tiny_parser_set_max_depth(&p, 2);
+  tiny_init(&v);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parser_parse(&p, &v, "[{\"a\":1},[]]"));
+  tiny_free(&v);
+  EXPECT_EQ_INT(TINY_PARSE_DEPTH_EXCEEDED, tiny_parser_parse(&p, &v, "[{\"a\":[1]}]"));
+  EXPECT_EQ_INT(TINY_NULL, tiny_get_type(&v));
+  EXPECT_EQ_INT(TINY_PARSE_DEPTH_EXCEEDED, tiny_parser_parse(&p, &v, "{\"a\":\"x\",\"b\":[[]]}"));
+  EXPECT_EQ_INT(TINY_NULL, tiny_get_type(&v));
+  tiny_parser_destroy(&p);
+}
+
 static void test_parse()
 {
   test_parse_true();
@@ -453,6 +795,7 @@ static void test_parse()
   test_parse_miss_colon();
   test_parse_miss_comma_or_curly_bracket();
 #endif
+  test_parse_depth();
 }
 
 #define TEST_ROUNDTRIP(json)                            \
@@ -499,6 +842,9 @@ static void test_stringify_string()
   TEST_ROUNDTRIP("\"Hello\\nWorld\"");
   TEST_ROUNDTRIP("\"\\\" \\\\ / \\b \\f \\n \\r \\t\"");
   TEST_ROUNDTRIP("\"Hello\\u0000World\"");
+  TEST_ROUNDTRIP("\"0123456789abcdef0123456789abcdef0123456789\""); /* clean runs longer than a block */
+  TEST_ROUNDTRIP("\"0123456789abcde\\n0123456789abcd\\u001F\\\"0123456789abcdef/0123\\\\\"");
+  TEST_ROUNDTRIP("\"\\t\\t\\t\\t\\t\\t\\t\\t\\t\\t\\t\\t\\t\\t\\t\\t\\t\"");
 }
 
 static void test_stringify_array()
@@ -513,6 +859,75 @@ static void test_stringify_object()
   TEST_ROUNDTRIP("{\"n\":null,\"f\":false,\"t\":true,\"i\":123,\"s\":\"abc\",\"a\":[1,2,3],\"o\":{\"1\":1,\"2\":2,\"3\":3}}");
 }
 
+#define TEST_STRINGIFY_INTO(json)                                         \
+  do                                                                      \
+  {                                                                       \
+    tiny_value v;                                                         \
+    char buf[256];                                                        \
+    size_t length;                                                        \
+    tiny_init(&v);                                                        \
+    EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v, json));                   \
+    length = tiny_stringify_size(&v);                                     \
+    EXPECT_EQ_SIZE_T(sizeof(json) - 1, length);                           \
+    EXPECT_EQ_SIZE_T(length, tiny_stringify_into(&v, buf, length));       \
+    EXPECT_EQ_STRING(json, buf, length);                                  \
+    EXPECT_EQ_SIZE_T(length, tiny_stringify_into(&v, buf, sizeof(buf)));  \
+    EXPECT_EQ_INT('\0', buf[length]);                                     \
+    if (length > 0)                                                       \
+      EXPECT_TRUE(tiny_stringify_into(&v, buf, length - 1) > length - 1); \
+    tiny_free(&v);                                                        \
+  } while (0)
+
+static void test_stringify_into()
+{
+  TEST_STRINGIFY_INTO("null");
+  TEST_STRINGIFY_INTO("-1.5");
+  TEST_STRINGIFY_INTO("1.7976931348623157e+308");
+  TEST_STRINGIFY_INTO("\"Hello\\nWorld\"");
+  TEST_STRINGIFY_INTO("\"\\\" \\\\ / \\b \\f \\n \\r \\t\"");
+  TEST_STRINGIFY_INTO("\"Hello\\u0000World\\u001F\"");
+  TEST_STRINGIFY_INTO("\"0123456789abcde\\n0123456789abcd\\u001F\\\"0123456789abcdef/0123\\\\\"");
+  TEST_STRINGIFY_INTO("[null,false,true,123,\"abc\",[1,2,3]]");
+  TEST_STRINGIFY_INTO("{\"n\":null,\"f\":false,\"t\":true,\"i\":123,\"s\":\"abc\",\"a\":[1,2,3],\"o\":{\"1\":1,\"2\":2,\"3\":3}}");
+}
+
+static char *deep_json(size_t depth, const char *leaf)
+{
+  size_t i, len = strlen(leaf);
+  char *json = (char *) malloc(2 * depth + len + 1);
+  for (i = 0; i < depth; i++)
+  {
+    json[i] = '[';
+    json[depth + len + i] = ']';
+  }
+  memcpy(json + depth, leaf, len);
+  json[2 * depth + len] = '\0';
+  return json;
+}
+
+static void test_stringify_deep()
+{
+  tiny_value v;
+  char *json, *out;
+  size_t i, length, depths[] = {31, 32, 33, 100, 1000000};
+  for (i = 0; i < sizeof(depths) / sizeof(depths[0]); i++)
+  {
+    /* both writers walk deep trees without recursing */
+    json = deep_json(depths[i], "{\"a\":[1,{}],\"b\":\"x\"}");
+    tiny_init(&v);
+    EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v, json));
+    out = tiny_stringify(&v, &length);
+    EXPECT_EQ_SIZE_T(strlen(json), length);
+    EXPECT_TRUE(strcmp(json, out) == 0);
+    EXPECT_EQ_SIZE_T(length, tiny_stringify_size(&v));
+    EXPECT_EQ_SIZE_T(length, tiny_stringify_into(&v, out, length + 1));
+    EXPECT_TRUE(strcmp(json, out) == 0);
+    tiny_free(&v);
+    free(out);
+    free(json);
+  }
+}
+
 static void test_stringify()
 {
   TEST_ROUNDTRIP("null");
@@ -522,6 +937,8 @@ static void test_stringify()
   test_stringify_string();
   test_stringify_array();
   test_stringify_object();
+  test_stringify_into();
+  test_stringify_deep();
 }
 
 #define TEST_EQUAL(json1, json2, equality)                \
@@ -533,6 +950,9 @@ static void test_stringify()
     EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v1, json1)); \
     EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v2, json2)); \
     EXPECT_EQ_INT(equality, tiny_is_equal(&v1, &v2));     \
+    EXPECT_EQ_INT(equality, tiny_is_equal(&v2, &v1));     \
+    if (equality)                                         \
+      EXPECT_TRUE(tiny_hash(&v1) == tiny_hash(&v2));      \
     tiny_free(&v1);                                       \
     tiny_free(&v2);                                       \
   } while (0)
@@ -562,6 +982,143 @@ static void test_equal()
   TEST_EQUAL("{\"a\":1,\"b\":2}", "{\"a\":1,\"b\":2,\"c\":3}", 0);
   TEST_EQUAL("{\"a\":{\"b\":{\"c\":{}}}}", "{\"a\":{\"b\":{\"c\":{}}}}", 1);
   TEST_EQUAL("{\"a\":{\"b\":{\"c\":{}}}}", "{\"a\":{\"b\":{\"c\":[]}}}", 0);
+  /* duplicate keys: members are matched one to one */
+  TEST_EQUAL("{\"a\":1,\"a\":1}", "{\"a\":1,\"b\":2}", 0);
+  TEST_EQUAL("{\"a\":1,\"a\":1}", "{\"a\":1,\"a\":2}", 0);
+  TEST_EQUAL("{\"a\":1,\"a\":2}", "{\"a\":2,\"a\":1}", 1);
+  TEST_EQUAL("{\"a\":1,\"b\":2,\"a\":1}", "{\"a\":1,\"a\":1,\"b\":2}", 1);
+  TEST_EQUAL("{\"a\":[1],\"a\":{\"x\":1}}", "{\"a\":{\"x\":1},\"a\":[1]}", 1);
+  TEST_EQUAL("{\"a\":[1],\"a\":{\"x\":1}}", "{\"a\":{\"x\":2},\"a\":[1]}", 0);
+  TEST_EQUAL("{\"a\":[1],\"a\":[2]}", "{\"a\":[2],\"a\":[1]}", 1);
+  TEST_EQUAL("[{\"x\":{\"a\":[[1]],\"a\":[[2]]}}]", "[{\"x\":{\"a\":[[2]],\"a\":[[1]]}}]", 1);
+  TEST_EQUAL("[{\"x\":{\"a\":[[1]],\"a\":[[2]]}}]", "[{\"x\":{\"a\":[[2]],\"a\":[[2]]}}]", 0);
+}
+
+static void test_equal_wide_object()
+{
+  tiny_value v1, v2;
+  char json1[4096], json2[4096], *p1 = json1, *p2 = json2;
+  int i, n = 200;
+  /* same members, opposite order */
+  for (i = 0; i < n; i++)
+  {
+    p1 += sprintf(p1, "%c\"k%d\":%d", i == 0 ? '{' : ',', i, i);
+    p2 += sprintf(p2, "%c\"k%d\":%d", i == 0 ? '{' : ',', n - 1 - i, n - 1 - i);
+  }
+  strcpy(p1, "}");
+  strcpy(p2, "}");
+  tiny_init(&v1);
+  tiny_init(&v2);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v1, json1));
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v2, json2));
+  EXPECT_TRUE(tiny_is_equal(&v1, &v2));
+  tiny_set_number(tiny_find_object_value(&v2, "k7", 2), -1);
+  EXPECT_FALSE(tiny_is_equal(&v1, &v2));
+  tiny_free(&v2);
+  p2 = json2 + sprintf(json2, "{\"x\":0");
+  for (i = 1; i < n; i++)
+    p2 += sprintf(p2, ",\"k%d\":%d", i, i);
+  strcpy(p2, "}");
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v2, json2));
+  EXPECT_FALSE(tiny_is_equal(&v1, &v2)); /* same size, one key differs */
+  tiny_free(&v1);
+  tiny_free(&v2);
+  /* duplicate keys in wide objects */
+  p1 = json1;
+  p2 = json2;
+  for (i = 0; i < n; i++)
+  {
+    p1 += sprintf(p1, "%c\"k%d\":%d", i == 0 ? '{' : ',', i == 7 ? 8 : i, i % 2);
+    p2 += sprintf(p2, "%c\"k%d\":%d", i == 0 ? '{' : ',', n - 1 - i == 7 ? 8 : n - 1 - i, (n - 1 - i) % 2);
+  }
+  strcpy(p1, "}");
+  strcpy(p2, "}");
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v1, json1));
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v2, json2));
+  EXPECT_TRUE(tiny_is_equal(&v1, &v2));
+  EXPECT_TRUE(tiny_is_equal(&v2, &v1));
+  tiny_set_number(tiny_get_object_value(&v2, n - 1 - 7), 5);
+  EXPECT_FALSE(tiny_is_equal(&v1, &v2));
+  EXPECT_FALSE(tiny_is_equal(&v2, &v1));
+  tiny_free(&v2);
+  p2 = json2;
+  for (i = 0; i < n; i++)
+    p2 += sprintf(p2, "%c\"k%d\":%d", i == 0 ? '{' : ',', i, i % 2);
+  strcpy(p2, "}");
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v2, json2));
+  EXPECT_FALSE(tiny_is_equal(&v1, &v2)); /* k7 on one side, a second k8 on the other */
+  EXPECT_FALSE(tiny_is_equal(&v2, &v1));
+  tiny_free(&v1);
+  tiny_free(&v2);
+}
+
+static unsigned long long test_hash_of(const char *json)
+{
+  tiny_value v;
+  unsigned long long h;
+  tiny_init(&v);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v, json));
+  h = tiny_hash(&v);
+  tiny_free(&v);
+  return h;
+}
+
+#define TEST_HASH(same, json1, json2) EXPECT_EQ_INT(same, test_hash_of(json1) == test_hash_of(json2))
+
+static void test_hash()
+{
+  tiny_parser p;
+  tiny_value v, w;
+  char *deep;
+  size_t i, n = 100000;
+
+  TEST_HASH(1, "null", "null");
+  TEST_HASH(1, "0", "-0");
+  TEST_HASH(1, "1.5", "15e-1");
+  TEST_HASH(1, "\"a\\u0062c\"", "\"abc\"");
+  TEST_HASH(1, "{\"a\":1,\"b\":[1,2,{\"c\":null,\"d\":true}]}", "{\"b\":[1,2,{\"d\":true,\"c\":null}],\"a\":1}");
+  TEST_HASH(0, "null", "false");
+  TEST_HASH(0, "false", "true");
+  TEST_HASH(0, "0", "null");
+  TEST_HASH(0, "1", "2");
+  TEST_HASH(0, "\"\"", "[]");
+  TEST_HASH(0, "[]", "{}");
+  TEST_HASH(0, "[1,2]", "[2,1]");
+  TEST_HASH(0, "[[]]", "[[],[]]");
+  TEST_HASH(0, "[[1],2]", "[1,[2]]");
+  TEST_HASH(0, "{\"a\":1,\"b\":2}", "{\"a\":2,\"b\":1}");
+  TEST_HASH(0, "{\"a\":1}", "{\"a\":1,\"b\":1}");
+  TEST_HASH(0, "{\"ab\":\"c\"}", "{\"a\":\"bc\"}");
+
+  /* lazy numbers and borrowed strings hash like eager ones */
+  tiny_parser_init(&p, NULL);
+  tiny_parser_set_flags(&p, TINY_PARSER_LAZY_NUMBERS | TINY_PARSER_BORROW_STRINGS);
+  tiny_init(&v);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parser_parse(&p, &v, "{\"s\":\"x\\ty\",\"n\":[1.0,-0]}"));
+  tiny_init(&w);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&w, "{\"n\":[1,0],\"s\":\"x\\u0009y\"}"));
+  EXPECT_TRUE(tiny_is_equal(&v, &w));
+  EXPECT_TRUE(tiny_hash(&v) == tiny_hash(&w));
+  tiny_free(&v);
+  tiny_parser_destroy(&p);
+
+  /* a change anywhere changes the hash */
+  tiny_copy(&v, &w);
+  tiny_set_number(tiny_get_array_element(tiny_find_object_value(&v, "n", 1), 1), 2.0);
+  EXPECT_TRUE(tiny_hash(&v) != tiny_hash(&w));
+  tiny_free(&v);
+  tiny_free(&w);
+
+  /* iterative, like tiny_is_equal() */
+  deep = (char *) malloc(2 * n + 1);
+  for (i = 0; i < n; i++)
+  {
+    deep[i] = '[';
+    deep[n + i] = ']';
+  }
+  deep[2 * n] = '\0';
+  EXPECT_TRUE(test_hash_of(deep) != test_hash_of("[]"));
+  free(deep);
 }
 
 static void test_copy()
@@ -576,6 +1133,26 @@ static void test_copy()
   tiny_free(&v2);
 }
 
+static void test_copy_deep()
+{
+  tiny_value v1, v2, v3;
+  char *json1 = deep_json(100000, "[1,\"x\",{}]");
+  char *json2 = deep_json(100000, "[1,\"y\",{}]");
+  tiny_init(&v1);
+  tiny_init(&v2);
+  tiny_init(&v3);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v1, json1));
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v3, json2));
+  tiny_copy(&v2, &v1);
+  EXPECT_TRUE(tiny_is_equal(&v1, &v2));
+  EXPECT_FALSE(tiny_is_equal(&v1, &v3));
+  tiny_free(&v1);
+  tiny_free(&v2);
+  tiny_free(&v3);
+  free(json1);
+  free(json2);
+}
+
 static void test_move()
 {
   tiny_value v1, v2, v3;
@@ -651,14 +1228,13 @@ static void test_access_array()
   for (i = 0; i < 6; i++)
     EXPECT_EQ_DOUBLE((double) i + 2, tiny_get_number(tiny_get_array_element(&a, i)));
 
-#if 0
-    for (i = 0; i < 2; i++) {
-        tiny_init(&e);
-        tiny_set_number(&e, i);
-        tiny_move(tiny_insert_array_element(&a, i), &e);
-        tiny_free(&e);
-    }
-#endif
+  for (i = 0; i < 2; i++)
+  {
+    tiny_init(&e);
+    tiny_set_number(&e, i);
+    tiny_move(tiny_insert_array_element(&a, i), &e);
+    tiny_free(&e);
+  }
   EXPECT_EQ_SIZE_T(8, tiny_get_array_size(&a));
   for (i = 0; i < 8; i++)
     EXPECT_EQ_DOUBLE((double) i, tiny_get_number(tiny_get_array_element(&a, i)));
@@ -683,77 +1259,1385 @@ static void test_access_array()
   tiny_free(&a);
 }
 
+static void test_access_array_batch()
+{
+  tiny_value a, b, values[3], *e;
+  size_t i;
+  char *json;
+  size_t length;
+
+  tiny_init(&a);
+  tiny_init(&b);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&a, "[1,2,3]"));
+  EXPECT_EQ_SIZE_T(3, tiny_get_array_capacity(&a)); /* parsed arrays can grow */
+  tiny_set_number(tiny_pushback_array_element(&a), 4);
+  EXPECT_EQ_SIZE_T(4, tiny_get_array_size(&a));
+
+  for (i = 0; i < 3; i++)
+  {
+    tiny_init(&values[i]);
+    tiny_set_number(&values[i], 10.0 + i);
+  }
+  tiny_insert_array_values(&a, 1, values, 3);
+  EXPECT_EQ_INT(TINY_NULL, tiny_get_type(&values[0])); /* moved out */
+  tiny_set_string(&values[0], "x", 1);
+  tiny_append_array_values(&a, values, 1);
+  e = tiny_insert_array_elements(&a, 0, 2);
+  tiny_set_boolean(&e[0], 1);
+  EXPECT_EQ_INT(TINY_NULL, tiny_get_type(&e[1]));
+
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&b, "[\"s\",[5],{}]"));
+  tiny_splice_array(&a, 3, &b);
+  EXPECT_EQ_SIZE_T(0, tiny_get_array_size(&b));
+  json = tiny_stringify(&a, &length);
+  EXPECT_EQ_STRING("[true,null,1,\"s\",[5],{},10,11,12,2,3,4,\"x\"]", json, length);
+  free(json);
+
+  tiny_erase_array_element(&a, 2, 4);
+  json = tiny_stringify(&a, &length);
+  EXPECT_EQ_STRING("[true,null,10,11,12,2,3,4,\"x\"]", json, length);
+  free(json);
+
+  tiny_free(&a);
+  tiny_free(&b);
+}
+
 static void test_access_object()
 {
-#if 0
-    tiny_value o, v, *pv;
-    size_t i, j, index;
-
-    tiny_init(&o);
-
-    for (j = 0; j <= 5; j += 5) {
-        tiny_set_object(&o, j);
-        EXPECT_EQ_SIZE_T(0, tiny_get_object_size(&o));
-        EXPECT_EQ_SIZE_T(j, tiny_get_object_capacity(&o));
-        for (i = 0; i < 10; i++) {
-            char key[2] = "a";
-            key[0] += i;
-            tiny_init(&v);
-            tiny_set_number(&v, i);
-            tiny_move(tiny_set_object_value(&o, key, 1), &v);
-            tiny_free(&v);
-        }
-        EXPECT_EQ_SIZE_T(10, tiny_get_object_size(&o));
-        for (i = 0; i < 10; i++) {
-            char key[] = "a";
-            key[0] += i;                                                                          index = tiny_find_object_index(&o, key, 1);
-            EXPECT_TRUE(index != tiny_KEY_NOT_EXIST);
-            pv = tiny_get_object_value(&o, index);
-            EXPECT_EQ_DOUBLE((double)i, tiny_get_number(pv));
-        }
-            }
-
-    index = tiny_find_object_index(&o, "j", 1);▫▫▫▫
-    EXPECT_TRUE(index != tiny_KEY_NOT_EXIST);
-    tiny_remove_object_value(&o, index);
-    index = tiny_find_object_index(&o, "j", 1);
-    EXPECT_TRUE(index == tiny_KEY_NOT_EXIST);
-    EXPECT_EQ_SIZE_T(9, tiny_get_object_size(&o));
-
-    index = tiny_find_object_index(&o, "a", 1);
-    EXPECT_TRUE(index != tiny_KEY_NOT_EXIST);
-    tiny_remove_object_value(&o, index);
-    index = tiny_find_object_index(&o, "a", 1);
-    EXPECT_TRUE(index == tiny_KEY_NOT_EXIST);
-    EXPECT_EQ_SIZE_T(8, tiny_get_object_size(&o));
-
-    EXPECT_TRUE(tiny_get_object_capacity(&o) > 8);
-    tiny_shrink_object(&o);
-    EXPECT_EQ_SIZE_T(8, tiny_get_object_capacity(&o));
-    EXPECT_EQ_SIZE_T(8, tiny_get_object_size(&o));
-    for (i = 0; i < 8; i++) {
-        char key[] = "a";
-        key[0] += i + 1;                                                                      EXPECT_EQ_DOUBLE((double)i + 1, tiny_get_number(tiny_get_object_value(&o, tiny_find_object_index(&o, key, 1))));
+  tiny_value o, v, *pv;
+  size_t i, j, index;
+
+  tiny_init(&o);
+
+  for (j = 0; j <= 5; j += 5)
+  {
+    tiny_set_object(&o, j);
+    EXPECT_EQ_SIZE_T(0, tiny_get_object_size(&o));
+    EXPECT_EQ_SIZE_T(j, tiny_get_object_capacity(&o));
+    for (i = 0; i < 10; i++)
+    {
+      char key[2] = "a";
+      key[0] += i;
+      tiny_init(&v);
+      tiny_set_number(&v, i);
+      tiny_move(tiny_set_object_value(&o, key, 1), &v);
+      tiny_free(&v);
+    }
+    EXPECT_EQ_SIZE_T(10, tiny_get_object_size(&o));
+    for (i = 0; i < 10; i++)
+    {
+      char key[] = "a";
+      key[0] += i;
+      index = tiny_find_object_index(&o, key, 1);
+      EXPECT_TRUE(index != TINY_KEY_NOT_EXIST);
+      pv = tiny_get_object_value(&o, index);
+      EXPECT_EQ_DOUBLE((double) i, tiny_get_number(pv));
     }
-        tiny_set_string(&v, "Hello", 5);
-    tiny_move(tiny_set_object_value(&o, "World", 5), &v); /* Test if element is freed */
+  }
+
+  index = tiny_find_object_index(&o, "j", 1);
+  EXPECT_TRUE(index != TINY_KEY_NOT_EXIST);
+  tiny_remove_object_value(&o, index);
+  index = tiny_find_object_index(&o, "j", 1);
+  EXPECT_TRUE(index == TINY_KEY_NOT_EXIST);
+  EXPECT_EQ_SIZE_T(9, tiny_get_object_size(&o));
+
+  index = tiny_find_object_index(&o, "a", 1);
+  EXPECT_TRUE(index != TINY_KEY_NOT_EXIST);
+  tiny_remove_object_value(&o, index);
+  index = tiny_find_object_index(&o, "a", 1);
+  EXPECT_TRUE(index == TINY_KEY_NOT_EXIST);
+  EXPECT_EQ_SIZE_T(8, tiny_get_object_size(&o));
+
+  EXPECT_TRUE(tiny_get_object_capacity(&o) > 8);
+  tiny_shrink_object(&o);
+  EXPECT_EQ_SIZE_T(8, tiny_get_object_capacity(&o));
+  EXPECT_EQ_SIZE_T(8, tiny_get_object_size(&o));
+  for (i = 0; i < 8; i++)
+  {
+    char key[] = "a";
+    key[0] += i + 1;
+    EXPECT_EQ_DOUBLE((double) i + 1, tiny_get_number(tiny_get_object_value(&o, tiny_find_object_index(&o, key, 1))));
+  }
+
+  tiny_init(&v);
+  tiny_set_string(&v, "Hello", 5);
+  tiny_move(tiny_set_object_value(&o, "World", 5), &v); /* Test if element is freed */
+  tiny_free(&v);
+
+  pv = tiny_find_object_value(&o, "World", 5);
+  EXPECT_TRUE(pv != NULL);
+  EXPECT_EQ_STRING("Hello", tiny_get_string(pv), tiny_get_string_length(pv));
+
+  /* swap-remove moves the last member into the hole */
+  index = tiny_find_object_index(&o, "b", 1);
+  tiny_swap_remove_object_value(&o, index);
+  EXPECT_EQ_SIZE_T(8, tiny_get_object_size(&o));
+  EXPECT_EQ_STRING("World", tiny_get_object_key(&o, index), tiny_get_object_key_length(&o, index));
+  EXPECT_TRUE(tiny_find_object_index(&o, "b", 1) == TINY_KEY_NOT_EXIST);
+  tiny_swap_remove_object_value(&o, tiny_get_object_size(&o) - 1);
+  EXPECT_EQ_SIZE_T(7, tiny_get_object_size(&o));
+
+  i = tiny_get_object_capacity(&o);
+  tiny_clear_object(&o);
+  EXPECT_EQ_SIZE_T(0, tiny_get_object_size(&o));
+  EXPECT_EQ_SIZE_T(i, tiny_get_object_capacity(&o)); /* capacity remains unchanged */
+  tiny_shrink_object(&o);
+  EXPECT_EQ_SIZE_T(0, tiny_get_object_capacity(&o));
+
+  /* parsed objects can grow */
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&o, "{\"a\":1,\"b\":2}"));
+  EXPECT_EQ_SIZE_T(2, tiny_get_object_capacity(&o));
+  tiny_set_boolean(tiny_set_object_value(&o, "c", 1), 1);
+  EXPECT_EQ_SIZE_T(3, tiny_get_object_size(&o));
+  EXPECT_TRUE(tiny_get_boolean(tiny_find_object_value(&o, "c", 1)));
+  EXPECT_EQ_DOUBLE(1.0, tiny_get_number(tiny_set_object_value(&o, "a", 1))); /* existing member */
+  EXPECT_EQ_SIZE_T(3, tiny_get_object_size(&o));
+
+  tiny_free(&o);
+}
+
+typedef struct
+{
+  size_t calls;
+  long live;
+} test_alloc_state;
+
+static void *test_malloc(void *ud, size_t size)
+{
+  test_alloc_state *s = (test_alloc_state *) ud;
+  s->calls++;
+  s->live++;
+  return malloc(size);
+}
+
+static void *test_realloc(void *ud, void *ptr, size_t old_size, size_t new_size)
+{
+  test_alloc_state *s = (test_alloc_state *) ud;
+  (void) old_size;
+  s->calls++;
+  if (ptr == NULL)
+    s->live++;
+  if (new_size == 0)
+  {
+    if (ptr != NULL)
+      s->live--;
+    free(ptr);
+    return NULL;
+  }
+  return realloc(ptr, new_size);
+}
+
+static void test_free(void *ud, void *ptr)
+{
+  test_alloc_state *s = (test_alloc_state *) ud;
+  if (ptr != NULL)
+    s->live--;
+  free(ptr);
+}
+
+static void test_allocator()
+{
+  test_alloc_state state = {0, 0};
+  tiny_allocator a = {test_malloc, test_realloc, test_free, NULL};
+  tiny_value v, s;
+  char *json;
+  size_t length;
+  a.ud = &state;
+
+  tiny_init(&v);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse_ex(&v, "{\"a\":[1,\"x\",{\"b\":null}],\"c\":\"yz\"}", &a));
+  EXPECT_TRUE(state.calls > 0);
+  json = tiny_stringify_ex(&v, &length, &a);
+  EXPECT_EQ_STRING("{\"a\":[1,\"x\",{\"b\":null}],\"c\":\"yz\"}", json, length);
+  test_free(&state, json);
+  tiny_init(&s);
+  tiny_copy_ex(&s, tiny_get_object_value(&v, 1), &a);
+  EXPECT_EQ_STRING("yz", tiny_get_string(&s), tiny_get_string_length(&s));
+  tiny_free_ex(&s, &a);
+  tiny_free_ex(&v, &a);
+  EXPECT_EQ_INT(0, (int) state.live);
+
+  /* global installation */
+  state.calls = 0;
+  tiny_set_allocator(&a);
+  EXPECT_TRUE(tiny_get_allocator() == &a);
+  tiny_init(&v);
+  tiny_set_array(&v, 0);
+  tiny_set_string(tiny_pushback_array_element(&v), "abc", 3);
+  tiny_shrink_array(&v);
+  tiny_free(&v);
+  tiny_set_allocator(NULL);
+  EXPECT_TRUE(state.calls > 0);
+  EXPECT_EQ_INT(0, (int) state.live);
+}
+
+static void test_allocator_mutation()
+{
+  test_alloc_state state = {0, 0};
+  tiny_allocator a = {test_malloc, test_realloc, test_free, NULL};
+  tiny_parser p;
+  tiny_value v, w, patch, *e;
+  char *json;
+  size_t length, calls;
+  a.ud = &state;
+
+  tiny_init(&v);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse_ex(&v, "[1,2,3]", &a));
+  calls = state.calls;
+  tiny_set_string_ex(tiny_pushback_array_element_ex(&v, &a), "abc", 3, &a);
+  EXPECT_TRUE(state.calls > calls); /* growth went through a */
+  e = tiny_insert_array_element_ex(&v, 0, &a);
+  tiny_set_object_ex(e, 0, &a);
+  tiny_set_number_ex(tiny_set_object_value_ex(e, "k", 1, &a), 1.0, &a);
+  tiny_set_boolean_ex(tiny_set_object_value_ex(e, "t", 1, &a), 1, &a);
+  tiny_remove_object_value_ex(e, 1, &a);
+  tiny_erase_array_element_ex(&v, 1, 2, &a);
+  tiny_shrink_array_ex(&v, &a);
+  json = tiny_stringify_ex(&v, &length, &a);
+  EXPECT_EQ_STRING("[{\"k\":1},3,\"abc\"]", json, length);
+  test_free(&state, json);
+
+  /* a compact clone moved apart and patched */
+  tiny_init(&w);
+  tiny_copy_compact_ex(&w, &v, &a);
+  tiny_move_ex(tiny_pushback_array_element_ex(&v, &a), tiny_get_array_element(&w, 0), &a);
+  tiny_free_ex(&w, &a);
+  tiny_init(&patch);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&patch, "[{\"op\":\"add\",\"path\":\"/0/x\",\"value\":[true]},{\"op\":\"move\",\"from\":\"/1\",\"path\":\"/-\"}]"));
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_apply_patch_ex(&v, &patch, &a));
+  tiny_free(&patch);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&patch, "{\"k\":null,\"y\":{\"z\":\"s\"}}"));
+  tiny_apply_merge_patch_ex(tiny_get_array_element(&v, 0), &patch, &a);
+  tiny_free(&patch);
+  json = tiny_stringify_ex(&v, &length, &a);
+  EXPECT_EQ_STRING("[{\"x\":[true],\"y\":{\"z\":\"s\"}},\"abc\",{\"k\":1},3]", json, length);
+  test_free(&state, json);
+  tiny_init(&w);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse_ex(&w, "[{\"y\":1},\"abc\"]", &a));
+  tiny_diff_ex(&patch, &w, &v, &a);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_apply_patch_ex(&w, &patch, &a));
+  EXPECT_TRUE(tiny_is_equal(&w, &v));
+  tiny_free_ex(&patch, &a);
+  tiny_free_ex(&w, &a);
+  tiny_free_ex(&v, &a);
+  EXPECT_EQ_INT(0, (int) state.live);
+
+  /* a borrowing parser with its own allocator decodes escapes while parsing */
+  tiny_parser_init(&p, &a);
+  tiny_parser_set_flags(&p, TINY_PARSER_BORROW_STRINGS | TINY_PARSER_LAZY_NUMBERS);
+  tiny_init(&v);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parser_parse(&p, &v, "{\"s\":\"a\\nb\",\"v\":\"cd\",\"n\":[1.5]}"));
+  EXPECT_EQ_STRING("a\nb", tiny_get_string(tiny_get_object_value(&v, 0)), tiny_get_string_length(tiny_get_object_value(&v, 0)));
+  tiny_materialize_ex(&v, &a);
+  tiny_set_string_ex(tiny_set_object_value_ex(&v, "w", 1, &a), "ef", 2, &a);
+  EXPECT_EQ_STRING("cd", tiny_get_string(tiny_get_object_value(&v, 1)), tiny_get_string_length(tiny_get_object_value(&v, 1)));
+  tiny_free_ex(&v, &a);
+  tiny_parser_destroy(&p);
+  EXPECT_EQ_INT(0, (int) state.live);
+}
+
+static void test_reuse()
+{
+  tiny_parser p;
+  tiny_stringifier s;
+  tiny_value v;
+  const char *json;
+  size_t length, size;
+  int i;
+
+  tiny_parser_init(&p, NULL);
+  tiny_stringifier_init(&s, NULL);
+  for (i = 0; i < 3; i++)
+  {
+    tiny_init(&v);
+    EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parser_parse(&p, &v, "[\"abc\",{\"k\":[1,2]},null]"));
+    json = tiny_stringifier_run(&s, &v, &length);
+    EXPECT_EQ_STRING("[\"abc\",{\"k\":[1,2]},null]", json, length);
     tiny_free(&v);
+  }
+  size = p.size;
+  EXPECT_TRUE(size > 0);
+  tiny_init(&v);
+  EXPECT_EQ_INT(TINY_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, tiny_parser_parse(&p, &v, "[1"));
+  EXPECT_EQ_SIZE_T(size, p.size); /* no regrowth */
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parser_parse(&p, &v, "\"x\""));
+  tiny_free(&v);
 
-    pv = tiny_find_object_value(&o, "World", 5);
-    EXPECT_TRUE(pv != NULL);
-    EXPECT_EQ_STRING("Hello", tiny_get_string(pv), tiny_get_string_length(pv));
+  tiny_parser_reset(&p, 0);
+  EXPECT_EQ_SIZE_T(0, p.size);
+  tiny_stringifier_reset(&s, 16);
+  EXPECT_TRUE(s.size <= 16);
+  tiny_init(&v);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parser_parse(&p, &v, "[true,false]"));
+  json = tiny_stringifier_run(&s, &v, &length);
+  EXPECT_EQ_STRING("[true,false]", json, length);
+  tiny_free(&v);
+  tiny_parser_destroy(&p);
+  tiny_stringifier_destroy(&s);
+}
 
-    i = tiny_get_object_capacity(&o);
-    tiny_clear_object(&o);
-    EXPECT_EQ_SIZE_T(0, tiny_get_object_size(&o));
-    EXPECT_EQ_SIZE_T(i, tiny_get_object_capacity(&o)); /* capacity remains unchanged */
-    tiny_shrink_object(&o);
-    EXPECT_EQ_SIZE_T(0, tiny_get_object_capacity(&o));
+#define TEST_LAZY_NUMBER(expect, json)                             \
+  do                                                               \
+  {                                                                \
+    tiny_value v;                                                  \
+    tiny_init(&v);                                                 \
+    EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parser_parse(&p, &v, json)); \
+    EXPECT_EQ_INT(TINY_NUMBER, tiny_get_type(&v));                 \
+    EXPECT_EQ_DOUBLE(expect, tiny_get_number(&v));                 \
+    tiny_free(&v);                                                 \
+  } while (0)
 
-    tiny_free(&o);
-#endif
+static void test_lazy_number()
+{
+  const char *json = "[1.10, 2E+0,-0,12345678901234567890,{\"k\":0.1000}]";
+  tiny_parser p;
+  tiny_value v, copy, eager;
+  const char *text;
+  char *out;
+  size_t length, elength;
+
+  tiny_parser_init(&p, NULL);
+  tiny_parser_set_flags(&p, TINY_PARSER_LAZY_NUMBERS);
+  TEST_LAZY_NUMBER(0.0, "0");
+  TEST_LAZY_NUMBER(-1.0, "-1");
+  TEST_LAZY_NUMBER(123456789012345.0, "123456789012345");
+  TEST_LAZY_NUMBER(12345678901234567890.0, "12345678901234567890");
+  TEST_LAZY_NUMBER(3.1416, "3.1416");
+  TEST_LAZY_NUMBER(-1.234E-10, "-1.234E-10");
+  TEST_LAZY_NUMBER(1.0000000000000002, "1.0000000000000002");
+  TEST_LAZY_NUMBER(1.7976931348623157e+308, "1.7976931348623157e+308");
+  tiny_init(&v);
+  EXPECT_EQ_INT(TINY_PARSE_NUMBER_TOO_BIG, tiny_parser_parse(&p, &v, "[1,1e309]"));
+  EXPECT_EQ_INT(TINY_PARSE_ROOT_NOT_SINGULAR, tiny_parser_parse(&p, &v, "01"));
+
+  /* untouched numbers keep their text */
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parser_parse(&p, &v, json));
+  out = tiny_stringify(&v, &length);
+  EXPECT_EQ_STRING("[1.10,2E+0,-0,12345678901234567890,{\"k\":0.1000}]", out, length);
+  free(out);
+  text = tiny_get_number_text(tiny_get_array_element(&v, 3), &length);
+  EXPECT_EQ_STRING("12345678901234567890", text, length);
+  EXPECT_EQ_DOUBLE(1.1, tiny_get_number(tiny_get_array_element(&v, 0)));
+  EXPECT_EQ_SIZE_T(48, tiny_stringify_size(&v));
+
+  /* reading does not change the output; copies share the text */
+  tiny_init(&copy);
+  tiny_copy(&copy, &v);
+  out = tiny_stringify(&copy, &length);
+  EXPECT_EQ_STRING("[1.10,2E+0,-0,12345678901234567890,{\"k\":0.1000}]", out, length);
+  free(out);
+  tiny_init(&eager);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&eager, json));
+  EXPECT_TRUE(tiny_is_equal(&eager, &copy));
+  out = tiny_encode_msgpack(&copy, &length);
+  text = tiny_encode_msgpack(&eager, &elength);
+  EXPECT_TRUE(length == elength && memcmp(out, text, length) == 0);
+  free(out);
+  free((char *) text);
+
+  /* set and materialize drop the text */
+  tiny_set_number(tiny_get_array_element(&copy, 0), 2.5);
+  EXPECT_TRUE(tiny_get_number_text(tiny_get_array_element(&copy, 0), NULL) == NULL);
+  tiny_materialize(&v);
+  EXPECT_TRUE(tiny_get_number_text(tiny_get_array_element(&v, 3), NULL) == NULL);
+  EXPECT_EQ_DOUBLE(0.1, tiny_get_number(tiny_get_object_value(tiny_get_array_element(&v, 4), 0)));
+  EXPECT_TRUE(tiny_is_equal(&eager, &v));
+  out = tiny_stringify(&v, &length);
+  EXPECT_EQ_STRING("[1.1000000000000001,2,-0,1.2345678901234567e+19,{\"k\":0.10000000000000001}]", out, length);
+  free(out);
+  tiny_free(&v);
+  tiny_free(&copy);
+  tiny_free(&eager);
+  tiny_parser_destroy(&p);
+}
+
+static void test_borrow_strings()
+{
+  const char *json = "{\"a\":\"x\\ty\",\"name\":\"plain\",\"list\":[\"\\u00e9\",\"\"]}";
+  tiny_parser p;
+  tiny_value v, copy, eager;
+  const tiny_value *e;
+  char *out;
+  size_t length;
+
+  tiny_parser_init(&p, NULL);
+  tiny_parser_set_flags(&p, TINY_PARSER_BORROW_STRINGS);
+  tiny_init(&v);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parser_parse(&p, &v, json));
+  e = tiny_find_object_value(&v, "name", 4);
+  EXPECT_TRUE(tiny_get_string(e) == json + 20); /* a view, not a copy */
+  EXPECT_EQ_STRING("plain", tiny_get_string(e), tiny_get_string_length(e));
+  EXPECT_TRUE(tiny_get_object_key(&v, 1) == json + 13);
+
+  /* untouched escapes are written back as they were */
+  out = tiny_stringify(&v, &length);
+  EXPECT_EQ_STRING("{\"a\":\"x\\ty\",\"name\":\"plain\",\"list\":[\"\\u00e9\",\"\"]}", out, length);
+  free(out);
+  e = tiny_get_array_element(tiny_find_object_value(&v, "list", 4), 0);
+  EXPECT_EQ_STRING("\xC3\xA9", tiny_get_string(e), tiny_get_string_length(e));
+  out = tiny_stringify(&v, &length);
+  EXPECT_EQ_STRING("{\"a\":\"x\\ty\",\"name\":\"plain\",\"list\":[\"\xC3\xA9\",\"\"]}", out, length);
+  free(out);
+
+  tiny_init(&eager);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&eager, json));
+  EXPECT_TRUE(tiny_is_equal(&eager, &v));
+  out = tiny_encode_msgpack(&v, &length);
+  tiny_init(&copy);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_decode_msgpack(&copy, out, length));
+  EXPECT_TRUE(tiny_is_equal(&eager, &copy));
+  free(out);
+  tiny_free(&copy);
+  tiny_copy(&copy, &v);
+  EXPECT_EQ_STRING("x\ty", tiny_get_string(tiny_get_object_value(&copy, 0)), tiny_get_string_length(tiny_get_object_value(&copy, 0)));
+  EXPECT_EQ_STRING("name", tiny_get_object_key(&copy, 1), 4);
+  EXPECT_EQ_INT('\0', tiny_get_object_key(&copy, 1)[4]);
+  tiny_free(&copy);
+  tiny_copy_compact(&copy, &v);
+  EXPECT_TRUE(tiny_is_equal(&eager, &copy));
+  tiny_free(&copy);
+
+  /* mutation copies the keys out first */
+  tiny_set_number(tiny_set_object_value(&v, "n", 1), 1.0);
+  tiny_remove_object_value(&v, 0);
+  EXPECT_EQ_SIZE_T(3, tiny_get_object_size(&v));
+  EXPECT_EQ_STRING("name", tiny_get_object_key(&v, 0), 4);
+  EXPECT_EQ_INT('\0', tiny_get_object_key(&v, 0)[4]);
+  tiny_free(&v);
+
+  /* an escaped key makes the whole object own its keys */
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parser_parse(&p, &v, "{\"a\":1,\"b\\n\":2,\"c\":3}"));
+  EXPECT_EQ_STRING("b\n", tiny_get_object_key(&v, 1), tiny_get_object_key_length(&v, 1));
+  EXPECT_EQ_STRING("c", tiny_get_object_key(&v, 2), 1);
+  tiny_free(&v);
+  EXPECT_EQ_INT(TINY_PARSE_INVALID_STRING_ESCAPE, tiny_parser_parse(&p, &v, "{\"a\":\"b\",\"c\\x\":1}"));
+  EXPECT_EQ_INT(TINY_PARSE_MISS_QUOTATION_MARK, tiny_parser_parse(&p, &v, "[\"ab\\n"));
+  EXPECT_EQ_INT(TINY_PARSE_INVALID_STRING_CHAR, tiny_parser_parse(&p, &v, "{\"a\x01\":1}"));
+
+  /* materialize lets the input go */
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parser_parse(&p, &v, json));
+  tiny_materialize(&v);
+  EXPECT_TRUE(tiny_get_string(tiny_find_object_value(&v, "name", 4)) != json + 20);
+  EXPECT_EQ_INT('\0', tiny_get_object_key(&v, 1)[4]);
+  EXPECT_TRUE(tiny_is_equal(&eager, &v));
+  tiny_free(&v);
+  tiny_free(&eager);
+  tiny_parser_destroy(&p);
+}
+
+/* seq placed at every offset of a 16-byte block, as a string and as a key */
+static void test_utf8_case(int expect, const char *seq)
+{
+  static const unsigned modes[2] = {TINY_PARSER_VALIDATE_UTF8, TINY_PARSER_VALIDATE_UTF8 | TINY_PARSER_BORROW_STRINGS};
+  tiny_parser p;
+  tiny_value v;
+  char json[128];
+  int i, m;
+  tiny_parser_init(&p, NULL);
+  for (m = 0; m < 2; m++)
+  {
+    tiny_parser_set_flags(&p, modes[m]);
+    for (i = 0; i < 32; i++)
+    {
+      tiny_init(&v);
+      sprintf(json, "[\"%.*s%s%s\"]", i, "................................", seq, "0123456789abcdef0123");
+      EXPECT_EQ_INT(expect, tiny_parser_parse(&p, &v, json));
+      tiny_free(&v);
+      sprintf(json, "{\"%.*s%s\":1}", i, "................................", seq);
+      EXPECT_EQ_INT(expect, tiny_parser_parse(&p, &v, json));
+      tiny_free(&v);
+    }
+  }
+  tiny_parser_destroy(&p);
+}
+
+static void test_validate_utf8()
+{
+  tiny_value v;
+  test_utf8_case(TINY_PARSE_OK, "");
+  test_utf8_case(TINY_PARSE_OK, "\xC2\x80");
+  test_utf8_case(TINY_PARSE_OK, "\xC3\xA9\\n\xDF\xBF");
+  test_utf8_case(TINY_PARSE_OK, "\xE0\xA0\x80");
+  test_utf8_case(TINY_PARSE_OK, "\xE2\x82\xAC\xE2\x82\xAC\xE2\x82\xAC\xE2\x82\xAC\xE2\x82\xAC\xE2\x82\xAC");
+  test_utf8_case(TINY_PARSE_OK, "\xED\x9F\xBF");
+  test_utf8_case(TINY_PARSE_OK, "\xEE\x80\x80\xEF\xBF\xBF");
+  test_utf8_case(TINY_PARSE_OK, "\xF0\x90\x80\x80");
+  test_utf8_case(TINY_PARSE_OK, "\xF0\x9F\x98\x80\xF3\xBF\xBF\xBF");
+  test_utf8_case(TINY_PARSE_OK, "\xF4\x8F\xBF\xBF");
+  test_utf8_case(TINY_PARSE_OK, "\\uD834\\uDD1E");
+
+  test_utf8_case(TINY_PARSE_INVALID_UTF8, "\x80");
+  test_utf8_case(TINY_PARSE_INVALID_UTF8, "\xBF");
+  test_utf8_case(TINY_PARSE_INVALID_UTF8, "\xC0\xAF"); /* overlong */
+  test_utf8_case(TINY_PARSE_INVALID_UTF8, "\xC1\xBF");
+  test_utf8_case(TINY_PARSE_INVALID_UTF8, "\xE0\x80\xAF");
+  test_utf8_case(TINY_PARSE_INVALID_UTF8, "\xE0\x9F\xBF");
+  test_utf8_case(TINY_PARSE_INVALID_UTF8, "\xF0\x80\x80\xAF");
+  test_utf8_case(TINY_PARSE_INVALID_UTF8, "\xF0\x8F\xBF\xBF");
+  test_utf8_case(TINY_PARSE_INVALID_UTF8, "\xED\xA0\x80"); /* surrogate */
+  test_utf8_case(TINY_PARSE_INVALID_UTF8, "\xED\xBF\xBF");
+  test_utf8_case(TINY_PARSE_INVALID_UTF8, "\xF4\x90\x80\x80"); /* above U+10FFFF */
+  test_utf8_case(TINY_PARSE_INVALID_UTF8, "\xF5\x80\x80\x80");
+  test_utf8_case(TINY_PARSE_INVALID_UTF8, "\xF8\x88\x80\x80\x80");
+  test_utf8_case(TINY_PARSE_INVALID_UTF8, "\xFF");
+  test_utf8_case(TINY_PARSE_INVALID_UTF8, "\xC3"); /* truncated */
+  test_utf8_case(TINY_PARSE_INVALID_UTF8, "\xC3\\n");
+  test_utf8_case(TINY_PARSE_INVALID_UTF8, "\xE2\x82");
+  test_utf8_case(TINY_PARSE_INVALID_UTF8, "\xF0\x9F\x98");
+  test_utf8_case(TINY_PARSE_INVALID_UTF8, "\xC3\xA9\xA9"); /* stray continuation */
+  test_utf8_case(TINY_PARSE_INVALID_UTF8, "\xE2\x82\xAC\x82");
+  test_utf8_case(TINY_PARSE_INVALID_UNICODE_SURROGATE, "\\uDC00");
+
+  /* without the flag nothing changes */
+  tiny_init(&v);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v, "[\"\xC0\xAF\",\"\\uDC00\"]"));
+  tiny_free(&v);
+}
+
+typedef struct
+{
+  int count, stop_at;
+  int ret[8];
+  size_t begin[8], end[8];
+  tiny_value kept;
+  char text[256];
+} test_batch;
+
+static int test_batch_document(void *ud, tiny_value *v, int ret, size_t begin, size_t end)
+{
+  test_batch *b = (test_batch *) ud;
+  char *json;
+  size_t length;
+  b->ret[b->count] = ret;
+  b->begin[b->count] = begin;
+  b->end[b->count] = end;
+  if (ret == TINY_PARSE_OK)
+  {
+    json = tiny_stringify(v, &length);
+    strcat(b->text, json);
+    free(json);
+    if (b->count == 0)
+      tiny_move(&b->kept, v);
+  }
+  else
+  {
+    EXPECT_EQ_INT(TINY_NULL, tiny_get_type(v));
+  }
+  strcat(b->text, "|");
+  return ++b->count == b->stop_at;
+}
+
+static void test_parse_many()
+{
+  test_batch b;
+  tiny_parser p;
+  const char *json = "{\"a\":[1,\"x\"]} [2,3]\n\"s\"4 {\"bad\":} true[5]";
+  char *text;
+
+  memset(&b, 0, sizeof(b));
+  tiny_init(&b.kept);
+  EXPECT_EQ_INT(TINY_PARSE_INVALID_VALUE, tiny_parse_many(json, strlen(json), test_batch_document, &b));
+  EXPECT_EQ_INT(7, b.count);
+  EXPECT_EQ_STRING("{\"a\":[1,\"x\"]}|[2,3]|\"s\"|4||true|[5]|", b.text, strlen(b.text));
+  EXPECT_EQ_SIZE_T(0, b.begin[0]);
+  EXPECT_EQ_SIZE_T(13, b.end[0]);
+  EXPECT_EQ_SIZE_T(14, b.begin[1]);
+  EXPECT_EQ_SIZE_T(19, b.end[1]);
+  EXPECT_EQ_SIZE_T(23, b.begin[3]); /* no separator needed after a string */
+  EXPECT_EQ_SIZE_T(24, b.end[3]);
+  EXPECT_EQ_INT(TINY_PARSE_INVALID_VALUE, b.ret[4]);
+  EXPECT_EQ_SIZE_T(25, b.begin[4]); /* the bad document is skipped as a whole */
+  EXPECT_EQ_SIZE_T(33, b.end[4]);
+  EXPECT_EQ_SIZE_T(38, b.begin[6]);
+  EXPECT_EQ_SIZE_T(41, b.end[6]);
+  EXPECT_EQ_SIZE_T(2, tiny_get_array_size(tiny_find_object_value(&b.kept, "a", 1))); /* moved out */
+  tiny_free(&b.kept);
+
+  /* the buffer is not NUL-terminated; stopping early */
+  memset(&b, 0, sizeof(b));
+  b.stop_at = 2;
+  tiny_parser_init(&p, NULL);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parser_parse_many(&p, "1 2 3 456", 8, test_batch_document, &b));
+  EXPECT_EQ_INT(2, b.count);
+  EXPECT_EQ_STRING("1|2|", b.text, strlen(b.text));
+  memset(&b, 0, sizeof(b));
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parser_parse_many(&p, "1 2 3 456", 8, test_batch_document, &b));
+  EXPECT_EQ_STRING("1|2|3|45|", b.text, strlen(b.text));
+  tiny_free(&b.kept);
+
+  /* borrowed values point into the buffer; the document running to its end is materialized */
+  tiny_parser_set_flags(&p, TINY_PARSER_LAZY_NUMBERS | TINY_PARSER_BORROW_STRINGS);
+  text = (char *) malloc(21);
+  memcpy(text, "[\"ab\",12] {\"k\":3}\n789", 21);
+  memset(&b, 0, sizeof(b));
+  tiny_init(&b.kept);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parser_parse_many(&p, text, 21, test_batch_document, &b));
+  EXPECT_EQ_STRING("[\"ab\",12]|{\"k\":3}|789|", b.text, strlen(b.text));
+  EXPECT_TRUE(tiny_get_string(tiny_get_array_element(&b.kept, 0)) == text + 2);
+  tiny_free(&b.kept);
+  memset(&b, 0, sizeof(b));
+  tiny_init(&b.kept);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parser_parse_many(&p, text, 9, test_batch_document, &b));
+  memset(text, 0, 21);
+  free(text);
+  EXPECT_EQ_STRING("ab", tiny_get_string(tiny_get_array_element(&b.kept, 0)), 2);
+  EXPECT_EQ_DOUBLE(12.0, tiny_get_number(tiny_get_array_element(&b.kept, 1)));
+  tiny_free(&b.kept);
+  tiny_parser_set_flags(&p, 0);
+
+  /* garbage between documents, an embedded NUL, an unterminated string */
+  memset(&b, 0, sizeof(b));
+  EXPECT_EQ_INT(TINY_PARSE_INVALID_VALUE, tiny_parser_parse_many(&p, "[1] ]x {\"k\":\"}\"} \0[2] \"ab", 25, test_batch_document, &b));
+  EXPECT_EQ_STRING("[1]|||{\"k\":\"}\"}||[2]||", b.text, strlen(b.text));
+  EXPECT_EQ_SIZE_T(5, b.end[1]);
+  EXPECT_EQ_SIZE_T(6, b.end[2]);
+  EXPECT_EQ_INT(TINY_PARSE_EXPECT_VALUE, b.ret[4]);
+  EXPECT_EQ_INT(TINY_PARSE_MISS_QUOTATION_MARK, b.ret[6]);
+  EXPECT_EQ_SIZE_T(25, b.end[6]);
+  tiny_free(&b.kept);
+
+  memset(&b, 0, sizeof(b));
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parser_parse_many(&p, " \n ", 3, test_batch_document, &b));
+  EXPECT_EQ_INT(0, b.count);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parser_parse_many(&p, NULL, 0, test_batch_document, &b));
+  tiny_parser_destroy(&p);
+}
+
+static void test_copy_compact()
+{
+  test_alloc_state state = {0, 0};
+  tiny_allocator a = {test_malloc, test_realloc, test_free, NULL};
+  const char *json = "{\"n\":null,\"s\":\"abc\",\"a\":[1,[],{},[\"x\",{\"k\":\"v\"}]],\"o\":{\"1\":true}}";
+  tiny_value v1, v2, v3, v4, v5, *e;
+  char *json2;
+  size_t length;
+  a.ud = &state;
+
+  tiny_init(&v1);
+  tiny_init(&v2);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v1, json));
+  tiny_copy_compact_ex(&v2, &v1, &a);
+  EXPECT_EQ_INT(1, (int) state.live); /* one block */
+  EXPECT_TRUE(tiny_is_equal(&v1, &v2));
+  json2 = tiny_stringify(&v2, &length);
+  EXPECT_EQ_STRING("{\"n\":null,\"s\":\"abc\",\"a\":[1,[],{},[\"x\",{\"k\":\"v\"}]],\"o\":{\"1\":true}}", json2, length);
+  free(json2);
+  tiny_free_ex(&v2, &a);
+  EXPECT_EQ_INT(0, (int) state.live);
+
+  /* the clone stays mutable */
+  tiny_init(&v3);
+  tiny_copy_compact(&v2, &v1);
+  e = tiny_find_object_value(&v2, "a", 1);
+  tiny_set_string(tiny_pushback_array_element(e), "y", 1); /* inner node leaves the block */
+  tiny_set_number(tiny_get_array_element(e, 0), 2.0);
+  tiny_set_string(tiny_find_object_value(&v2, "s", 1), "def", 3);
+  tiny_copy(&v3, &v2);
+  EXPECT_TRUE(tiny_is_equal(&v2, &v3));
+  EXPECT_FALSE(tiny_is_equal(&v1, &v2));
+  EXPECT_EQ_DOUBLE(1.0, tiny_get_number(tiny_get_array_element(tiny_find_object_value(&v1, "a", 1), 0)));
+  EXPECT_EQ_SIZE_T(5, tiny_get_array_size(e));
+  tiny_free(&v2);
+
+  /* values moved out of the clone outlive it */
+  tiny_init(&v4);
+  tiny_init(&v5);
+  tiny_copy_compact(&v2, &v1);
+  e = tiny_find_object_value(&v2, "a", 1);
+  tiny_set_number(tiny_pushback_array_element(e), 5.0); /* e leaves the block, and so do its children */
+  tiny_move(&v3, tiny_get_array_element(e, 3));
+  tiny_move(&v4, tiny_find_object_value(&v2, "o", 1));
+  tiny_free(&v2);
+  json2 = tiny_stringify(&v3, &length);
+  EXPECT_EQ_STRING("[\"x\",{\"k\":\"v\"}]", json2, length);
+  free(json2);
+  json2 = tiny_stringify(&v4, &length);
+  EXPECT_EQ_STRING("{\"1\":true}", json2, length);
+  free(json2);
+
+  tiny_copy_compact(&v2, &v1);
+  e = tiny_find_object_value(&v2, "a", 1);
+  tiny_set_array(&v5, 0);
+  tiny_splice_array(&v5, 0, tiny_get_array_element(e, 3));
+  tiny_append_array_values(&v5, tiny_get_array_element(e, 0), 2);
+  tiny_set_string(tiny_pushback_array_element(&v5), "z", 1);
+  tiny_swap(tiny_get_array_element(&v5, 4), tiny_find_object_value(&v2, "s", 1));
+  tiny_free(&v2);
+  json2 = tiny_stringify(&v5, &length);
+  EXPECT_EQ_STRING("[\"x\",{\"k\":\"v\"},1,[],\"abc\"]", json2, length);
+  free(json2);
+  tiny_free(&v4);
+  tiny_free(&v5);
+
+  tiny_set_array(&v1, 0);
+  tiny_set_string(tiny_pushback_array_element(&v1), "a", 1);
+  tiny_copy_compact(&v2, &v1);
+  tiny_set_boolean(tiny_pushback_array_element(&v2), 1); /* root leaves the block */
+  EXPECT_EQ_SIZE_T(2, tiny_get_array_size(&v2));
+  EXPECT_EQ_STRING("a", tiny_get_string(tiny_get_array_element(&v2, 0)), tiny_get_string_length(tiny_get_array_element(&v2, 0)));
+  tiny_free(&v1);
+  tiny_free(&v2);
+  tiny_free(&v3);
+}
+
+#define TEST_MSGPACK_ROUNDTRIP(json)                                      \
+  do                                                                      \
+  {                                                                       \
+    tiny_value v1, v2;                                                    \
+    char *bin, *json2;                                                    \
+    size_t blength, length;                                               \
+    tiny_init(&v1);                                                       \
+    tiny_init(&v2);                                                       \
+    EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v1, json));                  \
+    bin = tiny_encode_msgpack(&v1, &blength);                             \
+    EXPECT_EQ_INT(TINY_PARSE_OK, tiny_decode_msgpack(&v2, bin, blength)); \
+    EXPECT_TRUE(tiny_is_equal(&v1, &v2));                                 \
+    json2 = tiny_stringify(&v2, &length);                                 \
+    EXPECT_EQ_STRING(json, json2, length);                                \
+    free(bin);                                                            \
+    free(json2);                                                          \
+    tiny_free(&v1);                                                       \
+    tiny_free(&v2);                                                       \
+  } while (0)
+
+#define TEST_MSGPACK_ERROR(error, bin)                                   \
+  do                                                                     \
+  {                                                                      \
+    tiny_value v;                                                        \
+    tiny_init(&v);                                                       \
+    v.type = TINY_FALSE;                                                 \
+    EXPECT_EQ_INT(error, tiny_decode_msgpack(&v, bin, sizeof(bin) - 1)); \
+    EXPECT_EQ_INT(TINY_NULL, tiny_get_type(&v));                         \
+  } while (0)
+
+static void test_parse_cache()
+{
+  test_alloc_state state = {0, 0};
+  tiny_allocator a = {test_malloc, test_realloc, test_free, NULL};
+  tiny_parse_cache *c;
+  tiny_parse_cache_stats s;
+  const tiny_value *d1, *d2;
+  tiny_value v;
+  char json[32];
+  int i, ret;
+  a.ud = &state;
+
+  c = tiny_parse_cache_create(1 << 20, &a);
+  d1 = tiny_parse_cache_get(c, "{\"a\":[1,2,\"x\"]}", &ret);
+  EXPECT_EQ_INT(TINY_PARSE_OK, ret);
+  EXPECT_EQ_INT(TINY_OBJECT, tiny_get_type(d1));
+  d2 = tiny_parse_cache_get(c, "{\"a\":[1,2,\"x\"]}", NULL);
+  EXPECT_TRUE(d1 == d2); /* hit returns the same document */
+  d2 = tiny_parse_cache_get(c, "\"abc\"", NULL);
+  EXPECT_EQ_STRING("abc", tiny_get_string(d2), tiny_get_string_length(d2));
+  EXPECT_TRUE(tiny_parse_cache_get(c, "[1,", &ret) == NULL);
+  EXPECT_EQ_INT(TINY_PARSE_EXPECT_VALUE, ret);
+  tiny_parse_cache_get_stats(c, &s);
+  EXPECT_EQ_SIZE_T(1, s.hits);
+  EXPECT_EQ_SIZE_T(3, s.misses);
+  EXPECT_EQ_SIZE_T(2, s.entries); /* errors are not cached */
+
+  /* private copy outlives the cache */
+  tiny_init(&v);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse_cache_parse(c, &v, "{\"a\":[1,2,\"x\"]}"));
+  EXPECT_TRUE(tiny_is_equal(&v, d1));
+  tiny_set_number_ex(tiny_get_array_element(tiny_find_object_value(&v, "a", 1), 0), 5.0, &a);
+  tiny_set_string_ex(tiny_pushback_array_element_ex(tiny_find_object_value(&v, "a", 1), &a), "y", 1, &a);
+  EXPECT_FALSE(tiny_is_equal(&v, d1));
+  EXPECT_EQ_INT(TINY_PARSE_EXPECT_VALUE, tiny_parse_cache_parse(c, &v, ""));
+  tiny_parse_cache_destroy(c);
+  EXPECT_EQ_DOUBLE(5.0, tiny_get_number(tiny_get_array_element(tiny_find_object_value(&v, "a", 1), 0)));
+  tiny_free_ex(&v, &a);
+  EXPECT_EQ_INT(0, (int) state.live);
+
+  /* LRU eviction under a small budget */
+  c = tiny_parse_cache_create(0, &a);
+  tiny_parse_cache_get(c, "[1]", NULL);
+  tiny_parse_cache_get(c, "[2]", NULL);
+  tiny_parse_cache_get_stats(c, &s);
+  EXPECT_EQ_SIZE_T(1, s.entries); /* an oversized document stays until the next miss */
+  EXPECT_EQ_SIZE_T(1, s.evictions);
+  tiny_parse_cache_destroy(c);
+
+  c = tiny_parse_cache_create(1 << 20, &a);
+  tiny_parse_cache_get(c, "[0]", NULL);
+  tiny_parse_cache_get_stats(c, &s);
+  tiny_parse_cache_destroy(c);
+  c = tiny_parse_cache_create(s.bytes * 3, &a);
+  tiny_parse_cache_get(c, "[0]", NULL);
+  tiny_parse_cache_get(c, "[1]", NULL);
+  tiny_parse_cache_get(c, "[2]", NULL);
+  tiny_parse_cache_get(c, "[0]", NULL); /* [1] is now the oldest */
+  tiny_parse_cache_get(c, "[3]", NULL);
+  tiny_parse_cache_get_stats(c, &s);
+  EXPECT_EQ_SIZE_T(3, s.entries);
+  EXPECT_EQ_SIZE_T(1, s.evictions);
+  EXPECT_EQ_SIZE_T(1, s.hits);
+  tiny_parse_cache_get(c, "[0]", NULL);
+  tiny_parse_cache_get(c, "[1]", NULL);
+  tiny_parse_cache_get_stats(c, &s);
+  EXPECT_EQ_SIZE_T(2, s.hits);
+  EXPECT_EQ_SIZE_T(5, s.misses);
+  tiny_parse_cache_clear(c);
+  tiny_parse_cache_get_stats(c, &s);
+  EXPECT_EQ_SIZE_T(0, s.entries);
+  EXPECT_EQ_SIZE_T(0, s.bytes);
+  tiny_parse_cache_destroy(c);
+
+  /* the table grows past its initial buckets */
+  c = tiny_parse_cache_create(1 << 20, &a);
+  for (i = 0; i < 100; i++)
+  {
+    sprintf(json, "[%d]", i);
+    tiny_parse_cache_get(c, json, NULL);
+  }
+  for (i = 0; i < 100; i++)
+  {
+    sprintf(json, "[%d]", i);
+    d1 = tiny_parse_cache_get(c, json, NULL);
+    EXPECT_EQ_DOUBLE((double) i, tiny_get_number(tiny_get_array_element(d1, 0)));
+  }
+  tiny_parse_cache_get_stats(c, &s);
+  EXPECT_EQ_SIZE_T(100, s.hits);
+  EXPECT_EQ_SIZE_T(100, s.entries);
+  tiny_parse_cache_destroy(c);
+  EXPECT_EQ_INT(0, (int) state.live);
+}
+
+static void test_freeze()
+{
+  test_alloc_state state = {0, 0};
+  tiny_allocator a = {test_malloc, test_realloc, test_free, NULL};
+  tiny_document *d, *shared;
+  const tiny_value *root;
+  tiny_value v;
+  a.ud = &state;
+
+  tiny_init(&v);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse_ex(&v, "{\"a\":[1,2],\"s\":\"abc\"}", &a));
+  d = tiny_freeze_ex(&v, &a);
+  EXPECT_EQ_INT(TINY_NULL, tiny_get_type(&v)); /* moved, not copied */
+  root = tiny_document_root(d);
+  EXPECT_EQ_INT(TINY_OBJECT, tiny_get_type(root));
+  EXPECT_EQ_SIZE_T(2, tiny_get_object_size(root));
+  EXPECT_EQ_DOUBLE(2.0, tiny_get_number(tiny_get_array_element(tiny_get_object_value(root, 0), 1)));
+  shared = tiny_document_retain(d);
+  EXPECT_TRUE(shared == d);
+  EXPECT_TRUE(tiny_document_root(shared) == root);
+  tiny_document_release(d);
+  EXPECT_EQ_STRING("abc", tiny_get_string(tiny_get_object_value(root, 1)), tiny_get_string_length(tiny_get_object_value(root, 1)));
+  tiny_document_release(shared); /* last reference frees the tree */
+  EXPECT_EQ_INT(0, (int) state.live);
+  tiny_document_release(NULL);
+
+  tiny_set_string(&v, "x", 1);
+  d = tiny_freeze(&v);
+  EXPECT_EQ_STRING("x", tiny_get_string(tiny_document_root(d)), 1);
+  tiny_document_release(d);
+}
+
+static void test_persistent()
+{
+  test_alloc_state state = {0, 0};
+  tiny_allocator a = {test_malloc, test_realloc, test_free, NULL};
+  tiny_parser p;
+  tiny_value v1, v2, v3, patch, *e;
+  char *json, *input;
+  size_t length;
+  a.ud = &state;
+
+  tiny_set_allocator(&a);
+  tiny_init(&v1);
+  tiny_init(&v2);
+  tiny_init(&v3);
+  tiny_init(&patch);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v1, "{\"a\":{\"b\":[1,2,3],\"c\":\"x\"},\"d\":[{\"e\":1}],\"s\":\"str\",\"z\":[]}"));
+  tiny_share(&v2, &v1);
+  EXPECT_TRUE(v1.flags & TINY_FLAG_SHARED);
+  EXPECT_TRUE(tiny_get_object_value(&v1, 0) == tiny_get_object_value(&v2, 0)); /* O(1), nothing copied */
+  EXPECT_TRUE(tiny_is_equal(&v1, &v2));
+
+  /* writes copy the path only */
+  tiny_set_number(tiny_edit_array_element(tiny_set_object_value(tiny_set_object_value(&v2, "a", 1), "b", 1), 1), 20.0);
+  EXPECT_EQ_DOUBLE(2.0, tiny_get_number(tiny_get_array_element(tiny_find_object_value(tiny_find_object_value(&v1, "a", 1), "b", 1), 1)));
+  EXPECT_EQ_DOUBLE(20.0, tiny_get_number(tiny_get_array_element(tiny_find_object_value(tiny_find_object_value(&v2, "a", 1), "b", 1), 1)));
+  EXPECT_TRUE(tiny_get_array_element(tiny_find_object_value(&v1, "d", 1), 0) == tiny_get_array_element(tiny_find_object_value(&v2, "d", 1), 0));
+  EXPECT_TRUE(tiny_find_object_value(&v1, "s", 1)->u.s.s == tiny_find_object_value(&v2, "s", 1)->u.s.s);
+  EXPECT_FALSE(tiny_is_equal(&v1, &v2));
+
+  tiny_set_string(tiny_pushback_array_element(tiny_set_object_value(&v2, "d", 1)), "new", 3);
+  tiny_pushback_array_element(tiny_set_object_value(&v2, "z", 1));
+  tiny_remove_object_value(&v2, tiny_find_object_index(&v2, "s", 1));
+  tiny_popback_array_element(tiny_set_object_value(tiny_set_object_value(&v2, "a", 1), "b", 1));
+  tiny_set_number(tiny_edit_object_value(tiny_edit_array_element(tiny_find_object_value(&v2, "d", 1), 0), 0), 5.0);
+  json = tiny_stringify(&v1, &length);
+  EXPECT_EQ_STRING("{\"a\":{\"b\":[1,2,3],\"c\":\"x\"},\"d\":[{\"e\":1}],\"s\":\"str\",\"z\":[]}", json, length);
+  test_free(&state, json);
+  json = tiny_stringify(&v2, &length);
+  EXPECT_EQ_STRING("{\"a\":{\"b\":[1,20],\"c\":\"x\"},\"d\":[{\"e\":5},\"new\"],\"z\":[null]}", json, length);
+  test_free(&state, json);
+
+  /* the next version only persists what changed; patches copy paths too */
+  tiny_share(&v3, &v2);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&patch, "[{\"op\":\"replace\",\"path\":\"/a/c\",\"value\":\"y\"},{\"op\":\"add\",\"path\":\"/d/0/f\",\"value\":true}]"));
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_apply_patch(&v3, &patch));
+  tiny_free(&patch);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&patch, "{\"a\":{\"b\":null},\"z\":\"q\"}"));
+  tiny_apply_merge_patch(&v3, &patch);
+  json = tiny_stringify(&v3, &length);
+  EXPECT_EQ_STRING("{\"a\":{\"c\":\"y\"},\"d\":[{\"e\":5,\"f\":true},\"new\"],\"z\":\"q\"}", json, length);
+  test_free(&state, json);
+  json = tiny_stringify(&v2, &length);
+  EXPECT_EQ_STRING("{\"a\":{\"b\":[1,20],\"c\":\"x\"},\"d\":[{\"e\":5},\"new\"],\"z\":[null]}", json, length);
+  test_free(&state, json);
+  EXPECT_TRUE(tiny_find_object_value(&v2, "d", 1)->u.a.e != tiny_find_object_value(&v3, "d", 1)->u.a.e);
+  EXPECT_TRUE(tiny_get_array_element(tiny_find_object_value(&v2, "d", 1), 1)->u.s.s == tiny_get_array_element(tiny_find_object_value(&v3, "d", 1), 1)->u.s.s);
+
+  /* a deep copy is private again */
+  tiny_free(&patch);
+  tiny_copy(&patch, &v3);
+  EXPECT_TRUE(tiny_is_equal(&patch, &v3));
+  EXPECT_EQ_INT(0, patch.flags);
+  tiny_free(&v2); /* versions are released in any order */
+  tiny_free(&v3);
+  tiny_share(&v2, &v1);
+  tiny_free(&v1);
+  tiny_set_string(tiny_set_object_value(&v2, "s", 1), "t", 1);
+  EXPECT_EQ_STRING("t", tiny_get_string(tiny_find_object_value(&v2, "s", 1)), 1);
+  tiny_free(&v2);
+  tiny_free(&patch);
+
+  /* scalars and strings at the root */
+  tiny_set_string(&v1, "abc", 3);
+  tiny_share(&v2, &v1);
+  EXPECT_TRUE(v1.u.s.s == v2.u.s.s);
+  tiny_free(&v1);
+  EXPECT_EQ_STRING("abc", tiny_get_string(&v2), tiny_get_string_length(&v2));
+  tiny_set_number(&v1, 1.5);
+  tiny_share(&v2, &v1);
+  EXPECT_EQ_DOUBLE(1.5, tiny_get_number(&v2));
+
+  /* lazy and borrowed values let go of the input */
+  input = (char *) malloc(64);
+  strcpy(input, "{\"k\":[\"a\\nb\",12],\"s\":\"plain\"}");
+  tiny_parser_init(&p, NULL);
+  tiny_parser_set_flags(&p, TINY_PARSER_LAZY_NUMBERS | TINY_PARSER_BORROW_STRINGS);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parser_parse(&p, &v1, input));
+  tiny_parser_destroy(&p);
+  tiny_share(&v2, &v1);
+  memset(input, 0, 64);
+  free(input);
+  json = tiny_stringify(&v2, &length);
+  EXPECT_EQ_STRING("{\"k\":[\"a\\nb\",12],\"s\":\"plain\"}", json, length);
+  test_free(&state, json);
+  tiny_free(&v1);
+  tiny_free(&v2);
+
+  /* compact copies */
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v3, "[[1,2],{\"k\":\"v\"},\"s\"]"));
+  tiny_copy_compact(&v1, &v3);
+  tiny_share(&v2, &v1);
+  e = tiny_edit_array_element(&v2, 0);
+  tiny_set_number(tiny_edit_array_element(e, 0), 0.0);
+  EXPECT_EQ_DOUBLE(1.0, tiny_get_number(tiny_get_array_element(tiny_get_array_element(&v1, 0), 0)));
+  EXPECT_TRUE(tiny_is_equal(&v1, &v3));
+  tiny_free(&v1);
+  tiny_free(&v2);
+  tiny_free(&v3);
+  tiny_set_allocator(NULL);
+  EXPECT_EQ_INT(0, (int) state.live);
+}
+
+static void test_msgpack()
+{
+  tiny_value v, v2;
+  char *bin, key[16];
+  size_t i, length;
+
+  TEST_MSGPACK_ROUNDTRIP("null");
+  TEST_MSGPACK_ROUNDTRIP("[true,false,0,-0,1,-1,127,128,-32,-33,-129,65536,-32769,4294967296,-2147483649,1.5,0.25,-2.5,1.0000000000000002]");
+  TEST_MSGPACK_ROUNDTRIP("[1.8446744073709552e+19,-9.2233720368547758e+18]");
+  TEST_MSGPACK_ROUNDTRIP("{\"\":\"\",\"a\":[[],{}],\"b\\u0000c\":\"\\u0000\",\"o\":{\"k\":[null,{\"x\":\"0123456789012345678901234567890123456789\"}]}}");
+
+  tiny_init(&v);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v, "[1,-1,300,0.5,\"ab\",null,true,false,-0]"));
+  bin = tiny_encode_msgpack(&v, &length);
+  EXPECT_EQ_STRING("\x99\x01\xff\xcd\x01\x2c\xcb\x3f\xe0\0\0\0\0\0\0\xa2" "ab\xc0\xc3\xc2\xcb\x80\0\0\0\0\0\0\0", bin, length);
+  free(bin);
+  tiny_free(&v);
+
+  /* 16/32-bit lengths and the str8 form */
+  tiny_init(&v);
+  tiny_init(&v2);
+  tiny_set_array(&v, 0);
+  for (i = 0; i < 70000; i++)
+    tiny_set_number(tiny_pushback_array_element(&v), (double) i);
+  tiny_set_string(tiny_pushback_array_element(&v), "0123456789012345678901234567890123456789", 40);
+  tiny_set_object(tiny_pushback_array_element(&v), 0);
+  for (i = 0; i < 20; i++)
+    tiny_set_number(tiny_set_object_value(tiny_get_array_element(&v, 70001), key, sprintf(key, "k%d", (int) i)), -1.0 * i);
+  bin = tiny_encode_msgpack(&v, &length);
+  EXPECT_EQ_INT(0xdd, (unsigned char) bin[0]);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_decode_msgpack(&v2, bin, length));
+  EXPECT_TRUE(tiny_is_equal(&v, &v2));
+  EXPECT_EQ_SIZE_T(70002, tiny_get_array_capacity(&v2)); /* allocated exactly */
+  free(bin);
+  tiny_free(&v);
+  tiny_free(&v2);
+
+  /* forms the encoder never writes */
+  tiny_init(&v);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_decode_msgpack(&v, "\x96\xca\x3f\xc0\0\0\xd0\x80\xd3\xff\xff\xff\xff\xff\xff\xff\xfe\xcc\x05\xc4\x01z\xde\0\x01\xd9\x01k\xe3", 29));
+  bin = tiny_stringify(&v, &length);
+  EXPECT_EQ_STRING("[1.5,-128,-2,5,\"z\",{\"k\":-29}]", bin, length);
+  free(bin);
+  tiny_free(&v);
+
+  TEST_MSGPACK_ERROR(TINY_PARSE_EXPECT_VALUE, "");
+  TEST_MSGPACK_ERROR(TINY_PARSE_MSGPACK_TRUNCATED, "\x92\x01");
+  TEST_MSGPACK_ERROR(TINY_PARSE_MSGPACK_TRUNCATED, "\xcd\x01");
+  TEST_MSGPACK_ERROR(TINY_PARSE_MSGPACK_TRUNCATED, "\xa3" "ab");
+  TEST_MSGPACK_ERROR(TINY_PARSE_MSGPACK_TRUNCATED, "\xdd\xff\xff\xff\xff\x01\x02"); /* length larger than the input */
+  TEST_MSGPACK_ERROR(TINY_PARSE_MSGPACK_TRUNCATED, "\x82\xa1k\x91\x92\x01");
+  TEST_MSGPACK_ERROR(TINY_PARSE_INVALID_MSGPACK, "\xc1");
+  TEST_MSGPACK_ERROR(TINY_PARSE_INVALID_MSGPACK, "\xd4\x01\x02");
+  TEST_MSGPACK_ERROR(TINY_PARSE_INVALID_MSGPACK, "\x81\x01\x02"); /* key is not a string */
+  TEST_MSGPACK_ERROR(TINY_PARSE_INVALID_MSGPACK, "\x81\x91\x01\x02");
+  TEST_MSGPACK_ERROR(TINY_PARSE_INVALID_MSGPACK, "\x91\xcb\x7f\xf8\0\0\0\0\0\0"); /* NaN */
+  TEST_MSGPACK_ERROR(TINY_PARSE_ROOT_NOT_SINGULAR, "\x01\x02");
+}
+
+typedef struct
+{
+  double x, y;
+} test_point;
+
+typedef struct
+{
+  int id, ok;
+  double score;
+  char *name;
+  test_point pos;
+  tiny_value extra;
+} test_record;
+
+static const tiny_field test_point_fields[] = {
+    TINY_FIELD("x", test_point, x, TINY_FIELD_NUMBER, NULL),
+    TINY_FIELD("y", test_point, y, TINY_FIELD_NUMBER, NULL),
+};
+
+static void test_schema()
+{
+  test_alloc_state state = {0, 0};
+  tiny_allocator a = {test_malloc, test_realloc, test_free, NULL};
+  tiny_schema point, record, wide;
+  tiny_field record_fields[6] = {
+      TINY_FIELD("id", test_record, id, TINY_FIELD_INT, NULL),
+      TINY_FIELD("ok", test_record, ok, TINY_FIELD_BOOL, NULL),
+      TINY_FIELD("score", test_record, score, TINY_FIELD_NUMBER, NULL),
+      TINY_FIELD("name", test_record, name, TINY_FIELD_STRING, NULL),
+      TINY_FIELD("pos", test_record, pos, TINY_FIELD_OBJECT, NULL),
+      TINY_FIELD("extra", test_record, extra, TINY_FIELD_VALUE, NULL),
+  };
+  static const char *invalid[] = {"[1,}", "{\"a\" 1}", "{1:1}", "[\"\\x\"]", "{\"a\":[1}", "[[]", "tru", "\"abc", "[1 2]", "-"};
+  test_record r;
+  tiny_value v;
+  char *json, keys[40][8], buffer[64];
+  int wide_values[40];
+  tiny_field wide_fields[40];
+  size_t i, length;
+  a.ud = &state;
+  record_fields[4].schema = &point;
+
+  tiny_schema_init(&point, test_point_fields, 2);
+  tiny_schema_init(&record, record_fields, 6);
+  memset(&r, 0, sizeof(r));
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse_struct(&r, &record,
+                                                 " { \"name\" : \"a\\nb\", \"skip\":{\"a\":[1,\"\\u00e9\",{},[[]]]},\"id\":-7,\"pos\":{\"y\":2.5,\"z\":null,\"x\":-1},"
+                                                 "\"ok\":true,\"extra\":[null,{\"k\":\"v\"}],\"name\":\"cd\" } "));
+  EXPECT_EQ_INT(-7, r.id);
+  EXPECT_EQ_INT(1, r.ok);
+  EXPECT_EQ_DOUBLE(0.0, r.score); /* absent */
+  EXPECT_EQ_STRING("cd", r.name, strlen(r.name));
+  EXPECT_EQ_DOUBLE(-1.0, r.pos.x);
+  EXPECT_EQ_DOUBLE(2.5, r.pos.y);
+  json = tiny_stringify(&r.extra, &length);
+  EXPECT_EQ_STRING("[null,{\"k\":\"v\"}]", json, length);
+  free(json);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse_struct(&r, &record, "{\"name\":null,\"score\":1e3}"));
+  EXPECT_TRUE(r.name == NULL);
+  EXPECT_EQ_DOUBLE(1000.0, r.score);
+  EXPECT_EQ_INT(-7, r.id);
+  tiny_free_struct(&r, &record);
+  EXPECT_EQ_INT(TINY_NULL, tiny_get_type(&r.extra));
+
+  /* unknown keys are skipped without allocating */
+  tiny_set_allocator(&a);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse_struct(&r, &record, "{\"skip\":{\"a\":[1,2,\"xyz\",{\"b\":[true]}]},\"id\":3,\"more\":\"text\"}"));
+  EXPECT_EQ_INT(3, r.id);
+  EXPECT_EQ_INT(1, (int) state.calls); /* scratch stack only */
+  EXPECT_EQ_INT(0, (int) state.live);
+  tiny_set_allocator(NULL);
+
+  EXPECT_EQ_INT(TINY_PARSE_SCHEMA_MISMATCH, tiny_parse_struct(&r, &record, "{\"id\":1.5}"));
+  EXPECT_EQ_INT(TINY_PARSE_SCHEMA_MISMATCH, tiny_parse_struct(&r, &record, "{\"id\":3000000000}"));
+  EXPECT_EQ_INT(TINY_PARSE_SCHEMA_MISMATCH, tiny_parse_struct(&r, &record, "{\"ok\":1}"));
+  EXPECT_EQ_INT(TINY_PARSE_SCHEMA_MISMATCH, tiny_parse_struct(&r, &record, "{\"score\":\"1\"}"));
+  EXPECT_EQ_INT(TINY_PARSE_SCHEMA_MISMATCH, tiny_parse_struct(&r, &record, "{\"name\":\"x\",\"pos\":[]}"));
+  EXPECT_TRUE(r.name == NULL); /* released on error */
+  EXPECT_EQ_INT(TINY_PARSE_SCHEMA_MISMATCH, tiny_parse_struct(&r, &record, "[]"));
+  EXPECT_EQ_INT(TINY_PARSE_EXPECT_VALUE, tiny_parse_struct(&r, &record, " "));
+  EXPECT_EQ_INT(TINY_PARSE_ROOT_NOT_SINGULAR, tiny_parse_struct(&r, &record, "{} x"));
+  EXPECT_EQ_INT(TINY_PARSE_MISS_COMMA_OR_CURLY_BRACKET, tiny_parse_struct(&r, &record, "{\"id\":1 \"ok\":true}"));
+
+  /* a skipped value fails the same way tiny_parse() would */
+  tiny_init(&v);
+  for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+  {
+    sprintf(buffer, "{\"skip\":%s}", invalid[i]);
+    EXPECT_EQ_INT(tiny_parse(&v, invalid[i]), tiny_parse_struct(&r, &record, buffer));
+  }
+
+  /* enough keys to need a few seeds */
+  for (i = 0; i < 40; i++)
+  {
+    sprintf(keys[i], "k%d", (int) i);
+    wide_fields[i].key = keys[i];
+    wide_fields[i].offset = i * sizeof(int);
+    wide_fields[i].type = TINY_FIELD_INT;
+    wide_fields[i].schema = NULL;
+    wide_values[i] = -1;
+  }
+  tiny_schema_init(&wide, wide_fields, 40);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse_struct(wide_values, &wide, "{\"k39\":39,\"k0\":0,\"k17\":17,\"k4\":4,\"k40\":40,\"k\":0}"));
+  EXPECT_EQ_INT(39, wide_values[39]);
+  EXPECT_EQ_INT(0, wide_values[0]);
+  EXPECT_EQ_INT(17, wide_values[17]);
+  EXPECT_EQ_INT(4, wide_values[4]);
+  EXPECT_EQ_INT(-1, wide_values[5]);
+
+  tiny_schema_destroy(&wide);
+  tiny_schema_destroy(&record);
+  tiny_schema_destroy(&point);
+}
+
+// 递归比较快照节点和原来的值，测试里的文档都很浅
+static int snap_equal(const tiny_snap_node *n, const tiny_value *v)
+{
+  size_t i;
+  if (tiny_snap_get_type(n) != tiny_get_type(v))
+    return 0;
+  switch (tiny_get_type(v))
+  {
+  case TINY_NUMBER:
+    return tiny_snap_get_number(n) == tiny_get_number(v);
+  case TINY_STRING:
+    return tiny_snap_get_string_length(n) == tiny_get_string_length(v) && memcmp(tiny_snap_get_string(n), tiny_get_string(v), tiny_get_string_length(v) + 1) == 0;
+  case TINY_ARRAY:
+    if (tiny_snap_get_array_size(n) != tiny_get_array_size(v))
+      return 0;
+    for (i = 0; i < tiny_get_array_size(v); i++)
+      if (!snap_equal(tiny_snap_get_array_element(n, i), tiny_get_array_element(v, i)))
+        return 0;
+    return 1;
+  case TINY_OBJECT:
+    if (tiny_snap_get_object_size(n) != tiny_get_object_size(v))
+      return 0;
+    for (i = 0; i < tiny_get_object_size(v); i++)
+      if (tiny_snap_get_object_key_length(n, i) != tiny_get_object_key_length(v, i) ||
+          memcmp(tiny_snap_get_object_key(n, i), tiny_get_object_key(v, i), tiny_get_object_key_length(v, i) + 1) != 0 ||
+          !snap_equal(tiny_snap_get_object_value(n, i), tiny_get_object_value(v, i)))
+        return 0;
+    return 1;
+  default:
+    return 1;
+  }
+}
+
+#define TEST_FILTER(expect, json, selectors)                                                             \
+  do                                                                                                     \
+  {                                                                                                      \
+    tiny_filter f;                                                                                       \
+    tiny_value v;                                                                                        \
+    char *out;                                                                                           \
+    size_t length;                                                                                       \
+    EXPECT_EQ_INT(TINY_PARSE_OK, tiny_filter_init(&f, selectors, sizeof(selectors) / sizeof(char *)));  \
+    EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse_filtered(&v, &f, json));                                    \
+    out = tiny_stringify(&v, &length);                                                                   \
+    EXPECT_EQ_STRING(expect, out, length);                                                               \
+    free(out);                                                                                           \
+    tiny_free(&v);                                                                                       \
+    tiny_filter_destroy(&f);                                                                             \
+  } while (0)
+
+static void test_parse_filtered()
+{
+  test_alloc_state state = {0, 0};
+  tiny_allocator a = {test_malloc, test_realloc, test_free, NULL};
+  const char *s1[] = {"$.user.id", "$.events[*].type"};
+  const char *s2[] = {"$.events[1]"};
+  const char *s3[] = {"$.user", "$.user.id", "$.big[2]"};
+  const char *s4[] = {"$.*.id", "$.events"};
+  const char *s5[] = {"$.events[*].x"};
+  const char *s6[] = {"$.nothing", "$"};
+  const char *s7[] = {"$.nothing", "$.user.id.deeper", "$[0]"};
+  const char *s8[] = {"$[*][1]"};
+  const char *s9[] = {"$.user.id"};
+  const char *s10[] = {"$.*"};
+  const char *s11[] = {"$.a"};
+  const char *bad[] = {"$.a", "a.b"};
+  tiny_filter f;
+  tiny_value v;
+  a.ud = &state;
+
+  TEST_FILTER("{\"user\":{\"id\":7},\"events\":[{\"type\":\"a\"},{\"type\":\"b\"}]}", "{\"user\":{\"id\":7,\"name\":\"n\"},\"events\":[{\"type\":\"a\",\"x\":[1,{}]},{\"x\":2},{\"type\":\"b\"}],\"big\":[1,2,3]}", s1);
+  TEST_FILTER("{\"events\":[{\"x\":2}]}", "{\"user\":{\"id\":7,\"name\":\"n\"},\"events\":[{\"type\":\"a\",\"x\":[1,{}]},{\"x\":2},{\"type\":\"b\"}],\"big\":[1,2,3]}", s2);
+  TEST_FILTER("{\"user\":{\"id\":7,\"name\":\"n\"},\"big\":[3]}", "{\"user\":{\"id\":7,\"name\":\"n\"},\"events\":[{\"type\":\"a\",\"x\":[1,{}]},{\"x\":2},{\"type\":\"b\"}],\"big\":[1,2,3]}", s3);
+  TEST_FILTER("{\"user\":{\"id\":7},\"events\":[{\"type\":\"a\",\"x\":[1,{}]},{\"x\":2},{\"type\":\"b\"}]}", "{\"user\":{\"id\":7,\"name\":\"n\"},\"events\":[{\"type\":\"a\",\"x\":[1,{}]},{\"x\":2},{\"type\":\"b\"}],\"big\":[1,2,3]}", s4);
+  TEST_FILTER("{\"events\":[{\"x\":[1,{}]},{\"x\":2}]}", "{\"user\":{\"id\":7,\"name\":\"n\"},\"events\":[{\"type\":\"a\",\"x\":[1,{}]},{\"x\":2},{\"type\":\"b\"}],\"big\":[1,2,3]}", s5);
+  TEST_FILTER("{\"user\":{\"id\":7,\"name\":\"n\"},\"events\":[{\"type\":\"a\",\"x\":[1,{}]},{\"x\":2},{\"type\":\"b\"}],\"big\":[1,2,3]}", "{\"user\":{\"id\":7,\"name\":\"n\"},\"events\":[{\"type\":\"a\",\"x\":[1,{}]},{\"x\":2},{\"type\":\"b\"}],\"big\":[1,2,3]}", s6); /* "$" keeps everything */
+  TEST_FILTER("{}", "{\"user\":{\"id\":7,\"name\":\"n\"},\"events\":[{\"type\":\"a\",\"x\":[1,{}]},{\"x\":2},{\"type\":\"b\"}],\"big\":[1,2,3]}", s7);
+  TEST_FILTER("[[2],[4]]", "[[1,2],{\"a\":3},[3,4],5]", s8);
+  TEST_FILTER("null", " 42 ", s11); /* nothing to descend into */
+  TEST_FILTER("{\"user\":{\"id\":null}}", "{\"us\\u0065r\":{\"id\":null}}", s9);
+  TEST_FILTER("{\"a.b\":1}", "{\"a.b\":1}", s10);
+
+  /* no selectors at all */
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_filter_init(&f, NULL, 0));
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse_filtered(&v, &f, "[1,[2]]"));
+  EXPECT_EQ_SIZE_T(0, tiny_get_array_size(&v));
+  tiny_free(&v);
+  tiny_filter_destroy(&f);
+
+  /* skipped subtrees are still validated */
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_filter_init(&f, bad, 1));
+  tiny_set_allocator(&a);
+  EXPECT_EQ_INT(TINY_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, tiny_parse_filtered(&v, &f, "{\"a\":{\"b\":1},\"c\":[1 2]}"));
+  EXPECT_EQ_INT(TINY_NULL, tiny_get_type(&v));
+  EXPECT_EQ_INT(TINY_PARSE_MISS_COMMA_OR_CURLY_BRACKET, tiny_parse_filtered(&v, &f, "{\"a\":{\"b\":1} \"c\":1}"));
+  EXPECT_EQ_INT(TINY_PARSE_MISS_COLON, tiny_parse_filtered(&v, &f, "{\"a\":[1,2],\"c\" 1}"));
+  EXPECT_EQ_INT(TINY_PARSE_INVALID_VALUE, tiny_parse_filtered(&v, &f, "{\"a\":[1,tru]}"));
+  EXPECT_EQ_INT(TINY_PARSE_ROOT_NOT_SINGULAR, tiny_parse_filtered(&v, &f, "{\"a\":1} 2"));
+  EXPECT_EQ_INT(TINY_NULL, tiny_get_type(&v));
+  EXPECT_EQ_INT(TINY_PARSE_EXPECT_VALUE, tiny_parse_filtered(&v, &f, ""));
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse_filtered(&v, &f, "{\"b\":[1,{\"c\":\"x\"}],\"a\":\"kept\"}"));
+  EXPECT_EQ_STRING("kept", tiny_get_string(tiny_find_object_value(&v, "a", 1)), 4);
+  EXPECT_EQ_SIZE_T(1, tiny_get_object_size(&v));
+  tiny_free(&v);
+  tiny_set_allocator(NULL);
+  EXPECT_EQ_INT(0, (int) state.live);
+  tiny_filter_destroy(&f);
+
+  EXPECT_EQ_INT(TINY_PARSE_INVALID_SELECTOR, tiny_filter_init(&f, bad, 2));
+  tiny_filter_destroy(&f);
+  bad[0] = "$.";
+  EXPECT_EQ_INT(TINY_PARSE_INVALID_SELECTOR, tiny_filter_init(&f, bad, 1));
+  bad[0] = "$..a";
+  EXPECT_EQ_INT(TINY_PARSE_INVALID_SELECTOR, tiny_filter_init(&f, bad, 1));
+  bad[0] = "$[1";
+  EXPECT_EQ_INT(TINY_PARSE_INVALID_SELECTOR, tiny_filter_init(&f, bad, 1));
+  bad[0] = "$[x]";
+  EXPECT_EQ_INT(TINY_PARSE_INVALID_SELECTOR, tiny_filter_init(&f, bad, 1));
+  bad[0] = "$[99999999999999999999999]";
+  EXPECT_EQ_INT(TINY_PARSE_INVALID_SELECTOR, tiny_filter_init(&f, bad, 1));
+  bad[0] = "$a";
+  EXPECT_EQ_INT(TINY_PARSE_INVALID_SELECTOR, tiny_filter_init(&f, bad, 1));
+}
+
+static void test_snapshot()
+{
+  const char *path = "tinyjson_test.snap";
+  tiny_value v;
+  tiny_snapshot *s;
+  const tiny_snap_node *root, *n;
+  FILE *fp;
+  char buffer[256];
+  size_t length;
+
+  tiny_init(&v);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse(&v, "{\"n\":null,\"t\":true,\"f\":false,\"x\":-1.5,\"s\":\"a\\u0000b\",\"a\":[[],{},[1,\"yz\",{\"k\":\"v\"}]],\"\":{}}"));
+  EXPECT_EQ_INT(0, tiny_snapshot_write(&v, path));
+  s = tiny_snapshot_open(path);
+  EXPECT_TRUE(s != NULL);
+  if (s != NULL)
+  {
+    root = tiny_snapshot_root(s);
+    EXPECT_TRUE(snap_equal(root, &v));
+    EXPECT_EQ_SIZE_T(6, tiny_snap_find_object_index(root, "", 0));
+    EXPECT_EQ_SIZE_T(TINY_KEY_NOT_EXIST, tiny_snap_find_object_index(root, "z", 1));
+    EXPECT_TRUE(tiny_snap_find_object_value(root, "zz", 2) == NULL);
+    EXPECT_TRUE(tiny_snap_get_boolean(tiny_snap_find_object_value(root, "t", 1)));
+    EXPECT_EQ_DOUBLE(-1.5, tiny_snap_get_number(tiny_snap_find_object_value(root, "x", 1)));
+    n = tiny_snap_get_array_element(tiny_snap_find_object_value(root, "a", 1), 2);
+    n = tiny_snap_find_object_value(tiny_snap_get_array_element(n, 2), "k", 1);
+    EXPECT_EQ_STRING("v", tiny_snap_get_string(n), tiny_snap_get_string_length(n));
+    tiny_snapshot_close(s);
+  }
+  tiny_free(&v);
+
+  tiny_set_string(&v, "scalar root", 11);
+  EXPECT_EQ_INT(0, tiny_snapshot_write(&v, path));
+  s = tiny_snapshot_open(path);
+  EXPECT_TRUE(s != NULL);
+  if (s != NULL)
+  {
+    EXPECT_TRUE(snap_equal(tiny_snapshot_root(s), &v));
+    tiny_snapshot_close(s);
+  }
+  tiny_free(&v);
+
+  /* truncated file and foreign file */
+  tiny_set_array(&v, 0);
+  EXPECT_EQ_INT(0, tiny_snapshot_write(&v, path));
+  fp = fopen(path, "rb");
+  length = fread(buffer, 1, sizeof(buffer), fp);
+  fclose(fp);
+  fp = fopen(path, "wb");
+  fwrite(buffer, 1, length - 8, fp);
+  fclose(fp);
+  EXPECT_TRUE(tiny_snapshot_open(path) == NULL);
+  fp = fopen(path, "wb");
+  fputs("[1,2,3]-----------------------------------------------------------", fp);
+  fclose(fp);
+  EXPECT_TRUE(tiny_snapshot_open(path) == NULL);
+  tiny_free(&v);
+  remove(path);
+  EXPECT_TRUE(tiny_snapshot_open(path) == NULL);
 }
 
+#ifdef TINY_ENABLE_STATS
+static void test_stats()
+{
+  tiny_value v;
+  tiny_parse_stats stats;
+  char *json;
+  size_t length;
+  memset(&stats, 0, sizeof(stats));
+  tiny_init(&v);
+  EXPECT_EQ_INT(TINY_PARSE_OK, tiny_parse_with_stats(&v, "{\"a\":[1,\"x\\n\",[true]],\"b\":null}", &stats));
+  EXPECT_EQ_SIZE_T(3, stats.max_depth);
+  EXPECT_EQ_SIZE_T(1, stats.type_count[TINY_OBJECT]);
+  EXPECT_EQ_SIZE_T(2, stats.type_count[TINY_ARRAY]);
+  EXPECT_EQ_SIZE_T(1, stats.type_count[TINY_NUMBER]);
+  EXPECT_EQ_SIZE_T(1, stats.type_count[TINY_STRING]);
+  EXPECT_EQ_SIZE_T(1, stats.type_count[TINY_TRUE]);
+  EXPECT_EQ_SIZE_T(1, stats.type_count[TINY_NULL]);
+  EXPECT_EQ_SIZE_T(4, stats.string_bytes); /* "a", "x\n", "b" */
+  EXPECT_EQ_SIZE_T(2, stats.escape_bytes);
+  EXPECT_EQ_SIZE_T(6, stats.alloc_count); /* 2 keys, 1 string, 2 arrays, 1 object */
+  EXPECT_TRUE(stats.stack_peak > 0);
+
+  memset(&stats, 0, sizeof(stats));
+  json = tiny_stringify_with_stats(&v, &length, &stats);
+  EXPECT_EQ_STRING("{\"a\":[1,\"x\\n\",[true]],\"b\":null}", json, length);
+  EXPECT_EQ_SIZE_T(2, stats.escape_bytes);
+  EXPECT_EQ_SIZE_T(2, stats.type_count[TINY_ARRAY]);
+  free(json);
+  tiny_free(&v);
+}
+#endif
+
 static void test_access()
 {
   test_access_null();
@@ -761,6 +2645,7 @@ static void test_access()
   test_access_number();
   test_access_string();
   test_access_array();
+  test_access_array_batch();
   test_access_object();
 }
 
@@ -772,10 +2657,35 @@ int main()
   test_parse();
   test_stringify();
   test_equal();
+  test_equal_wide_object();
+  test_hash();
   test_copy();
+  test_copy_deep();
   test_move();
   test_swap();
+  test_pointer();
+  test_patch();
+  test_merge_patch();
+  test_diff();
   test_access();
+  test_allocator();
+  test_allocator_mutation();
+  test_reuse();
+  test_lazy_number();
+  test_borrow_strings();
+  test_validate_utf8();
+  test_parse_many();
+  test_copy_compact();
+  test_parse_cache();
+  test_freeze();
+  test_persistent();
+  test_msgpack();
+  test_snapshot();
+  test_schema();
+  test_parse_filtered();
+#ifdef TINY_ENABLE_STATS
+  test_stats();
+#endif
   printf("%d/%d (%3.2f%%) passed\n", test_pass, test_count, test_pass * 100.0 / test_count);
   return main_ret;
 }
@@ -1,15 +1,73 @@
 #include "tinyjson.h"
 #include <assert.h>  // assert()
 #include <errno.h>   // errno, ERANGE
+#include <float.h>   // DBL_MAX_10_EXP
+#include <limits.h>  // INT_MIN, INT_MAX
 #include <math.h>    // HUGE_VAL
 #include <stdio.h>   // sprintf()
-#include <stdlib.h>  // NULL, strtod()
+#include <stdlib.h>  // NULL, strtod(), qsort()
 #include <string.h>  // memcpy()
 
+// 快照用 mmap() 打开；没有 POSIX 的平台退回到整个读进内存
+#if !defined(TINY_SNAPSHOT_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#define TINY_SNAPSHOT_MMAP
+#include <fcntl.h>     // open()
+#include <sys/mman.h>  // mmap()
+#include <sys/stat.h>  // fstat()
+#include <unistd.h>    // close()
+#endif
+
+// 字符串扫描和 UTF-8 校验的 SIMD 路径，定义 TINY_NO_SIMD 可以关掉
+#if !defined(TINY_NO_SIMD) && defined(__GNUC__) && defined(__SSE2__)
+#define TINY_SSE2
+#include <emmintrin.h>  // SSE2
+#if defined(__SSSE3__)
+#define TINY_SSSE3
+#define TINY_TARGET_SSSE3
+#include <tmmintrin.h>  // _mm_shuffle_epi8(), _mm_alignr_epi8()
+#elif defined(__clang__) || __GNUC__ >= 5
+// 编译时没有打开 SSSE3：查表法的校验单独按 SSSE3 编译，运行时 CPU 支持才用，否则退回逐字节检查
+#define TINY_SSSE3
+#define TINY_SSSE3_DISPATCH
+#define TINY_TARGET_SSSE3 __attribute__((target("ssse3")))
+#include <tmmintrin.h>
+#endif
+#endif
+
+// 按 16 字节对齐的整块读取可能越过字符串结尾（但不会跨页），不让 ASan 把它当成越界
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5)
+#define TINY_NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define TINY_NO_SANITIZE_ADDRESS
+#endif
+
+// 冻结文档的引用计数；两者都没有的编译器上退化成普通加减，只能在单线程里共享
+#if defined(__GNUC__)
+#define TINY_ATOMIC_INC(p) __atomic_add_fetch(p, 1, __ATOMIC_RELAXED)
+#define TINY_ATOMIC_DEC(p) __atomic_sub_fetch(p, 1, __ATOMIC_ACQ_REL)
+#elif defined(_MSC_VER)
+#include <intrin.h>  // _InterlockedIncrement()
+#define TINY_ATOMIC_INC(p) _InterlockedIncrement(p)
+#define TINY_ATOMIC_DEC(p) _InterlockedDecrement(p)
+#else
+#define TINY_ATOMIC_INC(p) (++*(p))
+#define TINY_ATOMIC_DEC(p) (--*(p))
+#endif
+
 #ifndef TINY_PARSE_STACK_INIT_SIZE
 #define TINY_PARSE_STACK_INIT_SIZE 256
 #endif
 
+// 默认不限制嵌套深度，解析是非递归的，不会栈溢出
+#ifndef TINY_PARSE_MAX_DEPTH
+#define TINY_PARSE_MAX_DEPTH ((size_t) -1)
+#endif
+
+// 成员数达到这个值的对象比较时用哈希表查键，否则线性查找
+#ifndef TINY_EQUAL_HASH_THRESHOLD
+#define TINY_EQUAL_HASH_THRESHOLD 16
+#endif
+
 #ifndef TINY_PARSE_STRINGIFY_INIT_SIZE
 #define TINY_PARSE_STRINGIFY_INIT_SIZE 256
 #endif
@@ -33,11 +91,106 @@
 
 #define PUTS(c, s, len) memcpy(tiny_context_push(c, len), s, len)
 
+#ifdef TINY_ENABLE_STATS
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define tiny_cycles() ((unsigned long long) __builtin_ia32_rdtsc())
+#else
+#include <time.h>  // clock()
+#define tiny_cycles() ((unsigned long long) clock())
+#endif
+
+#define STAT_ADD(c, field, n)   \
+  do                            \
+  {                             \
+    if ((c)->stats)             \
+      (c)->stats->field += (n); \
+  } while (0)
+
+#define STAT_MAX(c, field, n)                           \
+  do                                                    \
+  {                                                     \
+    if ((c)->stats && (c)->stats->field < (size_t) (n)) \
+      (c)->stats->field = (n);                          \
+  } while (0)
+
+// 计时只用 context 里的起点，不需要额外的局部变量
+#define STAT_BEGIN(c, phase)           \
+  do                                   \
+  {                                    \
+    if ((c)->stats)                    \
+      (c)->phase##_t0 = tiny_cycles(); \
+  } while (0)
+
+#define STAT_END(c, phase)                                           \
+  do                                                                 \
+  {                                                                  \
+    if ((c)->stats)                                                  \
+      (c)->stats->phase##_cycles += tiny_cycles() - (c)->phase##_t0; \
+  } while (0)
+#else
+#define STAT_ADD(c, field, n) \
+  do                          \
+  {                           \
+  } while (0)
+#define STAT_MAX(c, field, n) STAT_ADD(c, field, n)
+#define STAT_BEGIN(c, phase) STAT_ADD(c, phase, 0)
+#define STAT_END(c, phase) STAT_ADD(c, phase, 0)
+#endif
+
+#define TINY_MALLOC(a, size) ((a)->malloc_fn((a)->ud, (size)))
+#define TINY_REALLOC(a, ptr, old_size, new_size) ((a)->realloc_fn((a)->ud, (ptr), (old_size), (new_size)))
+#define TINY_FREE(a, ptr) ((a)->free_fn((a)->ud, (ptr)))
+
+static void *tiny_std_malloc(void *ud, size_t size)
+{
+  (void) ud;
+  return malloc(size);
+}
+
+static void *tiny_std_realloc(void *ud, void *ptr, size_t old_size, size_t new_size)
+{
+  (void) ud;
+  (void) old_size;
+  if (new_size == 0)
+  {
+    // realloc(p, 0) 的行为是实现定义的
+    free(ptr);
+    return NULL;
+  }
+  return realloc(ptr, new_size);
+}
+
+static void tiny_std_free(void *ud, void *ptr)
+{
+  (void) ud;
+  free(ptr);
+}
+
+static const tiny_allocator tiny_std_allocator = {tiny_std_malloc, tiny_std_realloc, tiny_std_free, NULL};
+static const tiny_allocator *tiny_global_allocator = &tiny_std_allocator;
+
+void tiny_set_allocator(const tiny_allocator *a)
+{
+  tiny_global_allocator = a != NULL ? a : &tiny_std_allocator;
+}
+
+const tiny_allocator *tiny_get_allocator(void)
+{
+  return tiny_global_allocator;
+}
+
 typedef struct
 {
   const char *json;
   char *stack;
   size_t size, top;  // size表示栈的容量
+  const tiny_allocator *a;
+  size_t max_depth;  // 数组/对象最大嵌套层数
+  unsigned flags;    // TINY_PARSER_*
+#ifdef TINY_ENABLE_STATS
+  tiny_parse_stats *stats;  // NULL 表示不统计
+  unsigned long long string_t0, number_t0;
+#endif
 } tiny_context;
 
 // 进栈size个字符
@@ -47,7 +200,8 @@ static void *tiny_context_push(tiny_context *c, size_t size)
   assert(size > 0);
   if (c->top + size >= c->size)
   {
-    if (c->size == 0)
+    size_t old_size = c->size;
+    if (c->size < TINY_PARSE_STACK_INIT_SIZE)  // 空栈或被 reset 裁得太小
     {
       c->size = TINY_PARSE_STACK_INIT_SIZE;
     }
@@ -55,7 +209,9 @@ static void *tiny_context_push(tiny_context *c, size_t size)
     {
       c->size += c->size >> 1; /* c->size * 1.5 */
     }
-    c->stack = (char *) realloc(c->stack, c->size);
+    c->stack = (char *) TINY_REALLOC(c->a, c->stack, old_size, c->size);
+    STAT_ADD(c, stack_realloc_count, 1);
+    STAT_MAX(c, stack_peak, c->size);
   }
   ret = c->stack + c->top;
   c->top += size;
@@ -69,6 +225,20 @@ static void *tiny_context_pop(tiny_context *c, size_t size)
   return c->stack + (c->top -= size);
 }
 
+// 把 context 当作遍历树用的工作栈
+static void tiny_work_init(tiny_context *c, const tiny_allocator *a)
+{
+  c->json = NULL;
+  c->stack = NULL;
+  c->size = c->top = 0;
+  c->a = a;
+  c->max_depth = TINY_PARSE_MAX_DEPTH;
+  c->flags = 0;
+#ifdef TINY_ENABLE_STATS
+  c->stats = NULL;
+#endif
+}
+
 static void tiny_parse_whitespace(tiny_context *c)
 {
   const char *p = c->json;
@@ -94,9 +264,9 @@ static int tiny_parse_literal(tiny_context *c, tiny_value *v, const char *litera
   return TINY_PARSE_OK;
 }
 
-static int tiny_parse_number(tiny_context *c, tiny_value *v)
+static int tiny_parse_number_raw(tiny_context *c, tiny_value *v)
 {
-  const char *p = c->json;
+  const char *p = c->json, *exp = NULL;
   if (*p == '-')  // 负数
   {
     p++;
@@ -132,7 +302,7 @@ static int tiny_parse_number(tiny_context *c, tiny_value *v)
   if (*p == 'e' || *p == 'E')
   {
     // 有指数部分
-    p++;
+    exp = p++;
     if (*p == '+' || *p == '-')
     {
       p++;
@@ -145,17 +315,65 @@ static int tiny_parse_number(tiny_context *c, tiny_value *v)
     {
     }
   }
+  v->type = TINY_NUMBER;
+  if (c->flags & TINY_PARSER_LAZY_NUMBERS)
+  {
+    v->u.r.p = c->json;
+    v->u.r.len = p - c->json;
+    v->flags = TINY_FLAG_RAW_NUMBER;
+    // 没有指数、不超过 308 位的数不会溢出，可以推迟到读取时再转换
+    if (exp == NULL && p - c->json <= DBL_MAX_10_EXP)
+    {
+      v->flags |= TINY_FLAG_LAZY_NUMBER;
+      c->json = p;
+      return TINY_PARSE_OK;
+    }
+  }
   errno = 0;
   v->u.n = strtod(c->json, NULL);
   if (errno == ERANGE && (v->u.n == HUGE_VAL || v->u.n == -HUGE_VAL))
   {
+    v->type = TINY_NULL;
+    v->flags = 0;
     return TINY_PARSE_NUMBER_TOO_BIG;
   }
-  v->type = TINY_NUMBER;
   c->json = p;
   return TINY_PARSE_OK;
 }
 
+static int tiny_parse_number(tiny_context *c, tiny_value *v)
+{
+  int ret;
+  STAT_BEGIN(c, number);
+  ret = tiny_parse_number_raw(c, v);
+  STAT_END(c, number);
+  return ret;
+}
+
+// 惰性数字第一次被读取时才转换，结果写回 u.n，原文保留给 stringify
+static double tiny_number(const tiny_value *v)
+{
+  tiny_value *n = (tiny_value *) v;
+  if (v->flags & TINY_FLAG_LAZY_NUMBER)
+  {
+    const char *p = v->u.r.p, *end = p + v->u.r.len, *d = *p == '-' ? p + 1 : p;
+    // 不超过 15 位的整数在 double 里是精确的，直接累加，不用 strtod
+    if (end - d <= 15 && memchr(d, '.', end - d) == NULL)
+    {
+      double x = 0;
+      for (; d < end; d++)
+        x = x * 10 + (*d - '0');
+      n->u.r.n = *p == '-' ? -x : x;
+    }
+    else
+    {
+      n->u.r.n = strtod(p, NULL);  // 输入里数字后面紧跟的一定不是数字的一部分
+    }
+    n->flags &= ~TINY_FLAG_LAZY_NUMBER;
+  }
+  return v->u.n;
+}
+
 // 读取4位16进制数
 static const char *tiny_parse_hex4(const char *p, unsigned *u)
 {
@@ -219,6 +437,210 @@ static void tiny_encode_utf8(tiny_context *c, unsigned u)
   }
 }
 
+// 跳过不需要解码的字符，停在引号、反斜杠、控制字符或 '\0' 上；
+// 顺便记下跳过的字符里有没有非 ASCII 的，全是 ASCII 就不用校验 UTF-8
+#ifdef TINY_SSE2
+// 16 个字节里引号、反斜杠和控制字符所在的位
+static unsigned tiny_string_stops(__m128i x)
+{
+  __m128i quote = _mm_cmpeq_epi8(x, _mm_set1_epi8('"')), backslash = _mm_cmpeq_epi8(x, _mm_set1_epi8('\\'));
+  __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(0x1F)), x);
+  return (unsigned) _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(quote, backslash), control));
+}
+
+TINY_NO_SANITIZE_ADDRESS static const char *tiny_scan_string(const char *p, int *ascii)
+{
+  // 从 p 所在的对齐块开始读，'\0' 也算控制字符，所以不会读过结尾所在的块
+  const char *b = p - ((size_t) p & 15);
+  unsigned mask = ~0u << (p - b), high = 0;
+  for (;;)
+  {
+    __m128i x = _mm_load_si128((const __m128i *) b);
+    unsigned bits = tiny_string_stops(x) & mask;
+    if (bits != 0)
+    {
+      high |= (unsigned) _mm_movemask_epi8(x) & mask & ((bits & -bits) - 1);  // 停下的位置之前
+      *ascii = high == 0;
+      return b + __builtin_ctz(bits);
+    }
+    high |= (unsigned) _mm_movemask_epi8(x) & mask;
+    b += 16;
+    mask = ~0u;
+  }
+}
+#else
+static const char *tiny_scan_string(const char *p, int *ascii)
+{
+  unsigned char high = 0;
+  while ((unsigned char) *p >= 0x20 && *p != '"' && *p != '\\')
+    high |= (unsigned char) *p++;
+  *ascii = high < 0x80;
+  return p;
+}
+#endif
+
+// 找到 [s, end) 里第一个需要转义的字符，没有就返回 end。字符串不一定以 '\0' 结尾，只读 len 以内
+static const char *tiny_find_escape(const char *s, const char *end)
+{
+#ifdef TINY_SSE2
+  unsigned bits;
+  for (; end - s >= 16; s += 16)
+    if ((bits = tiny_string_stops(_mm_loadu_si128((const __m128i *) s))) != 0)
+      return s + __builtin_ctz(bits);
+#endif
+  while (s != end && (unsigned char) *s >= 0x20 && *s != '"' && *s != '\\')
+    s++;
+  return s;
+}
+
+#ifdef TINY_SSSE3
+// Keiser & Lemire 的查表法：每个字节的高半字节、前一个字节的高低半字节各查一张表，
+// 三个结果按位与之后只剩下真正的错误；第三、四个字节另外用前两、三个字节判断
+#define U8_TOO_SHORT 0x01   // 11______ 0_______ 或 11______ 11______
+#define U8_TOO_LONG 0x02    // 0_______ 10______
+#define U8_OVERLONG_3 0x04  // 11100000 100_____
+#define U8_TOO_LARGE 0x08   // 11110100 1001____ 以上
+#define U8_SURROGATE 0x10   // 11101101 101_____
+#define U8_OVERLONG_2 0x20  // 1100000_ 10______
+#define U8_BIT6 0x40        // 11110000 1000____ 或 11110101+ 1000____
+#define U8_TWO_CONTS 0x80   // 10______ 10______
+#define U8_CARRY (U8_TOO_SHORT | U8_TOO_LONG | U8_TWO_CONTS)
+#define U8(x) ((char) (x))
+
+TINY_TARGET_SSSE3 static int tiny_validate_utf8_ssse3(const char *s, size_t len)
+{
+  const __m128i byte1_high = _mm_setr_epi8(
+      U8(U8_TOO_LONG), U8(U8_TOO_LONG), U8(U8_TOO_LONG), U8(U8_TOO_LONG), U8(U8_TOO_LONG), U8(U8_TOO_LONG), U8(U8_TOO_LONG), U8(U8_TOO_LONG),
+      U8(U8_TWO_CONTS), U8(U8_TWO_CONTS), U8(U8_TWO_CONTS), U8(U8_TWO_CONTS), U8(U8_TOO_SHORT | U8_OVERLONG_2), U8(U8_TOO_SHORT),
+      U8(U8_TOO_SHORT | U8_OVERLONG_3 | U8_SURROGATE), U8(U8_TOO_SHORT | U8_TOO_LARGE | U8_BIT6));
+  const __m128i byte1_low = _mm_setr_epi8(
+      U8(U8_CARRY | U8_OVERLONG_3 | U8_OVERLONG_2 | U8_BIT6), U8(U8_CARRY | U8_OVERLONG_2), U8(U8_CARRY), U8(U8_CARRY), U8(U8_CARRY | U8_TOO_LARGE),
+      U8(U8_CARRY | U8_TOO_LARGE | U8_BIT6), U8(U8_CARRY | U8_TOO_LARGE | U8_BIT6), U8(U8_CARRY | U8_TOO_LARGE | U8_BIT6),
+      U8(U8_CARRY | U8_TOO_LARGE | U8_BIT6), U8(U8_CARRY | U8_TOO_LARGE | U8_BIT6), U8(U8_CARRY | U8_TOO_LARGE | U8_BIT6),
+      U8(U8_CARRY | U8_TOO_LARGE | U8_BIT6), U8(U8_CARRY | U8_TOO_LARGE | U8_BIT6), U8(U8_CARRY | U8_TOO_LARGE | U8_BIT6 | U8_SURROGATE),
+      U8(U8_CARRY | U8_TOO_LARGE | U8_BIT6), U8(U8_CARRY | U8_TOO_LARGE | U8_BIT6));
+  const __m128i byte2_high = _mm_setr_epi8(
+      U8(U8_TOO_SHORT), U8(U8_TOO_SHORT), U8(U8_TOO_SHORT), U8(U8_TOO_SHORT), U8(U8_TOO_SHORT), U8(U8_TOO_SHORT), U8(U8_TOO_SHORT), U8(U8_TOO_SHORT),
+      U8(U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_BIT6), U8(U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE),
+      U8(U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE), U8(U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE),
+      U8(U8_TOO_SHORT), U8(U8_TOO_SHORT), U8(U8_TOO_SHORT), U8(U8_TOO_SHORT));
+  const __m128i nibble = _mm_set1_epi8(0x0F);
+  __m128i prev = _mm_setzero_si128(), error = _mm_setzero_si128();
+  char tail[16];
+  size_t i = 0;
+  for (;;)
+  {
+    __m128i x, prev1, special, must23;
+    if (i + 16 <= len)
+    {
+      x = _mm_loadu_si128((const __m128i *) (s + i));
+    }
+    else
+    {
+      // 尾块补 0：结尾处不完整的序列后面跟着 ASCII，会被当成 TOO_SHORT
+      memset(tail, 0, sizeof(tail));
+      memcpy(tail, s + i, len - i);
+      x = _mm_loadu_si128((const __m128i *) tail);
+    }
+    if (_mm_movemask_epi8(_mm_or_si128(x, prev)) != 0)  // 这一块和上一块都是 ASCII 时不可能出错
+    {
+      prev1 = _mm_alignr_epi8(x, prev, 15);
+      special = _mm_and_si128(_mm_and_si128(_mm_shuffle_epi8(byte1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+                                            _mm_shuffle_epi8(byte1_low, _mm_and_si128(prev1, nibble))),
+                              _mm_shuffle_epi8(byte2_high, _mm_and_si128(_mm_srli_epi16(x, 4), nibble)));
+      must23 = _mm_or_si128(_mm_subs_epu8(_mm_alignr_epi8(x, prev, 14), _mm_set1_epi8(U8(0xE0 - 0x80))),
+                            _mm_subs_epu8(_mm_alignr_epi8(x, prev, 13), _mm_set1_epi8(U8(0xF0 - 0x80))));
+      error = _mm_or_si128(error, _mm_xor_si128(_mm_and_si128(must23, _mm_set1_epi8(U8(0x80))), special));
+    }
+    if (i + 16 > len)
+      break;
+    prev = x;
+    i += 16;
+  }
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF;
+}
+#endif
+
+#if !defined(TINY_SSSE3) || defined(TINY_SSSE3_DISPATCH)
+// 按 Unicode 表 3-7 检查 p 开始的一个多字节序列，返回它的长度，不合法返回 0
+static size_t tiny_utf8_sequence(const unsigned char *p, size_t n)
+{
+  unsigned char lo = 0x80, hi = 0xBF;
+  size_t len, i;
+  if (*p >= 0xC2 && *p <= 0xDF)
+  {
+    len = 2;
+  }
+  else if (*p >= 0xE0 && *p <= 0xEF)
+  {
+    len = 3;
+    if (*p == 0xE0)
+      lo = 0xA0;  // 过长编码
+    else if (*p == 0xED)
+      hi = 0x9F;  // 代理项
+  }
+  else if (*p >= 0xF0 && *p <= 0xF4)
+  {
+    len = 4;
+    if (*p == 0xF0)
+      lo = 0x90;  // 过长编码
+    else if (*p == 0xF4)
+      hi = 0x8F;  // 超过 U+10FFFF
+  }
+  else
+  {
+    return 0;
+  }
+  if (n < len || p[1] < lo || p[1] > hi)
+    return 0;
+  for (i = 2; i < len; i++)
+    if ((p[i] & 0xC0) != 0x80)
+      return 0;
+  return len;
+}
+
+static int tiny_validate_utf8_scalar(const char *s, size_t len)
+{
+  const unsigned char *p = (const unsigned char *) s, *end = p + len;
+  size_t n;
+  while (p < end)
+  {
+#ifdef TINY_SSE2
+    // 全是 ASCII 的 16 字节一次跳过
+    if (end - p >= 16 && _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) p)) == 0)
+    {
+      p += 16;
+      continue;
+    }
+#endif
+    if (*p < 0x80)
+    {
+      p++;
+      continue;
+    }
+    if ((n = tiny_utf8_sequence(p, end - p)) == 0)
+      return 0;
+    p += n;
+  }
+  return 1;
+}
+#endif
+
+static int tiny_validate_utf8(const char *s, size_t len)
+{
+#if defined(TINY_SSSE3_DISPATCH)
+  if (__builtin_cpu_supports("ssse3"))
+    return tiny_validate_utf8_ssse3(s, len);
+  return tiny_validate_utf8_scalar(s, len);
+#elif defined(TINY_SSSE3)
+  return tiny_validate_utf8_ssse3(s, len);
+#else
+  return tiny_validate_utf8_scalar(s, len);
+#endif
+}
+
+#define TINY_CHECK_UTF8(c, ascii, s, len) ((ascii) || ((c)->flags & TINY_PARSER_VALIDATE_UTF8) == 0 || tiny_validate_utf8(s, len))
+
 #define STRING_ERROR(ret) \
   do                      \
   {                       \
@@ -230,12 +652,23 @@ static int tiny_parse_string_raw(tiny_context *c, char **str, size_t *len)
 {
   size_t head = c->top;
   unsigned u, u2;
-  const char *p;
+  const char *p, *run;
+  int ascii;
   EXPECT(c, '\"');
   p = c->json;
   for (;;)
   {
-    char ch = *p++;
+    char ch;
+    // 不需要解码的一段整体进栈
+    run = p;
+    p = tiny_scan_string(p, &ascii);
+    if (p != run)
+    {
+      if (!TINY_CHECK_UTF8(c, ascii, run, p - run))
+        STRING_ERROR(TINY_PARSE_INVALID_UTF8);
+      PUTS(c, run, p - run);
+    }
+    ch = *p++;
     switch (ch)
     {
     case '\"':
@@ -246,6 +679,7 @@ static int tiny_parse_string_raw(tiny_context *c, char **str, size_t *len)
       return TINY_PARSE_OK;
     case '\\':
       // 转义字符
+      STAT_ADD(c, escape_bytes, 2);
       switch (*p++)
       {
       case '\"':
@@ -277,6 +711,7 @@ static int tiny_parse_string_raw(tiny_context *c, char **str, size_t *len)
         {
           STRING_ERROR(TINY_PARSE_INVALID_UNICODE_HEX);
         }
+        STAT_ADD(c, escape_bytes, 4);
         // 如果第一个码点在0xD800 ~ 0xDBFF之间
         if (u >= 0xD800 && u <= 0xDBFF)
         {
@@ -298,9 +733,15 @@ static int tiny_parse_string_raw(tiny_context *c, char **str, size_t *len)
           {
             STRING_ERROR(TINY_PARSE_INVALID_UNICODE_SURROGATE);
           }
+          STAT_ADD(c, escape_bytes, 6);
           // 计算真实的码点
           u = (((u - 0xD800) << 10) | (u2 - 0xDC00)) + 0x10000;
         }
+        else if (u >= 0xDC00 && u <= 0xDFFF && (c->flags & TINY_PARSER_VALIDATE_UTF8))
+        {
+          // 单独的低代理项编码出来不是合法的 UTF-8
+          STRING_ERROR(TINY_PARSE_INVALID_UNICODE_SURROGATE);
+        }
         tiny_encode_utf8(c, u);
         break;
       default:
@@ -311,16 +752,65 @@ static int tiny_parse_string_raw(tiny_context *c, char **str, size_t *len)
       // 不匹配""
       STRING_ERROR(TINY_PARSE_MISS_QUOTATION_MARK);
     default:
-      // char 带不带符号，是实现定义的。
-      // 如果编译器定义 char 为带符号的话，(unsigned char)ch >= 0x80 的字符，都会变成负数，并产生 tiny_PARSE_INVALID_STRING_CHAR 错误。
-      // 我们现时还没有测试 ASCII 以外的字符，所以有没有转型至不带符号都不影响，但开始处理 Unicode 的时候就要考虑了
-      if ((unsigned char) ch < 0x20)
-      {
-        STRING_ERROR(TINY_PARSE_INVALID_STRING_CHAR);
-      }
-      PUTC(c, ch);  // 把字符进栈
+      // tiny_scan_string() 只会停在控制字符上。char 带不带符号是实现定义的，
+      // 所以判断时要转型至不带符号，否则 >= 0x80 的字符会变成负数
+      assert((unsigned char) ch < 0x20);
+      STRING_ERROR(TINY_PARSE_INVALID_STRING_CHAR);
+    }
+  }
+}
+
+static void tiny_free_value(const tiny_allocator *a, tiny_value *v);
+static void tiny_set_string_value(const tiny_allocator *a, tiny_value *v, const char *s, size_t len);
+
+// 分配一份以 '\0' 结尾的拷贝，借用模式下的原文后面没有 '\0'
+static char *tiny_copy_chars(const tiny_allocator *a, const char *s, size_t len)
+{
+  char *p = (char *) TINY_MALLOC(a, len + 1);
+  if (len > 0)
+    memcpy(p, s, len);
+  p[len] = '\0';
+  return p;
+}
+
+// 借用模式：字符串指向输入里两个引号之间的原文。
+// 带转义的在这里只校验（解码到暂存区再丢掉），第一次读取时才真正解码
+static int tiny_parse_string_view(tiny_context *c, tiny_value *v)
+{
+  const char *s = c->json + 1, *p;
+  unsigned char flags = TINY_FLAG_BORROWED;
+  char *str;
+  size_t len;
+  int ret, ascii;
+  p = tiny_scan_string(s, &ascii);
+  if (*p == '\"')
+  {
+    if (!TINY_CHECK_UTF8(c, ascii, s, p - s))
+      return TINY_PARSE_INVALID_UTF8;
+    c->json = p + 1;
+  }
+  else
+  {
+    if ((ret = tiny_parse_string_raw(c, &str, &len)) != TINY_PARSE_OK)
+      return ret;
+    if (c->a != tiny_global_allocator)
+    {
+      // 延迟解码发生在只读的接口里，拿不到文档的分配器，所以这里直接解码
+      tiny_set_string_value(c->a, v, str, len);
+      STAT_ADD(c, alloc_count, 1);
+      STAT_ADD(c, alloc_bytes, len + 1);
+      STAT_ADD(c, string_bytes, len);
+      return TINY_PARSE_OK;
     }
+    p = c->json - 1;
+    flags |= TINY_FLAG_ESCAPED;
   }
+  v->u.s.s = (char *) s;
+  v->u.s.len = p - s;
+  v->type = TINY_STRING;
+  v->flags = flags;
+  STAT_ADD(c, string_bytes, v->u.s.len);
+  return TINY_PARSE_OK;
 }
 
 static int tiny_parse_string(tiny_context *c, tiny_value *v)
@@ -328,229 +818,748 @@ static int tiny_parse_string(tiny_context *c, tiny_value *v)
   int ret;
   char *s;
   size_t len;
-  if ((ret = tiny_parse_string_raw(c, &s, &len)) == TINY_PARSE_OK)
-    tiny_set_string(v, s, len);
+  STAT_BEGIN(c, string);
+  if (c->flags & TINY_PARSER_BORROW_STRINGS)
+  {
+    ret = tiny_parse_string_view(c, v);
+  }
+  else if ((ret = tiny_parse_string_raw(c, &s, &len)) == TINY_PARSE_OK)
+  {
+    tiny_set_string_value(c->a, v, s, len);
+    STAT_ADD(c, alloc_count, 1);
+    STAT_ADD(c, alloc_bytes, len + 1);
+    STAT_ADD(c, string_bytes, len);
+  }
+  STAT_END(c, string);
   return ret;
 }
 
-static int tiny_parse_value(tiny_context *c, tiny_value *v);
+// 借用模式下带转义的字符串第一次被读取时才解码，结果换成自己分配的存储。
+// 只有用全局分配器解析的文档里才有这种字符串
+static void tiny_unescape(const tiny_value *v)
+{
+  tiny_value *s = (tiny_value *) v;
+  tiny_context c;
+  char *str;
+  size_t len;
+  if ((v->flags & TINY_FLAG_ESCAPED) == 0)
+    return;
+  tiny_work_init(&c, tiny_global_allocator);
+  c.json = v->u.s.s - 1;  // 原文前面一定是引号
+  tiny_parse_string_raw(&c, &str, &len);  // 解析时已经校验过，不会出错
+  s->u.s.s = tiny_copy_chars(c.a, str, len);
+  s->u.s.len = len;
+  s->flags = 0;
+  TINY_FREE(c.a, c.stack);
+}
 
-static int tiny_parse_array(tiny_context *c, tiny_value *v)
+#define TINY_NO_FRAME ((size_t) -1)
+
+// 数组/对象在 context 栈上的帧。元素压在帧的后面，关闭时一次性拷贝出去
+typedef struct
 {
-  size_t size = 0;
-  int i, ret;
-  EXPECT(c, '[');
-  // 解析空白字符
-  tiny_parse_whitespace(c);
-  if (*c->json == ']')
+  size_t parent;   // 外层帧在栈中的偏移，最外层为 TINY_NO_FRAME
+  size_t size;     // 已经压栈的元素个数
+  tiny_type type;  // TINY_ARRAY 或 TINY_OBJECT
+  unsigned char views;  // 借用模式下对象的键指向输入，遇到带转义的键后改为全部分配
+} tiny_frame;
+
+enum
+{
+  TINY_STATE_VALUE,  // 期待一个值
+  TINY_STATE_KEY,    // 期待对象的键
+  TINY_STATE_DONE    // 刚完成一个值，交给外层帧
+};
+
+#define FRAME(c, offset) ((tiny_frame *) ((c)->stack + (offset)))
+
+static int tiny_parse_scalar(tiny_context *c, tiny_value *v)
+{
+  switch (*c->json)
   {
-    // 数组内没有元素
-    c->json++;
-    v->type = TINY_ARRAY;
-    v->u.a.size = 0;
-    v->u.a.e = NULL;
-    return TINY_PARSE_OK;
+  case 't':
+    return tiny_parse_literal(c, v, "true", TINY_TRUE);
+  case 'f':
+    return tiny_parse_literal(c, v, "false", TINY_FALSE);
+  case 'n':
+    return tiny_parse_literal(c, v, "null", TINY_NULL);
+  case '"':
+    return tiny_parse_string(c, v);
+  case '\0':
+    return TINY_PARSE_EXPECT_VALUE;
+  default:
+    return tiny_parse_number(c, v);
   }
-  for (;;)
-  {
-    tiny_value e;
-    tiny_init(&e);
-    // buggy
-    // 因为 tiny_parse_value() 及之下的函数都需要调用 tiny_context_push()
-    // 而 tiny_context_push() 在发现栈满了的时候会用 realloc() 扩容。
-    // 这时候，我们上层的 e 就会失效
+}
 
-    // tiny_value *e = tiny_context_push(c, sizeof(tiny_value));  // 可能会失效
-    // tiny_init(e);
-    // size++;
-    // if ((ret = tiny_parse_value(c, e)) != tiny_PARSE_OK)  // 可能会realloc()
-    //  return ret;
+// 借用模式下遇到带转义的键：这个对象已经压栈的键全部改为自己分配，之后的键也一样
+static void tiny_own_frame_keys(tiny_context *c, size_t frame)
+{
+  tiny_frame *f = FRAME(c, frame);
+  tiny_member *m = (tiny_member *) (c->stack + c->top) - f->size;
+  size_t i;
+  for (i = 0; i < f->size; i++)
+    m[i].k = tiny_copy_chars(c->a, m[i].k, m[i].klen);
+  f->views = 0;
+}
 
-    if ((ret = tiny_parse_value(c, &e)) != TINY_PARSE_OK)
-    {
-      break;
-    }
-    // 解析空白字符
-    tiny_parse_whitespace(c);
-    memcpy(tiny_context_push(c, sizeof(tiny_value)), &e, sizeof(tiny_value));
-    size++;
-    if (*c->json == ',')
-    {
-      c->json++;
-      // 解析空白字符
-      tiny_parse_whitespace(c);
-    }
-    else if (*c->json == ']')
+// 对象的键先和一个 null 值一起压栈，值解析完后再填进去
+static int tiny_parse_key(tiny_context *c, size_t frame)
+{
+  int ret;
+  char *str;
+  const char *p;
+  int ascii;
+  tiny_member m;
+  if (*c->json != '"')
+    return TINY_PARSE_MISS_KEY;
+  if (FRAME(c, frame)->views)
+  {
+    p = tiny_scan_string(c->json + 1, &ascii);
+    if (*p == '"')
     {
-      // 数组结束
-      c->json++;
-      v->type = TINY_ARRAY;
-      v->u.a.size = size;
-      // size 表示的是元素的数量
-      size *= sizeof(tiny_value);
-      memcpy(v->u.a.e = (tiny_value *) malloc(size), tiny_context_pop(c, size), size);
+      if (!TINY_CHECK_UTF8(c, ascii, c->json + 1, p - c->json - 1))
+        return TINY_PARSE_INVALID_UTF8;
+      m.k = (char *) c->json + 1;
+      m.klen = p - m.k;
+      c->json = p + 1;
+      tiny_init(&m.v);
+      memcpy(tiny_context_push(c, sizeof(tiny_member)), &m, sizeof(tiny_member));
       return TINY_PARSE_OK;
     }
-    else
+    if (*p == '\\')
+      tiny_own_frame_keys(c, frame);
+  }
+  STAT_BEGIN(c, string);
+  ret = tiny_parse_string_raw(c, &str, &m.klen);
+  STAT_END(c, string);
+  if (ret != TINY_PARSE_OK)
+    return ret;
+  m.k = tiny_copy_chars(c->a, str, m.klen);
+  STAT_ADD(c, alloc_count, 1);
+  STAT_ADD(c, alloc_bytes, m.klen + 1);
+  STAT_ADD(c, string_bytes, m.klen);
+  tiny_init(&m.v);
+  memcpy(tiny_context_push(c, sizeof(tiny_member)), &m, sizeof(tiny_member));
+  return TINY_PARSE_OK;
+}
+
+// 关闭栈顶的帧，把元素移到 v 里
+static void tiny_parse_close(tiny_context *c, size_t *frame, tiny_value *v)
+{
+  tiny_frame *f = FRAME(c, *frame);
+  size_t n = f->size;
+  size_t parent = f->parent;
+  tiny_init(v);
+  if (f->type == TINY_ARRAY)
+  {
+    size_t s = n * sizeof(tiny_value);
+    v->type = TINY_ARRAY;
+    v->u.a.size = v->u.a.capacity = n;
+    v->u.a.e = NULL;
+    if (n > 0)
     {
-      // 不匹配 ']'
-      ret = TINY_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
-      break;
+      memcpy(v->u.a.e = (tiny_value *) TINY_MALLOC(c->a, s), tiny_context_pop(c, s), s);
+      STAT_ADD(c, alloc_count, 1);
+      STAT_ADD(c, alloc_bytes, s);
     }
   }
-  /* Pop and free values on the stack */
-  for (i = 0; i < size; i++)
+  else
   {
-    tiny_free((tiny_value *) tiny_context_pop(c, sizeof(tiny_value)));
+    size_t s = n * sizeof(tiny_member);
+    v->type = TINY_OBJECT;
+    v->u.o.size = v->u.o.capacity = n;
+    v->u.o.m = NULL;
+    if (n > 0)
+    {
+      if (f->views)
+        v->flags = TINY_FLAG_KEY_VIEWS;
+      memcpy(v->u.o.m = (tiny_member *) TINY_MALLOC(c->a, s), tiny_context_pop(c, s), s);
+      STAT_ADD(c, alloc_count, 1);
+      STAT_ADD(c, alloc_bytes, s);
+    }
   }
-  return ret;
+  tiny_context_pop(c, sizeof(tiny_frame));
+  *frame = parent;
 }
 
-static int tiny_parse_object(tiny_context *c, tiny_value *v)
+// 出错时从内到外释放所有帧上已经解析好的元素
+static void tiny_parse_unwind(tiny_context *c, size_t frame)
 {
-  size_t i, size;
-  tiny_member m;
-  int ret;
-  EXPECT(c, '{');
-  tiny_parse_whitespace(c);
-  if (*c->json == '}')
+  size_t i;
+  while (frame != TINY_NO_FRAME)
   {
-    c->json++;
-    v->type = TINY_OBJECT;
-    v->u.o.m = 0;
-    v->u.o.size = 0;
-    return TINY_PARSE_OK;
+    tiny_frame *f = FRAME(c, frame);
+    size_t n = f->size;
+    size_t parent = f->parent;
+    for (i = 0; i < n; i++)
+    {
+      if (f->type == TINY_ARRAY)
+      {
+        tiny_free_value(c->a, (tiny_value *) tiny_context_pop(c, sizeof(tiny_value)));
+      }
+      else
+      {
+        tiny_member *m = (tiny_member *) tiny_context_pop(c, sizeof(tiny_member));
+        if (!f->views)
+          TINY_FREE(c->a, m->k);
+        tiny_free_value(c->a, &m->v);
+      }
+    }
+    tiny_context_pop(c, sizeof(tiny_frame));
+    frame = parent;
   }
-  m.k = NULL;
-  size = 0;
-  for (;;)
+}
+
+// 非递归的解析：数组和对象的嵌套用 context 栈上的帧表示，
+// 所以嵌套深度只受 c->max_depth 限制，不会耗尽线程栈
+static int tiny_parse_value(tiny_context *c, tiny_value *v)
+{
+  size_t frame = TINY_NO_FRAME, depth = 0;
+  int ret = TINY_PARSE_OK, state = TINY_STATE_VALUE;
+  tiny_value e;
+  tiny_frame *f;
+  tiny_init(&e);
+  while (ret == TINY_PARSE_OK)
   {
-    char *str;
-    tiny_init(&m.v);
-    /* parse key */
-    if (*c->json != '"')
+    switch (state)
     {
-      ret = TINY_PARSE_MISS_KEY;
+    case TINY_STATE_VALUE:
+      if (*c->json == '[' || *c->json == '{')
+      {
+        tiny_frame nf;
+        if (depth >= c->max_depth)
+        {
+          ret = TINY_PARSE_DEPTH_EXCEEDED;
+          break;
+        }
+        nf.parent = frame;
+        nf.size = 0;
+        nf.type = *c->json == '[' ? TINY_ARRAY : TINY_OBJECT;
+        nf.views = nf.type == TINY_OBJECT && (c->flags & TINY_PARSER_BORROW_STRINGS);
+        frame = c->top;
+        memcpy(tiny_context_push(c, sizeof(tiny_frame)), &nf, sizeof(tiny_frame));
+        STAT_MAX(c, max_depth, depth + 1);
+        depth++;
+        c->json++;
+        tiny_parse_whitespace(c);
+        if (*c->json == (nf.type == TINY_ARRAY ? ']' : '}'))
+        {
+          c->json++;
+          tiny_parse_close(c, &frame, &e);
+          depth--;
+          state = TINY_STATE_DONE;
+        }
+        else if (nf.type == TINY_OBJECT)
+        {
+          state = TINY_STATE_KEY;
+        }
+      }
+      else if ((ret = tiny_parse_scalar(c, &e)) == TINY_PARSE_OK)
+      {
+        state = TINY_STATE_DONE;
+      }
       break;
-    }
-    if ((ret = tiny_parse_string_raw(c, &str, &m.klen)) != TINY_PARSE_OK)
-    {
+    case TINY_STATE_KEY:
+      if ((ret = tiny_parse_key(c, frame)) != TINY_PARSE_OK)
+        break;
+      FRAME(c, frame)->size++;
+      tiny_parse_whitespace(c);
+      if (*c->json != ':')
+      {
+        ret = TINY_PARSE_MISS_COLON;
+        break;
+      }
+      c->json++;
+      tiny_parse_whitespace(c);
+      state = TINY_STATE_VALUE;
       break;
-    }
-    memcpy(m.k = (char *) malloc(m.klen + 1), str, m.klen);
-    m.k[m.klen] = '\0';
-    /* parse ws colon ws */
-    tiny_parse_whitespace(c);
-    if (*c->json != ':')
-    {
-      ret = TINY_PARSE_MISS_COLON;
+    case TINY_STATE_DONE:
+      STAT_ADD(c, type_count[e.type], 1);
+      if (frame == TINY_NO_FRAME)
+      {
+        memcpy(v, &e, sizeof(tiny_value));
+        return TINY_PARSE_OK;
+      }
+      if (FRAME(c, frame)->type == TINY_ARRAY)
+      {
+        // 先压栈再取帧指针，压栈可能 realloc
+        memcpy(tiny_context_push(c, sizeof(tiny_value)), &e, sizeof(tiny_value));
+        FRAME(c, frame)->size++;
+      }
+      else
+      {
+        memcpy(&((tiny_member *) (c->stack + c->top - sizeof(tiny_member)))->v, &e, sizeof(tiny_value));
+      }
+      tiny_init(&e);
+      f = FRAME(c, frame);
+      tiny_parse_whitespace(c);
+      if (*c->json == ',')
+      {
+        c->json++;
+        tiny_parse_whitespace(c);
+        state = f->type == TINY_ARRAY ? TINY_STATE_VALUE : TINY_STATE_KEY;
+      }
+      else if (*c->json == (f->type == TINY_ARRAY ? ']' : '}'))
+      {
+        c->json++;
+        tiny_parse_close(c, &frame, &e);
+        depth--;
+      }
+      else
+      {
+        ret = f->type == TINY_ARRAY ? TINY_PARSE_MISS_COMMA_OR_SQUARE_BRACKET : TINY_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+      }
       break;
     }
-    c->json++;
-    tiny_parse_whitespace(c);
-    /* parse value */
-    if ((ret = tiny_parse_value(c, &m.v)) != TINY_PARSE_OK)
+  }
+  tiny_free_value(c->a, &e);
+  tiny_parse_unwind(c, frame);
+  return ret;
+}
+
+// 跳过对象的键和冒号，键只在暂存区里解码一下用来校验
+static int tiny_skip_key(tiny_context *c)
+{
+  int ret;
+  char *str;
+  size_t len;
+  if (*c->json != '"')
+    return TINY_PARSE_MISS_KEY;
+  if ((ret = tiny_parse_string_raw(c, &str, &len)) != TINY_PARSE_OK)
+    return ret;
+  tiny_parse_whitespace(c);
+  if (*c->json != ':')
+    return TINY_PARSE_MISS_COLON;
+  c->json++;
+  tiny_parse_whitespace(c);
+  return TINY_PARSE_OK;
+}
+
+// 校验并跳过一个值，不为它分配任何节点、键或字符串。
+// 每层嵌套只在 context 栈上压一个括号字符，错误码和 tiny_parse_value() 相同
+static int tiny_skip_value(tiny_context *c)
+{
+  size_t base = c->top, depth = 0;
+  int ret = TINY_PARSE_OK, state = TINY_STATE_VALUE;
+  char *str, open;
+  size_t len;
+  unsigned flags;
+  tiny_value e;
+  while (ret == TINY_PARSE_OK)
+  {
+    if (state == TINY_STATE_VALUE)
     {
-      break;
+      open = *c->json;
+      if (open == '[' || open == '{')
+      {
+        if (depth >= c->max_depth)
+        {
+          ret = TINY_PARSE_DEPTH_EXCEEDED;
+          break;
+        }
+        PUTC(c, open);
+        depth++;
+        c->json++;
+        tiny_parse_whitespace(c);
+        if (*c->json == (open == '[' ? ']' : '}'))
+        {
+          c->json++;
+          c->top--;
+          depth--;
+          state = TINY_STATE_DONE;
+        }
+        else if (open == '{')
+        {
+          ret = tiny_skip_key(c);
+        }
+      }
+      else
+      {
+        tiny_init(&e);
+        if (open == '"')
+          ret = tiny_parse_string_raw(c, &str, &len);
+        else
+        {
+          // 字面量和数字不分配；数字按惰性模式只做校验，可能溢出的仍然转换一次来报错
+          flags = c->flags;
+          c->flags |= TINY_PARSER_LAZY_NUMBERS;
+          ret = tiny_parse_scalar(c, &e);
+          c->flags = flags;
+        }
+        state = TINY_STATE_DONE;
+      }
     }
-    memcpy(tiny_context_push(c, sizeof(tiny_member)), &m, sizeof(tiny_member));
-    size++;
-    m.k = NULL; /* ownership is transferred to member on stack */
-                /* parse ws [comma | right-curly-brace] ws */
-    tiny_parse_whitespace(c);
-    if (*c->json == ',')
+    else
     {
-      c->json++;
+      if (c->top == base)
+        return TINY_PARSE_OK;
+      open = c->stack[c->top - 1];
       tiny_parse_whitespace(c);
+      if (*c->json == ',')
+      {
+        c->json++;
+        tiny_parse_whitespace(c);
+        state = TINY_STATE_VALUE;
+        if (open == '{')
+          ret = tiny_skip_key(c);
+      }
+      else if (*c->json == (open == '[' ? ']' : '}'))
+      {
+        c->json++;
+        c->top--;
+        depth--;
+      }
+      else
+      {
+        ret = open == '[' ? TINY_PARSE_MISS_COMMA_OR_SQUARE_BRACKET : TINY_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+      }
     }
-    else if (*c->json == '}')
-    {
-      size_t s = sizeof(tiny_member) * size;
-      c->json++;
-      v->type = TINY_OBJECT;
-      v->u.o.size = size;
-      memcpy(v->u.o.m = (tiny_member *) malloc(s), tiny_context_pop(c, s), s);
-      return TINY_PARSE_OK;
-    }
+  }
+  c->top = base;
+  return ret;
+}
+
+// 存储（字符串、元素、成员和键）是单独分配、归自己所有的
+#define TINY_OWNS_STORAGE(v) (((v)->flags & (TINY_FLAG_BORROWED | TINY_FLAG_BLOCK | TINY_FLAG_SHARED)) == 0)
+
+// 共享存储前面的引用计数头，按 double 对齐，后面的节点数组也就是对齐的
+typedef union
+{
+  volatile long refs;
+  double align;
+  void *p;
+} tiny_shared_header;
+
+#define TINY_SHARED_HEADER(p) ((tiny_shared_header *) (p) - 1)
+
+// 字符串、元素数组、成员数组的指针（s.s、a.e 和 o.m 在 union 中位置相同，这里分开取更清楚）
+static void *tiny_storage(const tiny_value *v)
+{
+  return v->type == TINY_STRING ? (void *) v->u.s.s : (void *) v->u.a.e;
+}
+
+static void tiny_shared_retain(const tiny_value *v)
+{
+  TINY_ATOMIC_INC(&TINY_SHARED_HEADER(tiny_storage(v))->refs);
+}
+
+// 放掉一个引用，返回是不是最后一个
+static int tiny_shared_release(const tiny_value *v)
+{
+  return TINY_ATOMIC_DEC(&TINY_SHARED_HEADER(tiny_storage(v))->refs) == 0;
+}
+
+// 只释放 v 这一层的存储，不管子孙
+static void tiny_free_storage(const tiny_allocator *a, const tiny_value *v)
+{
+  if (v->flags & TINY_FLAG_SHARED)
+    TINY_FREE(a, TINY_SHARED_HEADER(tiny_storage(v)));
+  else if (TINY_OWNS_STORAGE(v))
+    TINY_FREE(a, tiny_storage(v));
+}
+
+// 释放一个子节点：叶子当场释放，非空的容器把自身拷贝压入工作栈稍后处理
+static void tiny_free_child(tiny_context *c, const tiny_value *e)
+{
+  if (e->flags & TINY_FLAG_BLOCK)
+  {
+    // 整块分配要等它的子孙都处理完才能释放，单独走一遍
+    tiny_value t;
+    memcpy(&t, e, sizeof(tiny_value));
+    tiny_free_value(c->a, &t);
+    return;
+  }
+  if ((e->flags & TINY_FLAG_SHARED) && !tiny_shared_release(e))
+    return;  // 别的值还在用这份存储和它下面的整棵子树
+  switch (e->type)
+  {
+  case TINY_STRING:
+    tiny_free_storage(c->a, e);
+    break;
+  case TINY_ARRAY:
+  case TINY_OBJECT:
+    if (e->u.a.size > 0)  // a.size 和 o.size 在 union 中位置相同
+      memcpy(tiny_context_push(c, sizeof(tiny_value)), e, sizeof(tiny_value));
     else
+      tiny_free_storage(c->a, e);
+    break;
+  default:
+    break;
+  }
+}
+
+// 顺序扫一遍容器的所有元素，然后释放它的存储。共享的容器到这里时已经放掉了最后一个引用
+static void tiny_free_children(tiny_context *c, const tiny_value *v)
+{
+  size_t i;
+  int owns = TINY_OWNS_STORAGE(v) || (v->flags & TINY_FLAG_SHARED);
+  if (v->type == TINY_ARRAY)
+  {
+    for (i = 0; i < v->u.a.size; i++)
+      tiny_free_child(c, &v->u.a.e[i]);
+    tiny_free_storage(c->a, v);
+  }
+  else
+  {
+    for (i = 0; i < v->u.o.size; i++)
     {
-      ret = TINY_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
-      break;
+      if (owns && (v->flags & TINY_FLAG_KEY_VIEWS) == 0)
+        TINY_FREE(c->a, v->u.o.m[i].k);
+      tiny_free_child(c, &v->u.o.m[i].v);
     }
+    tiny_free_storage(c->a, v);
   }
-  /* Pop and free members on the stack */
-  free(m.k);
-  for (i = 0; i < size; i++)
+}
+
+// 非递归释放，嵌套再深也不会耗尽线程栈
+static void tiny_free_value(const tiny_allocator *a, tiny_value *v)
+{
+  tiny_context c;
+  tiny_value w;
+  void *block = NULL;
+  assert(v != NULL);
+  if ((v->flags & TINY_FLAG_SHARED) && !tiny_shared_release(v))
+    v->type = TINY_NULL;  // 只放掉自己的引用
+  switch (v->type)
   {
-    tiny_member *m = (tiny_member *) tiny_context_pop(c, sizeof(tiny_member));
-    free(m->k);
-    tiny_free(&m->v);
+  case TINY_STRING:
+    if (v->flags & TINY_FLAG_BLOCK)
+      block = v->u.s.s;
+    else
+      tiny_free_storage(a, v);
+    break;
+  case TINY_ARRAY:
+  case TINY_OBJECT:
+    if (v->flags & TINY_FLAG_BLOCK)
+      block = v->u.a.e;
+    tiny_work_init(&c, a);
+    memcpy(&w, v, sizeof(tiny_value));
+    for (;;)
+    {
+      tiny_free_children(&c, &w);
+      if (c.top == 0)
+        break;
+      memcpy(&w, tiny_context_pop(&c, sizeof(tiny_value)), sizeof(tiny_value));
+    }
+    TINY_FREE(a, c.stack);
+    break;
+  default:
+    break;
   }
+  TINY_FREE(a, block);
   v->type = TINY_NULL;
-  return ret;
+  v->flags = 0;
 }
 
-void tiny_free(tiny_value *v)
+static void tiny_copy_value(const tiny_allocator *a, tiny_value *dst, const tiny_value *src);
+
+// 写之前把共享的存储换成自己的一份。只拷这一层，子节点的存储继续共享、计数加一，
+// 所以从根改到某个节点只复制路径上的几层
+static void tiny_unshare(const tiny_allocator *a, tiny_value *v)
 {
-  size_t i;
-  assert(v != NULL);
+  tiny_value old;
+  size_t i, s;
+  int last = TINY_SHARED_HEADER(tiny_storage(v))->refs == 1;  // 没有别人在用，子节点和键直接接手
+  memcpy(&old, v, sizeof(tiny_value));
   switch (v->type)
   {
   case TINY_STRING:
-    free(v->u.s.s);
+    v->u.s.s = tiny_copy_chars(a, old.u.s.s, old.u.s.len);
     break;
   case TINY_ARRAY:
-    for (i = 0; i < v->u.a.size; i++)
+    s = v->u.a.size * sizeof(tiny_value);
+    v->u.a.e = s > 0 ? (tiny_value *) TINY_MALLOC(a, s) : NULL;
+    if (s > 0)
+      memcpy(v->u.a.e, old.u.a.e, s);
+    v->u.a.capacity = v->u.a.size;
+    for (i = 0; i < v->u.a.size && !last; i++)
+      if (v->u.a.e[i].flags & TINY_FLAG_SHARED)
+        tiny_shared_retain(&v->u.a.e[i]);
+    break;
+  default:
+    s = v->u.o.size * sizeof(tiny_member);
+    v->u.o.m = s > 0 ? (tiny_member *) TINY_MALLOC(a, s) : NULL;
+    if (s > 0)
+      memcpy(v->u.o.m, old.u.o.m, s);
+    v->u.o.capacity = v->u.o.size;
+    for (i = 0; i < v->u.o.size && !last; i++)
     {
-      tiny_free(&v->u.a.e[i]);
+      v->u.o.m[i].k = tiny_copy_chars(a, v->u.o.m[i].k, v->u.o.m[i].klen);
+      if (v->u.o.m[i].v.flags & TINY_FLAG_SHARED)
+        tiny_shared_retain(&v->u.o.m[i].v);
     }
-    free(v->u.a.e);
+    break;
+  }
+  v->flags = 0;
+  if (last)
+    TINY_FREE(a, TINY_SHARED_HEADER(tiny_storage(&old)));
+  else
+    tiny_free_value(a, &old);  // 放掉这一层的引用；别的值恰好同时放掉的话，在这里连同子树一起释放
+}
+
+// 把借用的这一层存储拷出来，子节点原样跟过去
+static void tiny_own_level(const tiny_allocator *a, tiny_value *v)
+{
+  size_t i, s;
+  char *p;
+  switch (v->type)
+  {
+  case TINY_STRING:
+    v->u.s.s = tiny_copy_chars(a, v->u.s.s, v->u.s.len);
+    break;
+  case TINY_ARRAY:
+    s = v->u.a.size * sizeof(tiny_value);
+    p = s > 0 ? (char *) TINY_MALLOC(a, s) : NULL;
+    if (s > 0)
+      memcpy(p, v->u.a.e, s);
+    v->u.a.e = (tiny_value *) p;
+    v->u.a.capacity = v->u.a.size;
     break;
   case TINY_OBJECT:
+    s = v->u.o.size * sizeof(tiny_member);
+    p = s > 0 ? (char *) TINY_MALLOC(a, s) : NULL;
+    if (s > 0)
+      memcpy(p, v->u.o.m, s);
+    v->u.o.m = (tiny_member *) p;
+    v->u.o.capacity = v->u.o.size;
     for (i = 0; i < v->u.o.size; i++)
-    {
-      free(v->u.o.m[i].k);
-      tiny_free(&v->u.o.m[i].v);
-    }
-    free(v->u.o.m);
+      v->u.o.m[i].k = tiny_copy_chars(a, v->u.o.m[i].k, v->u.o.m[i].klen);
     break;
   default:
     break;
   }
-  v->type = TINY_NULL;
+  v->flags = 0;
+}
+
+// 在改变 v 的存储（扩容、收缩、删除成员）之前调用，保证存储是 v 自己单独分配的
+static void tiny_own_storage(const tiny_allocator *a, tiny_value *v)
+{
+  tiny_context c;
+  tiny_value *e;
+  size_t i, n;
+  if (v->type == TINY_STRING)
+    tiny_unescape(v);
+  if (v->flags & TINY_FLAG_KEY_VIEWS)
+  {
+    // 成员数组本来就是自己的，只需要把键拷出来
+    for (i = 0; i < v->u.o.size; i++)
+      v->u.o.m[i].k = tiny_copy_chars(a, v->u.o.m[i].k, v->u.o.m[i].klen);
+    v->flags = 0;
+    return;
+  }
+  if (v->flags & TINY_FLAG_SHARED)
+  {
+    tiny_unshare(a, v);
+    return;
+  }
+  if (TINY_OWNS_STORAGE(v))
+    return;
+  if (v->flags & TINY_FLAG_BLOCK)
+  {
+    // 整块的根：子孙都住在这一块里，只能整体拷贝出来再释放
+    tiny_value t;
+    tiny_init(&t);
+    tiny_copy_value(a, &t, v);
+    tiny_free_value(a, v);
+    memcpy(v, &t, sizeof(tiny_value));
+    return;
+  }
+  // 整块里的节点：下面借用的子孙一起拷出来，这样自己的节点下面不会再有指向整块的节点，
+  // 移出整块（tiny_move() 等）时只需要处理借用的节点
+  tiny_own_level(a, v);
+  if ((v->type != TINY_ARRAY && v->type != TINY_OBJECT) || v->u.a.size == 0)
+    return;
+  tiny_work_init(&c, a);
+  memcpy(tiny_context_push(&c, sizeof(tiny_value *)), &v, sizeof(tiny_value *));
+  while (c.top > 0)
+  {
+    memcpy(&v, tiny_context_pop(&c, sizeof(tiny_value *)), sizeof(tiny_value *));
+    n = v->u.a.size;  // a.size 和 o.size 在 union 中位置相同
+    for (i = 0; i < n; i++)
+    {
+      e = v->type == TINY_ARRAY ? &v->u.a.e[i] : &v->u.o.m[i].v;
+      if (e->flags & TINY_FLAG_ESCAPED)
+        tiny_unescape(e);
+      if ((e->flags & TINY_FLAG_BORROWED) == 0)
+        continue;
+      tiny_own_level(a, e);
+      if ((e->type == TINY_ARRAY || e->type == TINY_OBJECT) && e->u.a.size > 0)
+        memcpy(tiny_context_push(&c, sizeof(tiny_value *)), &e, sizeof(tiny_value *));
+    }
+  }
+  TINY_FREE(c.a, c.stack);
+}
+
+// 值要离开它所在的容器时调用：紧凑拷贝里借用整块的节点连同子孙换成自己的存储。
+// 整块的根带着整块走，自己的节点下面没有借用整块的节点，都不用处理
+static void tiny_detach(const tiny_allocator *a, tiny_value *v)
+{
+  if (v->flags & TINY_FLAG_BORROWED)
+    tiny_own_storage(a, v);
+}
+
+void tiny_free(tiny_value *v)
+{
+  tiny_free_value(tiny_global_allocator, v);
+}
+
+void tiny_free_ex(tiny_value *v, const tiny_allocator *a)
+{
+  assert(a != NULL);
+  tiny_free_value(a, v);
 }
 
 const char *tiny_get_string(const tiny_value *v)
 {
   assert(v != NULL && v->type == TINY_STRING);
+  tiny_unescape(v);
   return v->u.s.s;
 }
 
 size_t tiny_get_string_length(const tiny_value *v)
 {
   assert(v != NULL && v->type == TINY_STRING);
+  tiny_unescape(v);
   return v->u.s.len;
 }
 
-void tiny_set_string(tiny_value *v, const char *s, size_t len)
+static void tiny_set_string_value(const tiny_allocator *a, tiny_value *v, const char *s, size_t len)
 {
   assert(v != NULL && (s != NULL || len == 0));
-  tiny_free(v);
-  v->u.s.s = (char *) malloc(len + 1);
-  memcpy(v->u.s.s, s, len);
+  tiny_free_value(a, v);
+  v->u.s.s = (char *) TINY_MALLOC(a, len + 1);
+  if (len > 0)
+    memcpy(v->u.s.s, s, len);
   v->u.s.s[len] = '\0';
   v->u.s.len = len;
   v->type = TINY_STRING;
 }
 
+void tiny_set_string(tiny_value *v, const char *s, size_t len)
+{
+  tiny_set_string_value(tiny_global_allocator, v, s, len);
+}
+
+void tiny_set_string_ex(tiny_value *v, const char *s, size_t len, const tiny_allocator *a)
+{
+  assert(a != NULL);
+  tiny_set_string_value(a, v, s, len);
+}
+
 void tiny_set_array(tiny_value *v, size_t capacity)
 {
-  assert(v != NULL);
-  tiny_free(v);
+  tiny_set_array_ex(v, capacity, tiny_global_allocator);
+}
+
+void tiny_set_array_ex(tiny_value *v, size_t capacity, const tiny_allocator *a)
+{
+  assert(v != NULL && a != NULL);
+  tiny_free_value(a, v);
   v->type = TINY_ARRAY;
   v->u.a.size = 0;
   v->u.a.capacity = capacity;
-  v->u.a.e = capacity > 0 ? (tiny_value *) malloc(capacity * sizeof(tiny_value)) : NULL;
+  v->u.a.e = capacity > 0 ? (tiny_value *) TINY_MALLOC(a, capacity * sizeof(tiny_value)) : NULL;
 }
 
 size_t tiny_get_array_size(const tiny_value *v)
@@ -567,88 +1576,243 @@ size_t tiny_get_array_capacity(const tiny_value *v)
 
 void tiny_reserve_array(tiny_value *v, size_t capacity)
 {
-  assert(v != NULL && v->type == TINY_ARRAY);
+  tiny_reserve_array_ex(v, capacity, tiny_global_allocator);
+}
+
+void tiny_reserve_array_ex(tiny_value *v, size_t capacity, const tiny_allocator *a)
+{
+  assert(v != NULL && v->type == TINY_ARRAY && a != NULL);
+  tiny_own_storage(a, v);
   if (v->u.a.capacity < capacity)
   {
+    v->u.a.e = (tiny_value *) TINY_REALLOC(a, v->u.a.e, v->u.a.capacity * sizeof(tiny_value), capacity * sizeof(tiny_value));
     v->u.a.capacity = capacity;
-    v->u.a.e = (tiny_value *) realloc(v->u.a.e, capacity * sizeof(tiny_value));
   }
 }
 
 void tiny_shrink_array(tiny_value *v)
 {
-  assert(v != NULL && v->type == TINY_ARRAY);
+  tiny_shrink_array_ex(v, tiny_global_allocator);
+}
+
+void tiny_shrink_array_ex(tiny_value *v, const tiny_allocator *a)
+{
+  assert(v != NULL && v->type == TINY_ARRAY && a != NULL);
+  tiny_own_storage(a, v);
   if (v->u.a.capacity > v->u.a.size)
   {
+    v->u.a.e = (tiny_value *) TINY_REALLOC(a, v->u.a.e, v->u.a.capacity * sizeof(tiny_value), v->u.a.size * sizeof(tiny_value));
     v->u.a.capacity = v->u.a.size;
-    v->u.a.e = (tiny_value *) realloc(v->u.a.e, v->u.a.capacity * sizeof(tiny_value));
   }
 }
 
 void tiny_clear_array(tiny_value *v)
+{
+  tiny_clear_array_ex(v, tiny_global_allocator);
+}
+
+void tiny_clear_array_ex(tiny_value *v, const tiny_allocator *a)
 {
   assert(v != NULL && v->type == TINY_ARRAY);
-  tiny_erase_array_element(v, 0, v->u.a.size);
+  tiny_erase_array_element_ex(v, 0, v->u.a.size, a);
 }
 
 tiny_value *tiny_pushback_array_element(tiny_value *v)
+{
+  return tiny_pushback_array_element_ex(v, tiny_global_allocator);
+}
+
+tiny_value *tiny_pushback_array_element_ex(tiny_value *v, const tiny_allocator *a)
 {
   assert(v != NULL && v->type == TINY_ARRAY);
   if (v->u.a.size == v->u.a.capacity)
-    tiny_reserve_array(v, v->u.a.capacity == 0 ? 1 : v->u.a.capacity * 2);
+    tiny_reserve_array_ex(v, v->u.a.capacity == 0 ? 1 : v->u.a.capacity * 2, a);
   tiny_init(&v->u.a.e[v->u.a.size]);
   return &v->u.a.e[v->u.a.size++];
 }
 
 void tiny_popback_array_element(tiny_value *v)
 {
-  assert(v != NULL && v->type == TINY_ARRAY && v->u.a.size > 0);
-  tiny_free(&v->u.a.e[--v->u.a.size]);
+  tiny_popback_array_element_ex(v, tiny_global_allocator);
 }
 
-tiny_value *tiny_insert_array_element(tiny_value *v, size_t index)
+void tiny_popback_array_element_ex(tiny_value *v, const tiny_allocator *a)
 {
-  assert(v != NULL && v->type == TINY_ARRAY && index <= v->u.a.size); /* \todo */
-  return NULL;
+  assert(v != NULL && v->type == TINY_ARRAY && v->u.a.size > 0 && a != NULL);
+  if (v->flags & TINY_FLAG_SHARED)
+    tiny_own_storage(a, v);
+  tiny_free_value(a, &v->u.a.e[--v->u.a.size]);
 }
 
-void tiny_set_object(tiny_value *v, size_t capacity)
+// 在 index 处空出 count 个位置，只做一次扩容和一次 memmove；空位未初始化
+static tiny_value *tiny_open_array_gap(const tiny_allocator *a, tiny_value *v, size_t index, size_t count)
 {
-  assert(v != NULL);
-  tiny_free(v);
-  v->type = TINY_OBJECT;
-  v->u.o.size = 0;
-  v->u.o.capacity = capacity;
-  v->u.o.m = capacity > 0 ? (tiny_member *) malloc(capacity * sizeof(tiny_member)) : NULL;
+  size_t size = v->u.a.size;
+  if (size + count > v->u.a.capacity)
+  {
+    size_t capacity = v->u.a.capacity == 0 ? 1 : v->u.a.capacity * 2;
+    tiny_reserve_array_ex(v, capacity < size + count ? size + count : capacity, a);
+  }
+  else
+  {
+    tiny_own_storage(a, v);
+  }
+  memmove(&v->u.a.e[index + count], &v->u.a.e[index], (size - index) * sizeof(tiny_value));
+  v->u.a.size += count;
+  return &v->u.a.e[index];
 }
 
-size_t tiny_get_object_size(const tiny_value *v)
+tiny_value *tiny_insert_array_element(tiny_value *v, size_t index)
 {
-  assert(v != NULL && v->type == TINY_OBJECT);
-  return v->u.o.size;
+  return tiny_insert_array_element_ex(v, index, tiny_global_allocator);
 }
 
-size_t tiny_get_object_capacity(const tiny_value *v)
+tiny_value *tiny_insert_array_element_ex(tiny_value *v, size_t index, const tiny_allocator *a)
 {
-  assert(v != NULL && v->type == TINY_OBJECT);
-  /* \todo */
-  return 0;
+  tiny_value *e;
+  assert(v != NULL && v->type == TINY_ARRAY && index <= v->u.a.size && a != NULL);
+  e = tiny_open_array_gap(a, v, index, 1);
+  tiny_init(e);
+  return e;
+}
+
+tiny_value *tiny_insert_array_elements(tiny_value *v, size_t index, size_t count)
+{
+  return tiny_insert_array_elements_ex(v, index, count, tiny_global_allocator);
+}
+
+tiny_value *tiny_insert_array_elements_ex(tiny_value *v, size_t index, size_t count, const tiny_allocator *a)
+{
+  size_t i;
+  tiny_value *e;
+  assert(v != NULL && v->type == TINY_ARRAY && index <= v->u.a.size && a != NULL);
+  e = tiny_open_array_gap(a, v, index, count);
+  for (i = 0; i < count; i++)
+    tiny_init(&e[i]);
+  return e;
+}
+
+void tiny_insert_array_values(tiny_value *v, size_t index, tiny_value *values, size_t count)
+{
+  tiny_insert_array_values_ex(v, index, values, count, tiny_global_allocator);
+}
+
+void tiny_insert_array_values_ex(tiny_value *v, size_t index, tiny_value *values, size_t count, const tiny_allocator *a)
+{
+  size_t i;
+  assert(v != NULL && v->type == TINY_ARRAY && index <= v->u.a.size && (values != NULL || count == 0) && a != NULL);
+  if (count == 0)
+    return;
+  for (i = 0; i < count; i++)
+    tiny_detach(a, &values[i]);
+  memcpy(tiny_open_array_gap(a, v, index, count), values, count * sizeof(tiny_value));
+  for (i = 0; i < count; i++)
+    tiny_init(&values[i]);
+}
+
+void tiny_append_array_values(tiny_value *v, tiny_value *values, size_t count)
+{
+  tiny_append_array_values_ex(v, values, count, tiny_global_allocator);
+}
+
+void tiny_append_array_values_ex(tiny_value *v, tiny_value *values, size_t count, const tiny_allocator *a)
+{
+  assert(v != NULL && v->type == TINY_ARRAY);
+  tiny_insert_array_values_ex(v, v->u.a.size, values, count, a);
+}
+
+void tiny_splice_array(tiny_value *dst, size_t index, tiny_value *src)
+{
+  tiny_splice_array_ex(dst, index, src, tiny_global_allocator);
+}
+
+void tiny_splice_array_ex(tiny_value *dst, size_t index, tiny_value *src, const tiny_allocator *a)
+{
+  assert(dst != NULL && src != NULL && dst != src && dst->type == TINY_ARRAY && src->type == TINY_ARRAY && a != NULL);
+  assert(index <= dst->u.a.size);
+  if (src->u.a.size == 0)
+    return;
+  if (!TINY_OWNS_STORAGE(src))
+    tiny_own_storage(a, src);  // 元素会离开 src，不能再住在 src 的整块、所在的整块或共享的存储里
+  memcpy(tiny_open_array_gap(a, dst, index, src->u.a.size), src->u.a.e, src->u.a.size * sizeof(tiny_value));
+  src->u.a.size = 0;
+}
+
+void tiny_set_object(tiny_value *v, size_t capacity)
+{
+  tiny_set_object_ex(v, capacity, tiny_global_allocator);
+}
+
+void tiny_set_object_ex(tiny_value *v, size_t capacity, const tiny_allocator *a)
+{
+  assert(v != NULL && a != NULL);
+  tiny_free_value(a, v);
+  v->type = TINY_OBJECT;
+  v->u.o.size = 0;
+  v->u.o.capacity = capacity;
+  v->u.o.m = capacity > 0 ? (tiny_member *) TINY_MALLOC(a, capacity * sizeof(tiny_member)) : NULL;
+}
+
+size_t tiny_get_object_size(const tiny_value *v)
+{
+  assert(v != NULL && v->type == TINY_OBJECT);
+  return v->u.o.size;
+}
+
+size_t tiny_get_object_capacity(const tiny_value *v)
+{
+  assert(v != NULL && v->type == TINY_OBJECT);
+  return v->u.o.capacity;
 }
 
 void tiny_reserve_object(tiny_value *v, size_t capacity)
 {
-  assert(v != NULL && v->type == TINY_OBJECT); /* \todo */
+  tiny_reserve_object_ex(v, capacity, tiny_global_allocator);
 }
+
+void tiny_reserve_object_ex(tiny_value *v, size_t capacity, const tiny_allocator *a)
+{
+  assert(v != NULL && v->type == TINY_OBJECT && a != NULL);
+  tiny_own_storage(a, v);
+  if (v->u.o.capacity < capacity)
+  {
+    v->u.o.m = (tiny_member *) TINY_REALLOC(a, v->u.o.m, v->u.o.capacity * sizeof(tiny_member), capacity * sizeof(tiny_member));
+    v->u.o.capacity = capacity;
+  }
+}
+
 void tiny_shrink_object(tiny_value *v)
 {
-  assert(v != NULL && v->type == TINY_OBJECT);
-  /* \todo */
+  tiny_shrink_object_ex(v, tiny_global_allocator);
+}
+
+void tiny_shrink_object_ex(tiny_value *v, const tiny_allocator *a)
+{
+  assert(v != NULL && v->type == TINY_OBJECT && a != NULL);
+  tiny_own_storage(a, v);
+  if (v->u.o.capacity > v->u.o.size)
+  {
+    v->u.o.m = (tiny_member *) TINY_REALLOC(a, v->u.o.m, v->u.o.capacity * sizeof(tiny_member), v->u.o.size * sizeof(tiny_member));
+    v->u.o.capacity = v->u.o.size;
+  }
 }
 
 void tiny_clear_object(tiny_value *v)
 {
-  assert(v != NULL && v->type == TINY_OBJECT);
-  /* \todo */
+  tiny_clear_object_ex(v, tiny_global_allocator);
+}
+
+void tiny_clear_object_ex(tiny_value *v, const tiny_allocator *a)
+{
+  size_t i;
+  assert(v != NULL && v->type == TINY_OBJECT && a != NULL);
+  tiny_own_storage(a, v);
+  for (i = 0; i < v->u.o.size; i++)
+  {
+    TINY_FREE(a, v->u.o.m[i].k);
+    tiny_free_value(a, &v->u.o.m[i].v);
+  }
+  v->u.o.size = 0;
 }
 
 const char *tiny_get_object_key(const tiny_value *v, size_t index)
@@ -681,349 +1845,4103 @@ tiny_value *tiny_find_object_value(tiny_value *v, const char *key, size_t klen)
   return index != TINY_KEY_NOT_EXIST ? &v->u.o.m[index].v : NULL;
 }
 
-tiny_value *tiny_set_object_value(tiny_value *v, const char *key, size_t klen)
-{
-  assert(v != NULL && v->type == TINY_OBJECT && key != NULL);
-  /* \todo */
-  return NULL;
-}
-
-void tiny_remove_object_value(tiny_value *v, size_t index)
-{
-  assert(v != NULL && v->type == TINY_OBJECT && index < v->u.o.size);
-  /* \todo */
-}
+#define TINY_HASH_K 0x9E3779B97F4A7C15ULL
 
-static int tiny_parse_value(tiny_context *c, tiny_value *v)
+// 快速的非加密哈希，每次吃 8 个字节；结果只在本进程内有意义（依赖字节序）
+static unsigned long long tiny_hash_bytes(const char *s, size_t len, unsigned long long h)
 {
-  switch (*c->json)
+  unsigned long long w;
+  h ^= len * TINY_HASH_K;
+  while (len >= 8)
   {
-  case 't':
-    return tiny_parse_literal(c, v, "true", TINY_TRUE);
-  case 'f':
-    return tiny_parse_literal(c, v, "false", TINY_FALSE);
-  case 'n':
-    return tiny_parse_literal(c, v, "null", TINY_NULL);
-  case '"':
-    return tiny_parse_string(c, v);
-  case '[':
-    return tiny_parse_array(c, v);
-  case '{':
-    return tiny_parse_object(c, v);
-  case '\0':
-    return TINY_PARSE_EXPECT_VALUE;
-  default:
-    return tiny_parse_number(c, v);
+    memcpy(&w, s, 8);
+    h = (h ^ w) * TINY_HASH_K;
+    h ^= h >> 32;
+    s += 8;
+    len -= 8;
+  }
+  if (len > 0)
+  {
+    w = 0;
+    memcpy(&w, s, len);
+    h = (h ^ w) * TINY_HASH_K;
   }
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  return h;
 }
 
-int tiny_parse(tiny_value *v, const char *json)
+// 对象键的临时开放寻址哈希表，槽里存 成员下标 + 1，0 表示空槽。
+// 重复的键只记录第一个，和 tiny_find_object_index() 的结果一致
+typedef struct
 {
-  int ret;
-  tiny_context c;
-  assert(v != NULL);
-  c.json = json;
-  c.stack = NULL;
-  c.size = c.top = 0;
-  tiny_init(v);
-  tiny_parse_whitespace(&c);
-  if ((ret = tiny_parse_value(&c, v)) == TINY_PARSE_OK)
+  size_t *slots;
+  size_t mask;
+} tiny_key_index;
+
+// 返回 1 表示对象里有重复的键
+static int tiny_key_index_build(const tiny_allocator *a, tiny_key_index *t, const tiny_value *o)
+{
+  size_t i, j, n = 16;
+  int dup = 0;
+  while (n < o->u.o.size * 2)
+    n <<= 1;
+  t->slots = (size_t *) TINY_MALLOC(a, n * sizeof(size_t));
+  memset(t->slots, 0, n * sizeof(size_t));
+  t->mask = n - 1;
+  for (i = 0; i < o->u.o.size; i++)
   {
-    tiny_parse_whitespace(&c);
-    if (*c.json != '\0')
+    const tiny_member *m = &o->u.o.m[i];
+    for (j = (size_t) tiny_hash_bytes(m->k, m->klen, 0) & t->mask; t->slots[j] != 0; j = (j + 1) & t->mask)
     {
-      v->type = TINY_NULL;
-      ret = TINY_PARSE_ROOT_NOT_SINGULAR;
+      const tiny_member *other = &o->u.o.m[t->slots[j] - 1];
+      if (other->klen == m->klen && memcmp(other->k, m->k, m->klen) == 0)
+        break;
     }
+    if (t->slots[j] == 0)
+      t->slots[j] = i + 1;
+    else
+      dup = 1;
   }
-  assert(c.top == 0);
-  free(c.stack);
-  return ret;
+  return dup;
 }
 
-#if 0
-static void tiny_stringify_string(tiny_context *c, const char *s, size_t len)
+static size_t tiny_key_index_find(const tiny_key_index *t, const tiny_value *o, const char *key, size_t klen)
 {
-  size_t i;
-  assert(s != NULL);
-  PUTC(c, '"');
-  for (i = 0; i < len; i++)
+  size_t j;
+  for (j = (size_t) tiny_hash_bytes(key, klen, 0) & t->mask; t->slots[j] != 0; j = (j + 1) & t->mask)
   {
-    unsigned char ch = (unsigned char) s[i];
-    switch (ch)
-    {
-    case '\"':
-      PUTS(c, "\\\"", 2);
-      break;
-    case '\\':
-      PUTS(c, "\\\\", 2);
-      break;
-    case '\b':
-      PUTS(c, "\\b", 2);
-      break;
-    case '\f':
-      PUTS(c, "\\f", 2);
-      break;
-    case '\n':
-      PUTS(c, "\\n", 2);
-      break;
-    case '\r':
-      PUTS(c, "\\r", 2);
-      break;
-    case '\t':
-      PUTS(c, "\\t", 2);
-      break;
-    default:
-      if (ch < 0x20)
-      {
-        char buffer[7];
-        sprintf(buffer, "\\u%04X", ch);
-        PUTS(c, buffer, 6);
-      }
-      else
-        PUTC(c, s[i]);
-    }
+    const tiny_member *m = &o->u.o.m[t->slots[j] - 1];
+    if (m->klen == klen && memcmp(m->k, key, klen) == 0)
+      return t->slots[j] - 1;
   }
-  PUTC(c, '"');
+  return TINY_KEY_NOT_EXIST;
 }
-#else
-static void tiny_stringify_string(tiny_context *c, const char *s, size_t len)
+
+// 建好的表里重复的键改为指向最后一个同名成员
+static void tiny_key_index_keep_last(tiny_key_index *t, const tiny_value *o)
 {
-  static const char hex_digits[] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
-  size_t i, size;
-  char *head, *p;
-  assert(s != NULL);
-  p = head = tiny_context_push(c, size = len * 6 + 2); /* "\u00xx..." */
-  *p++ = '"';
-  for (i = 0; i < len; i++)
+  size_t i, j;
+  for (i = 0; i < o->u.o.size; i++)
   {
-    unsigned char ch = (unsigned char) s[i];
-    switch (ch)
+    const tiny_member *m = &o->u.o.m[i];
+    for (j = (size_t) tiny_hash_bytes(m->k, m->klen, 0) & t->mask;; j = (j + 1) & t->mask)
     {
-    case '\"':
-      *p++ = '\\';
-      *p++ = '\"';
-      break;
-    case '\\':
-      *p++ = '\\';
-      *p++ = '\\';
-      break;
-    case '\b':
-      *p++ = '\\';
-      *p++ = 'b';
-      break;
-    case '\f':
-      *p++ = '\\';
-      *p++ = 'f';
-      break;
-    case '\n':
-      *p++ = '\\';
-      *p++ = 'n';
-      break;
-    case '\r':
-      *p++ = '\\';
-      *p++ = 'r';
-      break;
-    case '\t':
-      *p++ = '\\';
-      *p++ = 't';
-      break;
-    default:
-      if (ch < 0x20)
-      {
-        *p++ = '\\';
-        *p++ = 'u';
-        *p++ = '0';
-        *p++ = '0';
-        *p++ = hex_digits[ch >> 4];
-        *p++ = hex_digits[ch & 15];
-      }
-      else
-        *p++ = s[i];
+      const tiny_member *other = &o->u.o.m[t->slots[j] - 1];
+      if (other->klen == m->klen && memcmp(other->k, m->k, m->klen) == 0)
+        break;
     }
+    t->slots[j] = i + 1;
   }
-  *p++ = '"';
-  c->top -= size - (p - head);
 }
-#endif
 
-static void tiny_stringify_value(tiny_context *c, const tiny_value *v)
+static void tiny_key_index_free(const tiny_allocator *a, tiny_key_index *t)
+{
+  TINY_FREE(a, t->slots);
+  t->slots = NULL;
+}
+
+// index 之后下一个同名成员的下标，没有返回 TINY_KEY_NOT_EXIST
+static size_t tiny_find_next_key(const tiny_value *o, size_t index)
 {
+  const tiny_member *m = &o->u.o.m[index];
   size_t i;
-  switch (v->type)
-  {
-  case TINY_NULL:
-    PUTS(c, "null", 4);
-    break;
-  case TINY_FALSE:
-    PUTS(c, "false", 5);
-    break;
-  case TINY_TRUE:
-    PUTS(c, "true", 4);
-    break;
-  case TINY_NUMBER:
-    c->top -= 32 - sprintf(tiny_context_push(c, 32), "%.17g", v->u.n);
-    break;
-  case TINY_STRING:
-    tiny_stringify_string(c, v->u.s.s, v->u.s.len);
-    break;
-  case TINY_ARRAY:
-    PUTC(c, '[');
-    for (i = 0; i < v->u.a.size; i++)
-    {
-      if (i > 0)
-        PUTC(c, ',');
-      tiny_stringify_value(c, &v->u.a.e[i]);
-    }
-    PUTC(c, ']');
-    break;
-  case TINY_OBJECT:
-    PUTC(c, '{');
-    for (i = 0; i < v->u.o.size; i++)
-    {
-      if (i > 0)
-        PUTC(c, ',');
-      tiny_stringify_string(c, v->u.o.m[i].k, v->u.o.m[i].klen);
-      PUTC(c, ':');
-      tiny_stringify_value(c, &v->u.o.m[i].v);
-    }
-    PUTC(c, '}');
-    break;
-  default:
-    assert(0 && "invalid type");
-  }
+  for (i = index + 1; i < o->u.o.size; i++)
+    if (o->u.o.m[i].klen == m->klen && memcmp(o->u.o.m[i].k, m->k, m->klen) == 0)
+      return i;
+  return TINY_KEY_NOT_EXIST;
 }
 
-char *tiny_stringify(const tiny_value *v, size_t *length)
+// 对象里除了 index 还有没有同名的成员
+static int tiny_key_repeats(const tiny_value *o, size_t index)
 {
-  tiny_context c;
-  assert(v != NULL);
-  c.stack = (char *) malloc(c.size = TINY_PARSE_STRINGIFY_INIT_SIZE);
-  c.top = 0;
-  tiny_stringify_value(&c, v);
-  if (length)
-    *length = c.top;
-  PUTC(&c, '\0');
-  return c.stack;
+  const tiny_member *m = &o->u.o.m[index], *e = o->u.o.m + o->u.o.size, *p;
+  for (p = o->u.o.m; p < e; p++)
+    if (p != m && p->klen == m->klen && memcmp(p->k, m->k, m->klen) == 0)
+      return 1;
+  return 0;
 }
 
-void tiny_copy(tiny_value *dst, const tiny_value *src)
+// 小对象两两比较；大对象看 tiny_key_index_build() 的返回值
+static int tiny_has_duplicate_keys(const tiny_value *o)
 {
-  assert(src != NULL && dst != NULL && src != dst);
-  switch (src->type)
-  {
-  case TINY_STRING:
-    tiny_set_string(dst, src->u.s.s, src->u.s.len);
-    break;
-  case TINY_ARRAY:
-    /* \todo */
-    break;
-  case TINY_OBJECT:
-    /* \todo */
-    break;
-  default:
-    tiny_free(dst);
-    memcpy(dst, src, sizeof(tiny_value));
-    break;
-  }
+  size_t i;
+  for (i = 0; i + 1 < o->u.o.size; i++)
+    if (tiny_find_next_key(o, i) != TINY_KEY_NOT_EXIST)
+      return 1;
+  return 0;
 }
 
-void tiny_move(tiny_value *dst, tiny_value *src)
+tiny_value *tiny_set_object_value(tiny_value *v, const char *key, size_t klen)
 {
-  assert(dst != NULL && src != NULL && src != dst);
-  tiny_free(dst);
-  memcpy(dst, src, sizeof(tiny_value));
-  tiny_init(src);
+  return tiny_set_object_value_ex(v, key, klen, tiny_global_allocator);
 }
 
-void tiny_swap(tiny_value *lhs, tiny_value *rhs)
+tiny_value *tiny_set_object_value_ex(tiny_value *v, const char *key, size_t klen, const tiny_allocator *a)
 {
-  assert(lhs != NULL && rhs != NULL);
-  if (lhs != rhs)
+  size_t index;
+  tiny_member *m;
+  assert(v != NULL && v->type == TINY_OBJECT && key != NULL && a != NULL);
+  if ((index = tiny_find_object_index(v, key, klen)) != TINY_KEY_NOT_EXIST)
   {
-    tiny_value temp;
-    memcpy(&temp, lhs, sizeof(tiny_value));
-    memcpy(lhs, rhs, sizeof(tiny_value));
-    memcpy(rhs, &temp, sizeof(tiny_value));
+    if (v->flags & TINY_FLAG_SHARED)
+      tiny_own_storage(a, v);  // 返回的成员会被改写
+    return &v->u.o.m[index].v;
   }
+  // 和 tiny_pushback_array_element() 一样按 2 倍扩容
+  if (v->u.o.size == v->u.o.capacity)
+    tiny_reserve_object_ex(v, v->u.o.capacity == 0 ? 1 : v->u.o.capacity * 2, a);
+  else
+    tiny_own_storage(a, v);
+  m = &v->u.o.m[v->u.o.size++];
+  m->k = (char *) TINY_MALLOC(a, klen + 1);
+  memcpy(m->k, key, klen);
+  m->k[klen] = '\0';
+  m->klen = klen;
+  tiny_init(&m->v);
+  return &m->v;
+}
+
+void tiny_remove_object_value(tiny_value *v, size_t index)
+{
+  tiny_remove_object_value_ex(v, index, tiny_global_allocator);
+}
+
+void tiny_remove_object_value_ex(tiny_value *v, size_t index, const tiny_allocator *a)
+{
+  tiny_member *m;
+  assert(v != NULL && v->type == TINY_OBJECT && index < v->u.o.size && a != NULL);
+  tiny_own_storage(a, v);
+  m = &v->u.o.m[index];
+  TINY_FREE(a, m->k);
+  tiny_free_value(a, &m->v);
+  memmove(m, m + 1, (--v->u.o.size - index) * sizeof(tiny_member));
+}
+
+void tiny_swap_remove_object_value(tiny_value *v, size_t index)
+{
+  tiny_swap_remove_object_value_ex(v, index, tiny_global_allocator);
+}
+
+void tiny_swap_remove_object_value_ex(tiny_value *v, size_t index, const tiny_allocator *a)
+{
+  tiny_member *m;
+  assert(v != NULL && v->type == TINY_OBJECT && index < v->u.o.size && a != NULL);
+  tiny_own_storage(a, v);
+  m = &v->u.o.m[index];
+  TINY_FREE(a, m->k);
+  tiny_free_value(a, &m->v);
+  // 用最后一个成员填洞，O(1)，但打乱成员顺序
+  if (index != --v->u.o.size)
+    memcpy(m, &v->u.o.m[v->u.o.size], sizeof(tiny_member));
+}
+
+static int tiny_parse_root(tiny_context *c, tiny_value *v)
+{
+  int ret;
+  tiny_init(v);
+  tiny_parse_whitespace(c);
+  if ((ret = tiny_parse_value(c, v)) == TINY_PARSE_OK)
+  {
+    tiny_parse_whitespace(c);
+    if (*c->json != '\0')
+    {
+      tiny_free_value(c->a, v);
+      ret = TINY_PARSE_ROOT_NOT_SINGULAR;
+    }
+  }
+  assert(c->top == 0);
+  return ret;
+}
+
+int tiny_parse_ex(tiny_value *v, const char *json, const tiny_allocator *a)
+{
+  int ret;
+  tiny_context c;
+  assert(v != NULL && a != NULL);
+  c.json = json;
+  c.stack = NULL;
+  c.size = c.top = 0;
+  c.a = a;
+  c.max_depth = TINY_PARSE_MAX_DEPTH;
+  c.flags = 0;
+#ifdef TINY_ENABLE_STATS
+  c.stats = NULL;
+#endif
+  ret = tiny_parse_root(&c, v);
+  TINY_FREE(a, c.stack);
+  return ret;
+}
+
+int tiny_parse(tiny_value *v, const char *json)
+{
+  return tiny_parse_ex(v, json, tiny_global_allocator);
+}
+
+void tiny_parser_init(tiny_parser *p, const tiny_allocator *a)
+{
+  assert(p != NULL);
+  p->stack = NULL;
+  p->size = 0;
+  p->a = a != NULL ? a : tiny_global_allocator;
+  p->max_depth = TINY_PARSE_MAX_DEPTH;
+  p->flags = 0;
+}
+
+void tiny_parser_set_max_depth(tiny_parser *p, size_t max_depth)
+{
+  assert(p != NULL);
+  p->max_depth = max_depth;
+}
+
+void tiny_parser_set_flags(tiny_parser *p, unsigned flags)
+{
+  assert(p != NULL);
+  p->flags = flags;
+}
+
+int tiny_parser_parse(tiny_parser *p, tiny_value *v, const char *json)
+{
+  int ret;
+  tiny_context c;
+  assert(p != NULL && v != NULL);
+  c.json = json;
+  c.stack = p->stack;
+  c.size = p->size;
+  c.top = 0;
+  c.a = p->a;
+  c.max_depth = p->max_depth;
+  c.flags = p->flags;
+#ifdef TINY_ENABLE_STATS
+  c.stats = NULL;
+#endif
+  ret = tiny_parse_root(&c, v);
+  // 保留已经扩好的栈，下次直接复用
+  p->stack = c.stack;
+  p->size = c.size;
+  return ret;
+}
+
+// 把暂存区收缩到不超过 keep 字节，用于处理过一个超大的输入之后
+static void tiny_scratch_trim(const tiny_allocator *a, char **stack, size_t *size, size_t keep)
+{
+  if (*size > keep)
+  {
+    *stack = (char *) TINY_REALLOC(a, *stack, *size, keep);
+    *size = keep;
+  }
+}
+
+void tiny_parser_reset(tiny_parser *p, size_t keep)
+{
+  assert(p != NULL);
+  tiny_scratch_trim(p->a, &p->stack, &p->size, keep);
+}
+
+void tiny_parser_destroy(tiny_parser *p)
+{
+  assert(p != NULL);
+  TINY_FREE(p->a, p->stack);
+  p->stack = NULL;
+  p->size = 0;
+}
+
+// 括号里逐个字节配对。深度回到 0 时返回 1，*p 停在下一个位置；否则返回 0，*p 停在 end（转义的反斜杠在最后时多一个字节）
+static int tiny_resync_bytes(const char **p, const char *end, size_t *depth, int *in_string)
+{
+  const char *s;
+  for (s = *p; s < end; s++)
+  {
+    if (*in_string)
+    {
+      if (*s == '\\')
+        s++;
+      else if (*s == '"')
+        *in_string = 0;
+    }
+    else if (*s == '"')
+    {
+      *in_string = 1;
+    }
+    else if (*s == '[' || *s == '{')
+    {
+      ++*depth;
+    }
+    else if ((*s == ']' || *s == '}') && --*depth == 0)
+    {
+      *p = s + 1;
+      return 1;
+    }
+  }
+  *p = s;
+  return 0;
+}
+
+#ifdef TINY_SSE2
+// 一次看 16 个字节：引号的前缀异或就是每个字节在不在字符串里，只有字符串外的括号要逐个数。
+// 带反斜杠的块逐个字节处理
+static int tiny_resync_blocks(const char **p, const char *end, size_t *depth, int *in_string)
+{
+  __m128i x;
+  unsigned quotes, inside, brackets, opens;
+  const char *s = *p;
+  while (end - s >= 16)
+  {
+    x = _mm_loadu_si128((const __m128i *) s);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('\\'))) != 0)
+    {
+      *p = s;
+      if (tiny_resync_bytes(p, s + 16, depth, in_string))
+        return 1;
+      s = *p;
+      continue;
+    }
+    quotes = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('"')));
+    inside = quotes ^ (quotes << 1);
+    inside ^= inside << 2;
+    inside ^= inside << 4;
+    inside ^= inside << 8;
+    if (*in_string)
+      inside = ~inside;
+    *in_string = (inside >> 15) & 1;
+    opens = (unsigned) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('[')), _mm_cmpeq_epi8(x, _mm_set1_epi8('{'))));
+    brackets = (unsigned) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(']')), _mm_cmpeq_epi8(x, _mm_set1_epi8('}'))));
+    for (brackets = (brackets | opens) & ~inside & 0xFFFF; brackets != 0; brackets &= brackets - 1)
+    {
+      if (opens & brackets & -brackets)
+      {
+        ++*depth;
+      }
+      else if (--*depth == 0)
+      {
+        *p = s + __builtin_ctz(brackets) + 1;
+        return 1;
+      }
+    }
+    s += 16;
+  }
+  *p = s;
+  return tiny_resync_bytes(p, end, depth, in_string);
+}
+#endif
+
+// 找这份文档的结尾：只配对括号、跳过字符串，不做校验；至少前进一个字节。
+// 解析同一份文档时读到的不会超过这里，后面最多再看一个字节
+static const char *tiny_resync(const char *p, const char *end)
+{
+  size_t depth = 1;
+  int in_string = 0;
+  switch (*p)
+  {
+  case '"':
+    for (p++; p < end && *p != '"'; p++)
+      if (*p == '\\' && p + 1 < end)
+        p++;
+    break;
+  case '[':
+  case '{':
+    p++;
+#ifdef TINY_SSE2
+    tiny_resync_blocks(&p, end, &depth, &in_string);
+#else
+    tiny_resync_bytes(&p, end, &depth, &in_string);
+#endif
+    return p < end ? p : end;
+  case ']':
+  case '}':
+    break;
+  default:
+    // 顶层的标量走到空白或者下一个值的开头为止
+    while (p + 1 < end && strchr(" \t\n\r[{\"", p[1]) == NULL)
+      p++;
+    break;
+  }
+  p++;
+  return p < end ? p : end;
+}
+
+int tiny_parser_parse_many(tiny_parser *p, const char *buf, size_t len, tiny_parse_many_callback cb, void *ud)
+{
+  tiny_context c;
+  tiny_value v;
+  char *text;
+  const char *begin, *next, *end;
+  int ret, first = TINY_PARSE_OK, stop = 0;
+  assert(p != NULL && (buf != NULL || len == 0) && cb != NULL);
+  if (len == 0)
+    return TINY_PARSE_OK;
+  end = buf + len;
+  c.json = buf;
+  c.stack = p->stack;
+  c.size = p->size;
+  c.top = 0;
+  c.a = p->a;
+  c.max_depth = p->max_depth;
+  c.flags = p->flags;
+#ifdef TINY_ENABLE_STATS
+  c.stats = NULL;
+#endif
+  while (!stop)
+  {
+    // 缓冲区不一定以 '\0' 结尾，空白也不能读过 end
+    while (c.json < end && (*c.json == ' ' || *c.json == '\t' || *c.json == '\n' || *c.json == '\r'))
+      c.json++;
+    if (c.json >= end)
+      break;
+    begin = c.json;
+    tiny_init(&v);
+    // 解析最多读到配对括号找到的结尾后面一个字节：后面还有字节就直接在 buf 里解析，
+    // 一直到 end 的最后一份文档拷出来补上 '\0'，解析完马上 materialize，不引用这份拷贝
+    next = tiny_resync(begin, end);
+    if (next < end)
+    {
+      ret = tiny_parse_value(&c, &v);
+    }
+    else
+    {
+      text = (char *) TINY_MALLOC(c.a, end - begin + 1);
+      memcpy(text, begin, end - begin);
+      text[end - begin] = '\0';
+      c.json = text;
+      if ((ret = tiny_parse_value(&c, &v)) == TINY_PARSE_OK)
+        tiny_materialize_ex(&v, c.a);
+      c.json = begin + (c.json - text);
+      TINY_FREE(c.a, text);
+    }
+    if (ret != TINY_PARSE_OK)
+    {
+      c.json = next;
+      if (first == TINY_PARSE_OK)
+        first = ret;
+    }
+    stop = cb(ud, &v, ret, (size_t) (begin - buf), (size_t) (c.json - buf));
+    tiny_free_value(c.a, &v);
+  }
+  p->stack = c.stack;
+  p->size = c.size;
+  return first;
+}
+
+int tiny_parse_many(const char *buf, size_t len, tiny_parse_many_callback cb, void *ud)
+{
+  tiny_parser p;
+  int ret;
+  tiny_parser_init(&p, NULL);
+  ret = tiny_parser_parse_many(&p, buf, len, cb, ud);
+  tiny_parser_destroy(&p);
+  return ret;
+}
+
+#ifdef TINY_ENABLE_STATS
+int tiny_parse_with_stats(tiny_value *v, const char *json, tiny_parse_stats *stats)
+{
+  int ret;
+  unsigned long long t0 = tiny_cycles();
+  tiny_context c;
+  assert(v != NULL && stats != NULL);
+  c.json = json;
+  c.stack = NULL;
+  c.size = c.top = 0;
+  c.a = tiny_global_allocator;
+  c.stats = stats;
+  c.max_depth = TINY_PARSE_MAX_DEPTH;
+  c.flags = 0;
+  ret = tiny_parse_root(&c, v);
+  TINY_FREE(c.a, c.stack);
+  stats->parse_cycles += tiny_cycles() - t0;
+  return ret;
+}
+#endif
+
+#if 0
+static void tiny_stringify_string(tiny_context *c, const char *s, size_t len)
+{
+  size_t i;
+  assert(s != NULL);
+  PUTC(c, '"');
+  for (i = 0; i < len; i++)
+  {
+    unsigned char ch = (unsigned char) s[i];
+    switch (ch)
+    {
+    case '\"':
+      PUTS(c, "\\\"", 2);
+      break;
+    case '\\':
+      PUTS(c, "\\\\", 2);
+      break;
+    case '\b':
+      PUTS(c, "\\b", 2);
+      break;
+    case '\f':
+      PUTS(c, "\\f", 2);
+      break;
+    case '\n':
+      PUTS(c, "\\n", 2);
+      break;
+    case '\r':
+      PUTS(c, "\\r", 2);
+      break;
+    case '\t':
+      PUTS(c, "\\t", 2);
+      break;
+    default:
+      if (ch < 0x20)
+      {
+        char buffer[7];
+        sprintf(buffer, "\\u%04X", ch);
+        PUTS(c, buffer, 6);
+      }
+      else
+        PUTC(c, s[i]);
+    }
+  }
+  PUTC(c, '"');
+}
+#else
+// 写出 ch 的转义序列，返回长度（2 或 6）
+static size_t tiny_escape_char(unsigned char ch, char *esc)
+{
+  static const char hex_digits[] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
+  esc[0] = '\\';
+  switch (ch)
+  {
+  case '\"':
+    esc[1] = '\"';
+    return 2;
+  case '\\':
+    esc[1] = '\\';
+    return 2;
+  case '\b':
+    esc[1] = 'b';
+    return 2;
+  case '\f':
+    esc[1] = 'f';
+    return 2;
+  case '\n':
+    esc[1] = 'n';
+    return 2;
+  case '\r':
+    esc[1] = 'r';
+    return 2;
+  case '\t':
+    esc[1] = 't';
+    return 2;
+  default:
+    assert(ch < 0x20);
+    esc[1] = 'u';
+    esc[2] = '0';
+    esc[3] = '0';
+    esc[4] = hex_digits[ch >> 4];
+    esc[5] = hex_digits[ch & 15];
+    return 6;
+  }
+}
+
+// 不需要转义的一段整体拷贝，只为真正遇到的转义字符额外占用空间
+static void tiny_stringify_string(tiny_context *c, const char *s, size_t len)
+{
+  const char *end = s + len, *run;
+  size_t n;
+  assert(s != NULL || len == 0);
+  PUTC(c, '"');
+  for (;;)
+  {
+    run = s;
+    s = tiny_find_escape(s, end);
+    if (s != run)
+      PUTS(c, run, s - run);
+    if (s == end)
+      break;
+    n = tiny_escape_char((unsigned char) *s++, tiny_context_push(c, 6));
+    c->top -= 6 - n;
+    STAT_ADD(c, escape_bytes, n);
+  }
+  PUTC(c, '"');
+}
+#endif
+
+// 输出时遍历容器用的栈。浅的文档只用局部数组，不分配；超过 TINY_WRITE_LOCAL_DEPTH 层才借助堆上的工作栈
+#define TINY_WRITE_LOCAL_DEPTH 32
+
+typedef struct
+{
+  const tiny_value *v;  // 正在输出的容器
+  size_t i;             // 下一个要输出的子节点
+} tiny_write_frame;
+
+typedef struct
+{
+  tiny_write_frame local[TINY_WRITE_LOCAL_DEPTH];
+  size_t depth;
+  tiny_context spill;
+} tiny_write_stack;
+
+// 返回新的栈顶
+static tiny_write_frame *tiny_write_push(tiny_write_stack *s, const tiny_value *v)
+{
+  tiny_write_frame *f;
+  if (s->depth < TINY_WRITE_LOCAL_DEPTH)
+    f = &s->local[s->depth];
+  else
+    f = (tiny_write_frame *) tiny_context_push(&s->spill, sizeof(tiny_write_frame));
+  f->v = v;
+  f->i = 0;
+  s->depth++;
+  return f;
+}
+
+// 返回弹出后的栈顶，栈空了返回 NULL
+static tiny_write_frame *tiny_write_pop(tiny_write_stack *s)
+{
+  if (s->depth-- > TINY_WRITE_LOCAL_DEPTH)
+    tiny_context_pop(&s->spill, sizeof(tiny_write_frame));
+  if (s->depth == 0)
+    return NULL;
+  if (s->depth <= TINY_WRITE_LOCAL_DEPTH)
+    return &s->local[s->depth - 1];
+  return (tiny_write_frame *) (s->spill.stack + s->spill.top - sizeof(tiny_write_frame));
+}
+
+
+static void tiny_stringify_scalar(tiny_context *c, const tiny_value *v)
+{
+  switch (v->type)
+  {
+  case TINY_NULL:
+    PUTS(c, "null", 4);
+    break;
+  case TINY_FALSE:
+    PUTS(c, "false", 5);
+    break;
+  case TINY_TRUE:
+    PUTS(c, "true", 4);
+    break;
+  case TINY_NUMBER:
+    if (v->flags & TINY_FLAG_RAW_NUMBER)
+      PUTS(c, v->u.r.p, v->u.r.len);
+    else
+      c->top -= 32 - sprintf(tiny_context_push(c, 32), "%.17g", v->u.n);
+    break;
+  case TINY_STRING:
+    if (v->flags & TINY_FLAG_ESCAPED)
+    {
+      // 没读过的原文本身就是合法的 JSON 字符串内容
+      PUTC(c, '"');
+      PUTS(c, v->u.s.s, v->u.s.len);
+      PUTC(c, '"');
+    }
+    else
+    {
+      tiny_stringify_string(c, v->u.s.s, v->u.s.len);
+    }
+    break;
+  default:
+    assert(0 && "invalid type");
+  }
+}
+
+// 非递归：容器入栈，写完最后一个子节点时补上收尾的括号
+static void tiny_stringify_value(tiny_context *c, const tiny_value *v)
+{
+  tiny_write_stack s;
+  tiny_write_frame *f;
+  const tiny_member *m;
+  f = NULL;
+  s.depth = 0;
+  tiny_work_init(&s.spill, c->a);
+  for (;;)
+  {
+    STAT_ADD(c, type_count[v->type], 1);
+    if (v->type == TINY_ARRAY || v->type == TINY_OBJECT)
+    {
+      PUTC(c, v->type == TINY_ARRAY ? '[' : '{');
+      f = tiny_write_push(&s, v);
+    }
+    else
+    {
+      tiny_stringify_scalar(c, v);
+    }
+    while (f != NULL && f->i == f->v->u.a.size)  // a.size 和 o.size 在 union 中位置相同
+    {
+      PUTC(c, f->v->type == TINY_ARRAY ? ']' : '}');
+      f = tiny_write_pop(&s);
+    }
+    if (f == NULL)
+      break;
+    if (f->i > 0)
+      PUTC(c, ',');
+    if (f->v->type == TINY_ARRAY)
+    {
+      v = &f->v->u.a.e[f->i++];
+    }
+    else
+    {
+      m = &f->v->u.o.m[f->i++];
+      tiny_stringify_string(c, m->k, m->klen);
+      PUTC(c, ':');
+      v = &m->v;
+    }
+  }
+  TINY_FREE(s.spill.a, s.spill.stack);
+}
+
+char *tiny_stringify_ex(const tiny_value *v, size_t *length, const tiny_allocator *a)
+{
+  tiny_context c;
+  assert(v != NULL && a != NULL);
+  c.a = a;
+  c.stack = (char *) TINY_MALLOC(a, c.size = TINY_PARSE_STRINGIFY_INIT_SIZE);
+  c.top = 0;
+#ifdef TINY_ENABLE_STATS
+  c.stats = NULL;
+#endif
+  tiny_stringify_value(&c, v);
+  if (length)
+    *length = c.top;
+  PUTC(&c, '\0');
+  return c.stack;
+}
+
+char *tiny_stringify(const tiny_value *v, size_t *length)
+{
+  return tiny_stringify_ex(v, length, tiny_global_allocator);
+}
+
+void tiny_stringifier_init(tiny_stringifier *s, const tiny_allocator *a)
+{
+  assert(s != NULL);
+  s->buffer = NULL;
+  s->size = 0;
+  s->a = a != NULL ? a : tiny_global_allocator;
+}
+
+const char *tiny_stringifier_run(tiny_stringifier *s, const tiny_value *v, size_t *length)
+{
+  tiny_context c;
+  assert(s != NULL && v != NULL);
+  c.a = s->a;
+  c.stack = s->buffer;
+  c.size = s->size;
+  c.top = 0;
+#ifdef TINY_ENABLE_STATS
+  c.stats = NULL;
+#endif
+  tiny_stringify_value(&c, v);
+  if (length)
+    *length = c.top;
+  PUTC(&c, '\0');
+  s->buffer = c.stack;
+  s->size = c.size;
+  return c.stack;
+}
+
+void tiny_stringifier_reset(tiny_stringifier *s, size_t keep)
+{
+  assert(s != NULL);
+  tiny_scratch_trim(s->a, &s->buffer, &s->size, keep);
+}
+
+void tiny_stringifier_destroy(tiny_stringifier *s)
+{
+  assert(s != NULL);
+  TINY_FREE(s->a, s->buffer);
+  s->buffer = NULL;
+  s->size = 0;
+}
+
+typedef struct
+{
+  char *p;     // 输出位置
+  size_t left;  // 剩余容量；放不下之后清零，只计数不再写
+  size_t n;     // 完整输出需要的字节数
+} tiny_writer;
+
+static void tiny_writer_puts(tiny_writer *w, const char *s, size_t len)
+{
+  if (len == 0)
+    return;
+  if (w->left >= len)
+  {
+    memcpy(w->p, s, len);
+    w->p += len;
+    w->left -= len;
+  }
+  else
+  {
+    w->left = 0;
+  }
+  w->n += len;
+}
+
+static void tiny_write_string(tiny_writer *w, const char *s, size_t len)
+{
+  const char *end = s + len, *run;
+  char esc[6];
+  tiny_writer_puts(w, "\"", 1);
+  for (;;)
+  {
+    run = s;
+    s = tiny_find_escape(s, end);
+    tiny_writer_puts(w, run, s - run);
+    if (s == end)
+      break;
+    tiny_writer_puts(w, esc, tiny_escape_char((unsigned char) *s++, esc));
+  }
+  tiny_writer_puts(w, "\"", 1);
+}
+
+static void tiny_write_scalar(tiny_writer *w, const tiny_value *v)
+{
+  char buffer[32];
+  switch (v->type)
+  {
+  case TINY_NULL:
+    tiny_writer_puts(w, "null", 4);
+    break;
+  case TINY_FALSE:
+    tiny_writer_puts(w, "false", 5);
+    break;
+  case TINY_TRUE:
+    tiny_writer_puts(w, "true", 4);
+    break;
+  case TINY_NUMBER:
+    if (v->flags & TINY_FLAG_RAW_NUMBER)
+      tiny_writer_puts(w, v->u.r.p, v->u.r.len);
+    else
+      tiny_writer_puts(w, buffer, sprintf(buffer, "%.17g", v->u.n));
+    break;
+  case TINY_STRING:
+    if (v->flags & TINY_FLAG_ESCAPED)
+    {
+      tiny_writer_puts(w, "\"", 1);
+      tiny_writer_puts(w, v->u.s.s, v->u.s.len);
+      tiny_writer_puts(w, "\"", 1);
+    }
+    else
+    {
+      tiny_write_string(w, v->u.s.s, v->u.s.len);
+    }
+    break;
+  default:
+    assert(0 && "invalid type");
+  }
+}
+
+// 和 tiny_stringify_value() 一样的非递归遍历
+static void tiny_write_value(tiny_writer *w, const tiny_value *v)
+{
+  tiny_write_stack s;
+  tiny_write_frame *f;
+  const tiny_member *m;
+  f = NULL;
+  s.depth = 0;
+  tiny_work_init(&s.spill, tiny_global_allocator);
+  for (;;)
+  {
+    if (v->type == TINY_ARRAY || v->type == TINY_OBJECT)
+    {
+      tiny_writer_puts(w, v->type == TINY_ARRAY ? "[" : "{", 1);
+      f = tiny_write_push(&s, v);
+    }
+    else
+    {
+      tiny_write_scalar(w, v);
+    }
+    while (f != NULL && f->i == f->v->u.a.size)
+    {
+      tiny_writer_puts(w, f->v->type == TINY_ARRAY ? "]" : "}", 1);
+      f = tiny_write_pop(&s);
+    }
+    if (f == NULL)
+      break;
+    if (f->i > 0)
+      tiny_writer_puts(w, ",", 1);
+    if (f->v->type == TINY_ARRAY)
+    {
+      v = &f->v->u.a.e[f->i++];
+    }
+    else
+    {
+      m = &f->v->u.o.m[f->i++];
+      tiny_write_string(w, m->k, m->klen);
+      tiny_writer_puts(w, ":", 1);
+      v = &m->v;
+    }
+  }
+  TINY_FREE(s.spill.a, s.spill.stack);
+}
+
+size_t tiny_stringify_size(const tiny_value *v)
+{
+  return tiny_stringify_into(v, NULL, 0);
+}
+
+size_t tiny_stringify_into(const tiny_value *v, char *buf, size_t cap)
+{
+  tiny_writer w;
+  assert(v != NULL && (buf != NULL || cap == 0));
+  w.p = buf;
+  w.left = cap;
+  w.n = 0;
+  tiny_write_value(&w, v);
+  if (w.n < cap)
+    buf[w.n] = '\0';
+  return w.n;
+}
+
+#ifdef TINY_ENABLE_STATS
+char *tiny_stringify_with_stats(const tiny_value *v, size_t *length, tiny_parse_stats *stats)
+{
+  unsigned long long t0 = tiny_cycles();
+  tiny_context c;
+  assert(v != NULL && stats != NULL);
+  c.a = tiny_global_allocator;
+  c.stack = (char *) TINY_MALLOC(c.a, c.size = TINY_PARSE_STRINGIFY_INIT_SIZE);
+  c.top = 0;
+  c.stats = stats;
+  STAT_ADD(&c, alloc_count, 1);
+  STAT_ADD(&c, alloc_bytes, c.size);
+  STAT_MAX(&c, stack_peak, c.size);
+  tiny_stringify_value(&c, v);
+  if (length)
+    *length = c.top;
+  PUTC(&c, '\0');
+  stats->stringify_cycles += tiny_cycles() - t0;
+  return c.stack;
+}
+#endif
+
+// MessagePack：整数和浮点数都还原成 double；字符串和容器带长度前缀，解码时一次分配到位
+typedef struct
+{
+  const tiny_value *v;
+  const tiny_member *m;  // 非 NULL 时先写键，再写 m->v
+} tiny_msgpack_work;
+
+// 写一个类型字节和 bytes 个字节的大端整数
+static void tiny_msgpack_put(tiny_context *c, unsigned char tag, unsigned long long n, size_t bytes)
+{
+  unsigned char *p = (unsigned char *) tiny_context_push(c, bytes + 1);
+  p[0] = tag;
+  for (; bytes > 0; bytes--, n >>= 8)
+    p[bytes] = (unsigned char) n;
+}
+
+// 长度能放进 fix 形式就用 fix，否则选最短的 8/16/32 位长度；tag16 + 1 是 32 位形式
+static void tiny_msgpack_put_header(tiny_context *c, unsigned char fix, size_t fix_max, unsigned char tag8, unsigned char tag16, size_t n)
+{
+  assert((unsigned long long) n <= 0xffffffffULL && "too long for MessagePack");
+  if (n <= fix_max)
+    PUTC(c, (char) (fix | n));
+  else if (n <= 0xff && tag8 != 0)
+    tiny_msgpack_put(c, tag8, n, 1);
+  else if (n <= 0xffff)
+    tiny_msgpack_put(c, tag16, n, 2);
+  else
+    tiny_msgpack_put(c, (unsigned char) (tag16 + 1), n, 4);
+}
+
+static void tiny_msgpack_put_string(tiny_context *c, const char *s, size_t len)
+{
+  tiny_msgpack_put_header(c, 0xa0, 31, 0xd9, 0xda, len);
+  if (len > 0)
+    PUTS(c, s, len);
+}
+
+// 整数值用最短的整数编码，-0 和小数保留为 float64
+static void tiny_msgpack_put_number(tiny_context *c, double n)
+{
+  unsigned long long u;
+  long long i;
+  memcpy(&u, &n, sizeof(double));
+  if (n >= 0 && n < 18446744073709551616.0 && n == (double) (unsigned long long) n && (u >> 63) == 0)
+  {
+    u = (unsigned long long) n;
+    if (u < 0x80)
+      PUTC(c, (char) u);
+    else if (u <= 0xff)
+      tiny_msgpack_put(c, 0xcc, u, 1);
+    else if (u <= 0xffff)
+      tiny_msgpack_put(c, 0xcd, u, 2);
+    else if (u <= 0xffffffffULL)
+      tiny_msgpack_put(c, 0xce, u, 4);
+    else
+      tiny_msgpack_put(c, 0xcf, u, 8);
+  }
+  else if (n < 0 && n >= -9223372036854775808.0 && n == (double) (long long) n)
+  {
+    i = (long long) n;
+    if (i >= -32)
+      PUTC(c, (char) (unsigned char) i);
+    else if (i >= -128)
+      tiny_msgpack_put(c, 0xd0, (unsigned long long) i, 1);
+    else if (i >= -32768)
+      tiny_msgpack_put(c, 0xd1, (unsigned long long) i, 2);
+    else if (i >= -2147483647LL - 1)
+      tiny_msgpack_put(c, 0xd2, (unsigned long long) i, 4);
+    else
+      tiny_msgpack_put(c, 0xd3, (unsigned long long) i, 8);
+  }
+  else
+  {
+    tiny_msgpack_put(c, 0xcb, u, 8);
+  }
+}
+
+// 写出一个值的头部；容器的子节点逆序压入工作栈，出栈时就是原来的顺序
+static void tiny_msgpack_put_value(tiny_context *c, tiny_context *work, const tiny_value *v)
+{
+  tiny_msgpack_work w;
+  size_t i;
+  switch (v->type)
+  {
+  case TINY_NULL:
+    PUTC(c, (char) 0xc0);
+    break;
+  case TINY_FALSE:
+    PUTC(c, (char) 0xc2);
+    break;
+  case TINY_TRUE:
+    PUTC(c, (char) 0xc3);
+    break;
+  case TINY_NUMBER:
+    tiny_msgpack_put_number(c, tiny_number(v));
+    break;
+  case TINY_STRING:
+    tiny_unescape(v);
+    tiny_msgpack_put_string(c, v->u.s.s, v->u.s.len);
+    break;
+  case TINY_ARRAY:
+    tiny_msgpack_put_header(c, 0x90, 15, 0, 0xdc, v->u.a.size);
+    w.m = NULL;
+    for (i = v->u.a.size; i-- > 0;)
+    {
+      w.v = &v->u.a.e[i];
+      memcpy(tiny_context_push(work, sizeof(tiny_msgpack_work)), &w, sizeof(tiny_msgpack_work));
+    }
+    break;
+  case TINY_OBJECT:
+    tiny_msgpack_put_header(c, 0x80, 15, 0, 0xde, v->u.o.size);
+    w.v = NULL;
+    for (i = v->u.o.size; i-- > 0;)
+    {
+      w.m = &v->u.o.m[i];
+      memcpy(tiny_context_push(work, sizeof(tiny_msgpack_work)), &w, sizeof(tiny_msgpack_work));
+    }
+    break;
+  default:
+    assert(0 && "invalid type");
+  }
+}
+
+char *tiny_encode_msgpack_ex(const tiny_value *v, size_t *length, const tiny_allocator *a)
+{
+  tiny_context c, work;
+  tiny_msgpack_work w;
+  assert(v != NULL && length != NULL && a != NULL);
+  tiny_work_init(&c, a);
+  tiny_work_init(&work, a);
+  tiny_msgpack_put_value(&c, &work, v);
+  while (work.top > 0)
+  {
+    memcpy(&w, tiny_context_pop(&work, sizeof(tiny_msgpack_work)), sizeof(tiny_msgpack_work));
+    if (w.m != NULL)
+    {
+      tiny_msgpack_put_string(&c, w.m->k, w.m->klen);
+      w.v = &w.m->v;
+    }
+    tiny_msgpack_put_value(&c, &work, w.v);
+  }
+  TINY_FREE(a, work.stack);
+  *length = c.top;
+  return c.stack;
+}
+
+char *tiny_encode_msgpack(const tiny_value *v, size_t *length)
+{
+  return tiny_encode_msgpack_ex(v, length, tiny_global_allocator);
+}
+
+typedef struct
+{
+  const unsigned char *p, *end;
+  const tiny_allocator *a;
+} tiny_msgpack_reader;
+
+static unsigned long long tiny_msgpack_get(const unsigned char *p, size_t bytes)
+{
+  unsigned long long n = 0;
+  while (bytes-- > 0)
+    n = (n << 8) | *p++;
+  return n;
+}
+
+// 把 float32/float64/整数的载荷转换成 double；JSON 表示不了 NaN 和无穷大
+static int tiny_msgpack_number(tiny_value *v, unsigned char tag, unsigned long long u, size_t bytes)
+{
+  double n;
+  float f;
+  unsigned int w;
+  if (tag == 0xca)
+  {
+    w = (unsigned int) u;
+    memcpy(&f, &w, sizeof(float));
+    n = f;
+  }
+  else if (tag == 0xcb)
+  {
+    memcpy(&n, &u, sizeof(double));
+  }
+  else if (tag <= 0xcf)
+  {
+    n = (double) u;
+  }
+  else
+  {
+    if (bytes < 8 && (u >> (bytes * 8 - 1)) != 0)
+      u |= ~0ULL << (bytes * 8);  // 符号扩展
+    n = (double) (long long) u;
+  }
+  if (n != n || n == HUGE_VAL || n == -HUGE_VAL)
+    return TINY_PARSE_INVALID_MSGPACK;
+  v->u.n = n;
+  v->type = TINY_NUMBER;
+  return TINY_PARSE_OK;
+}
+
+// 解码一个值的头部：标量和字符串当场完成，容器只按长度分配好存储，size 从 0 开始由调用方填
+static int tiny_msgpack_get_value(tiny_msgpack_reader *r, tiny_value *v)
+{
+  unsigned char tag;
+  size_t bytes = 0, left;
+  unsigned long long u;
+  tiny_type type;
+  if (r->p == r->end)
+    return TINY_PARSE_MSGPACK_TRUNCATED;
+  tag = *r->p++;
+  if (tag < 0x80 || tag >= 0xe0)  // positive/negative fixint
+  {
+    v->u.n = tag < 0x80 ? (double) tag : (double) tag - 256;
+    v->type = TINY_NUMBER;
+    return TINY_PARSE_OK;
+  }
+  if (tag <= 0x8f)
+  {
+    type = TINY_OBJECT;
+    u = tag & 0x0f;
+  }
+  else if (tag <= 0x9f)
+  {
+    type = TINY_ARRAY;
+    u = tag & 0x0f;
+  }
+  else if (tag <= 0xbf)
+  {
+    type = TINY_STRING;
+    u = tag & 0x1f;
+  }
+  else
+  {
+    switch (tag)
+    {
+    case 0xc0:
+      return TINY_PARSE_OK;
+    case 0xc2:
+    case 0xc3:
+      v->type = tag == 0xc3 ? TINY_TRUE : TINY_FALSE;
+      return TINY_PARSE_OK;
+    case 0xc4:  // bin 也当作字符串
+    case 0xd9:
+      type = TINY_STRING;
+      bytes = 1;
+      break;
+    case 0xc5:
+    case 0xda:
+      type = TINY_STRING;
+      bytes = 2;
+      break;
+    case 0xc6:
+    case 0xdb:
+      type = TINY_STRING;
+      bytes = 4;
+      break;
+    case 0xca:
+    case 0xcb:
+      type = TINY_NUMBER;
+      bytes = (size_t) 4 << (tag - 0xca);
+      break;
+    case 0xcc:
+    case 0xcd:
+    case 0xce:
+    case 0xcf:
+    case 0xd0:
+    case 0xd1:
+    case 0xd2:
+    case 0xd3:
+      type = TINY_NUMBER;
+      bytes = (size_t) 1 << ((tag - 0xcc) & 3);
+      break;
+    case 0xdc:
+    case 0xdd:
+      type = TINY_ARRAY;
+      bytes = tag == 0xdc ? 2 : 4;
+      break;
+    case 0xde:
+    case 0xdf:
+      type = TINY_OBJECT;
+      bytes = tag == 0xde ? 2 : 4;
+      break;
+    default:  // ext 和保留的类型
+      return TINY_PARSE_INVALID_MSGPACK;
+    }
+    if ((size_t) (r->end - r->p) < bytes)
+      return TINY_PARSE_MSGPACK_TRUNCATED;
+    u = tiny_msgpack_get(r->p, bytes);
+    r->p += bytes;
+    if (type == TINY_NUMBER)
+      return tiny_msgpack_number(v, tag, u, bytes);
+  }
+  // 每个元素至少一个字节，每个成员至少两个，长度不可能超过剩下的输入，据此限制分配的大小
+  left = (size_t) (r->end - r->p);
+  if (u > (type == TINY_OBJECT ? left / 2 : left))
+    return TINY_PARSE_MSGPACK_TRUNCATED;
+  if (type == TINY_STRING)
+  {
+    tiny_set_string_value(r->a, v, (const char *) r->p, (size_t) u);
+    r->p += u;
+  }
+  else if (type == TINY_ARRAY)
+  {
+    v->u.a.e = u > 0 ? (tiny_value *) TINY_MALLOC(r->a, (size_t) u * sizeof(tiny_value)) : NULL;
+    v->u.a.size = 0;
+    v->u.a.capacity = (size_t) u;
+    v->type = TINY_ARRAY;
+  }
+  else
+  {
+    v->u.o.m = u > 0 ? (tiny_member *) TINY_MALLOC(r->a, (size_t) u * sizeof(tiny_member)) : NULL;
+    v->u.o.size = 0;
+    v->u.o.capacity = (size_t) u;
+    v->type = TINY_OBJECT;
+  }
+  return TINY_PARSE_OK;
+}
+
+// 还没填满的容器压在工作栈上；它们的存储已经按最终大小分配，指针不会失效
+static void tiny_msgpack_push(tiny_context *c, tiny_value *v)
+{
+  if ((v->type == TINY_ARRAY || v->type == TINY_OBJECT) && v->u.a.capacity > 0)
+    memcpy(tiny_context_push(c, sizeof(tiny_value *)), &v, sizeof(tiny_value *));
+}
+
+int tiny_decode_msgpack_ex(tiny_value *v, const char *data, size_t len, const tiny_allocator *a)
+{
+  tiny_context c;
+  tiny_msgpack_reader r;
+  tiny_value *f, *e, k;
+  tiny_member *m;
+  int ret;
+  assert(v != NULL && (data != NULL || len == 0) && a != NULL);
+  tiny_init(v);
+  if (len == 0)
+    return TINY_PARSE_EXPECT_VALUE;
+  tiny_work_init(&c, a);
+  r.p = (const unsigned char *) data;
+  r.end = r.p + len;
+  r.a = a;
+  if ((ret = tiny_msgpack_get_value(&r, v)) == TINY_PARSE_OK)
+    tiny_msgpack_push(&c, v);
+  while (ret == TINY_PARSE_OK && c.top > 0)
+  {
+    memcpy(&f, c.stack + c.top - sizeof(tiny_value *), sizeof(tiny_value *));
+    if (f->type == TINY_ARRAY)
+    {
+      e = &f->u.a.e[f->u.a.size++];
+    }
+    else
+    {
+      tiny_init(&k);
+      if ((ret = tiny_msgpack_get_value(&r, &k)) != TINY_PARSE_OK || k.type != TINY_STRING)
+      {
+        tiny_free_value(a, &k);
+        ret = ret != TINY_PARSE_OK ? ret : TINY_PARSE_INVALID_MSGPACK;  // 键必须是字符串
+        break;
+      }
+      m = &f->u.o.m[f->u.o.size++];
+      m->k = k.u.s.s;
+      m->klen = k.u.s.len;
+      e = &m->v;
+    }
+    tiny_init(e);
+    if (f->u.a.size == f->u.a.capacity)  // a 和 o 的 size/capacity 在 union 中位置相同
+      tiny_context_pop(&c, sizeof(tiny_value *));
+    if ((ret = tiny_msgpack_get_value(&r, e)) == TINY_PARSE_OK)
+      tiny_msgpack_push(&c, e);
+  }
+  if (ret == TINY_PARSE_OK && r.p != r.end)
+    ret = TINY_PARSE_ROOT_NOT_SINGULAR;
+  if (ret != TINY_PARSE_OK)
+    tiny_free_value(a, v);
+  TINY_FREE(a, c.stack);
+  return ret;
+}
+
+int tiny_decode_msgpack(tiny_value *v, const char *data, size_t len)
+{
+  return tiny_decode_msgpack_ex(v, data, len, tiny_global_allocator);
+}
+
+// 快照：一块自包含的只读内存。节点里的偏移都相对节点（或成员）自己的地址，
+// 所以文件映射到任何位置都能直接用。所有记录按 8 字节对齐，字节序和写入的机器相同
+struct tiny_snap_node
+{
+  unsigned int type;  // tiny_type
+  unsigned int pad;
+  union
+  {
+    double n;
+    unsigned long long off;  // 字符串或子节点数组相对本节点的偏移
+  } u;
+  unsigned long long len;  // 字符串长度或元素/成员个数
+};
+
+typedef struct
+{
+  unsigned long long k;     // 键相对本成员的偏移
+  unsigned long long klen;  // 键的长度
+  tiny_snap_node v;
+} tiny_snap_member;
+
+typedef struct
+{
+  char magic[8];
+  unsigned int version;
+  unsigned int order;       // 写入 TINY_SNAPSHOT_ORDER，读到别的值说明字节序不同
+  unsigned long long size;  // 整个快照的字节数
+  tiny_snap_node root;
+} tiny_snap_header;
+
+#define TINY_SNAPSHOT_MAGIC "TINYSNAP"
+#define TINY_SNAPSHOT_VERSION 1
+#define TINY_SNAPSHOT_ORDER 0x01020304u
+
+struct tiny_snapshot
+{
+  char *base;
+  size_t size;
+  int mapped;  // base 来自 mmap()，否则来自分配器
+  const tiny_allocator *a;
+};
+
+typedef struct
+{
+  const tiny_value *src;  // 数组或对象
+  size_t at;              // 它的子节点区域在快照里的位置
+} tiny_snap_work;
+
+#define TINY_SNAP_ALIGN(n) (((n) + 7) & ~(size_t) 7)
+
+// 在快照末尾追加 len 个字节并补齐到 8 字节，返回起始位置；追加会让 c->stack 移动，所以只记位置
+static size_t tiny_snap_append(tiny_context *c, const void *s, size_t len)
+{
+  size_t at = c->top, n = TINY_SNAP_ALIGN(len);
+  char *p;
+  if (n == 0)
+    return at;
+  p = (char *) tiny_context_push(c, n);
+  memset(p, 0, n);  // 填充字节也写成 0，同样的值总是写出同样的文件
+  if (s != NULL)
+    memcpy(p, s, len);
+  return at;
+}
+
+// 字符串和键不一定以 '\0' 结尾，只拷贝 len 个字节，结尾的 0 由填充补上
+static size_t tiny_snap_append_chars(tiny_context *c, const char *s, size_t len)
+{
+  size_t at = tiny_snap_append(c, NULL, len + 1);
+  if (len > 0)
+    memcpy(c->stack + at, s, len);
+  return at;
+}
+
+// 填写 node 位置上的节点；容器的子节点区域先占好位置，放进工作栈稍后填
+static void tiny_snap_put(tiny_context *c, tiny_context *work, size_t node, const tiny_value *v)
+{
+  tiny_snap_work w;
+  tiny_snap_node *n;
+  size_t at = 0, len = 0;
+  switch (v->type)
+  {
+  case TINY_STRING:
+    tiny_unescape(v);
+    at = tiny_snap_append_chars(c, v->u.s.s, v->u.s.len);
+    len = v->u.s.len;
+    break;
+  case TINY_ARRAY:
+  case TINY_OBJECT:
+    len = v->u.a.size;  // a.size 和 o.size 在 union 中位置相同
+    at = tiny_snap_append(c, NULL, len * (v->type == TINY_ARRAY ? sizeof(tiny_snap_node) : sizeof(tiny_snap_member)));
+    if (len > 0)
+    {
+      w.src = v;
+      w.at = at;
+      memcpy(tiny_context_push(work, sizeof(tiny_snap_work)), &w, sizeof(tiny_snap_work));
+    }
+    break;
+  default:
+    break;
+  }
+  n = (tiny_snap_node *) (c->stack + node);
+  n->type = (unsigned int) v->type;
+  n->pad = 0;
+  if (v->type == TINY_NUMBER)
+    n->u.n = tiny_number(v);
+  else
+    n->u.off = v->type == TINY_STRING || v->type == TINY_ARRAY || v->type == TINY_OBJECT ? at - node : 0;
+  n->len = len;
+}
+
+static void tiny_snap_put_children(tiny_context *c, tiny_context *work, const tiny_snap_work *w)
+{
+  size_t i, m, k;
+  if (w->src->type == TINY_ARRAY)
+  {
+    for (i = 0; i < w->src->u.a.size; i++)
+      tiny_snap_put(c, work, w->at + i * sizeof(tiny_snap_node), &w->src->u.a.e[i]);
+  }
+  else
+  {
+    for (i = 0; i < w->src->u.o.size; i++)
+    {
+      const tiny_member *sm = &w->src->u.o.m[i];
+      m = w->at + i * sizeof(tiny_snap_member);
+      k = tiny_snap_append_chars(c, sm->k, sm->klen);
+      ((tiny_snap_member *) (c->stack + m))->k = k - m;
+      ((tiny_snap_member *) (c->stack + m))->klen = sm->klen;
+      tiny_snap_put(c, work, m + offsetof(tiny_snap_member, v), &sm->v);
+    }
+  }
+}
+
+int tiny_snapshot_write(const tiny_value *v, const char *path)
+{
+  tiny_context c, work;
+  tiny_snap_header h;
+  tiny_snap_work w;
+  FILE *fp;
+  int ret = -1;
+  assert(v != NULL && path != NULL);
+  tiny_work_init(&c, tiny_global_allocator);
+  tiny_work_init(&work, tiny_global_allocator);
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, TINY_SNAPSHOT_MAGIC, sizeof(h.magic));
+  h.version = TINY_SNAPSHOT_VERSION;
+  h.order = TINY_SNAPSHOT_ORDER;
+  tiny_snap_append(&c, &h, sizeof(h));
+  tiny_snap_put(&c, &work, offsetof(tiny_snap_header, root), v);
+  while (work.top > 0)
+  {
+    memcpy(&w, tiny_context_pop(&work, sizeof(tiny_snap_work)), sizeof(tiny_snap_work));
+    tiny_snap_put_children(&c, &work, &w);
+  }
+  ((tiny_snap_header *) c.stack)->size = c.top;
+  if ((fp = fopen(path, "wb")) != NULL)
+  {
+    if (fwrite(c.stack, 1, c.top, fp) == c.top)
+      ret = 0;
+    if (fclose(fp) != 0)
+      ret = -1;
+  }
+  TINY_FREE(c.a, c.stack);
+  TINY_FREE(work.a, work.stack);
+  return ret;
+}
+
+// 只检查头部，打开的代价和文件大小无关；内容要由 tiny_snapshot_write() 写出才可信
+static int tiny_snap_check(const char *base, size_t size)
+{
+  const tiny_snap_header *h = (const tiny_snap_header *) base;
+  return size >= sizeof(tiny_snap_header) && memcmp(h->magic, TINY_SNAPSHOT_MAGIC, sizeof(h->magic)) == 0 && h->version == TINY_SNAPSHOT_VERSION &&
+         h->order == TINY_SNAPSHOT_ORDER && h->size == size;
+}
+
+tiny_snapshot *tiny_snapshot_open(const char *path)
+{
+  const tiny_allocator *a = tiny_global_allocator;
+  tiny_snapshot *s;
+  char *base = NULL;
+  size_t size = 0;
+  int mapped = 0;
+#ifdef TINY_SNAPSHOT_MMAP
+  int fd;
+  struct stat st;
+  assert(path != NULL);
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return NULL;
+  if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(tiny_snap_header))
+  {
+    void *p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p != MAP_FAILED)
+    {
+      base = (char *) p;
+      size = (size_t) st.st_size;
+      mapped = 1;
+    }
+  }
+  close(fd);
+#else
+  FILE *fp;
+  long n;
+  assert(path != NULL);
+  if ((fp = fopen(path, "rb")) == NULL)
+    return NULL;
+  if (fseek(fp, 0, SEEK_END) == 0 && (n = ftell(fp)) >= (long) sizeof(tiny_snap_header) && fseek(fp, 0, SEEK_SET) == 0)
+  {
+    base = (char *) TINY_MALLOC(a, (size_t) n);
+    if (fread(base, 1, (size_t) n, fp) == (size_t) n)
+    {
+      size = (size_t) n;
+    }
+    else
+    {
+      TINY_FREE(a, base);
+      base = NULL;
+    }
+  }
+  fclose(fp);
+#endif
+  if (base == NULL)
+    return NULL;
+  if (!tiny_snap_check(base, size))
+  {
+#ifdef TINY_SNAPSHOT_MMAP
+    munmap(base, size);
+#else
+    TINY_FREE(a, base);
+#endif
+    return NULL;
+  }
+  s = (tiny_snapshot *) TINY_MALLOC(a, sizeof(tiny_snapshot));
+  s->base = base;
+  s->size = size;
+  s->mapped = mapped;
+  s->a = a;
+  return s;
+}
+
+void tiny_snapshot_close(tiny_snapshot *s)
+{
+  if (s == NULL)
+    return;
+#ifdef TINY_SNAPSHOT_MMAP
+  if (s->mapped)
+    munmap(s->base, s->size);
+#endif
+  if (!s->mapped)
+    TINY_FREE(s->a, s->base);
+  TINY_FREE(s->a, s);
+}
+
+const tiny_snap_node *tiny_snapshot_root(const tiny_snapshot *s)
+{
+  assert(s != NULL);
+  return &((const tiny_snap_header *) s->base)->root;
+}
+
+#define TINY_SNAP_AT(p, off) ((const char *) (p) + (off))
+
+tiny_type tiny_snap_get_type(const tiny_snap_node *n)
+{
+  assert(n != NULL);
+  return (tiny_type) n->type;
+}
+
+int tiny_snap_get_boolean(const tiny_snap_node *n)
+{
+  assert(n != NULL && (n->type == TINY_TRUE || n->type == TINY_FALSE));
+  return n->type == TINY_TRUE;
+}
+
+double tiny_snap_get_number(const tiny_snap_node *n)
+{
+  assert(n != NULL && n->type == TINY_NUMBER);
+  return n->u.n;
+}
+
+const char *tiny_snap_get_string(const tiny_snap_node *n)
+{
+  assert(n != NULL && n->type == TINY_STRING);
+  return TINY_SNAP_AT(n, n->u.off);
+}
+
+size_t tiny_snap_get_string_length(const tiny_snap_node *n)
+{
+  assert(n != NULL && n->type == TINY_STRING);
+  return (size_t) n->len;
+}
+
+size_t tiny_snap_get_array_size(const tiny_snap_node *n)
+{
+  assert(n != NULL && n->type == TINY_ARRAY);
+  return (size_t) n->len;
+}
+
+const tiny_snap_node *tiny_snap_get_array_element(const tiny_snap_node *n, size_t index)
+{
+  assert(n != NULL && n->type == TINY_ARRAY && index < n->len);
+  return (const tiny_snap_node *) TINY_SNAP_AT(n, n->u.off) + index;
+}
+
+size_t tiny_snap_get_object_size(const tiny_snap_node *n)
+{
+  assert(n != NULL && n->type == TINY_OBJECT);
+  return (size_t) n->len;
+}
+
+static const tiny_snap_member *tiny_snap_get_member(const tiny_snap_node *n, size_t index)
+{
+  assert(n != NULL && n->type == TINY_OBJECT && index < n->len);
+  return (const tiny_snap_member *) TINY_SNAP_AT(n, n->u.off) + index;
+}
+
+const char *tiny_snap_get_object_key(const tiny_snap_node *n, size_t index)
+{
+  const tiny_snap_member *m = tiny_snap_get_member(n, index);
+  return TINY_SNAP_AT(m, m->k);
+}
+
+size_t tiny_snap_get_object_key_length(const tiny_snap_node *n, size_t index)
+{
+  return (size_t) tiny_snap_get_member(n, index)->klen;
+}
+
+const tiny_snap_node *tiny_snap_get_object_value(const tiny_snap_node *n, size_t index)
+{
+  return &tiny_snap_get_member(n, index)->v;
+}
+
+size_t tiny_snap_find_object_index(const tiny_snap_node *n, const char *key, size_t klen)
+{
+  size_t i;
+  const tiny_snap_member *m;
+  assert(n != NULL && n->type == TINY_OBJECT && key != NULL);
+  m = (const tiny_snap_member *) TINY_SNAP_AT(n, n->u.off);
+  for (i = 0; i < n->len; i++)
+    if (m[i].klen == klen && memcmp(TINY_SNAP_AT(&m[i], m[i].k), key, klen) == 0)
+      return i;
+  return TINY_KEY_NOT_EXIST;
+}
+
+const tiny_snap_node *tiny_snap_find_object_value(const tiny_snap_node *n, const char *key, size_t klen)
+{
+  size_t index = tiny_snap_find_object_index(n, key, klen);
+  return index != TINY_KEY_NOT_EXIST ? tiny_snap_get_object_value(n, index) : NULL;
+}
+
+// 描述符的键表是一个最小完美哈希：换种子直到所有键落在不同的槽里，查找时只算一次哈希、比一次键
+struct tiny_schema_slot
+{
+  size_t field;  // 字段下标 + 1，0 表示空槽
+  size_t klen;
+};
+
+// 种子试这么多次还有冲突，就把表扩大一倍
+#ifndef TINY_SCHEMA_SEED_TRIES
+#define TINY_SCHEMA_SEED_TRIES 64
+#endif
+
+void tiny_schema_init(tiny_schema *s, const tiny_field *fields, size_t count)
+{
+  size_t i, j, n = 1, tries = 0, h;
+  assert(s != NULL && (fields != NULL || count == 0));
+  for (i = 0; i < count; i++)
+    for (j = 0; j < i; j++)
+      assert(strcmp(fields[i].key, fields[j].key) != 0 && "duplicate key in schema");
+  while (n < count * 2)
+    n <<= 1;
+  s->fields = fields;
+  s->count = count;
+  s->seed = 0;
+  s->slots = NULL;
+  for (;;)
+  {
+    TINY_FREE(tiny_global_allocator, s->slots);
+    s->slots = (struct tiny_schema_slot *) TINY_MALLOC(tiny_global_allocator, n * sizeof(struct tiny_schema_slot));
+    memset(s->slots, 0, n * sizeof(struct tiny_schema_slot));
+    s->mask = n - 1;
+    for (i = 0; i < count; i++)
+    {
+      size_t klen = strlen(fields[i].key);
+      h = (size_t) tiny_hash_bytes(fields[i].key, klen, s->seed) & s->mask;
+      if (s->slots[h].field != 0)
+        break;
+      s->slots[h].field = i + 1;
+      s->slots[h].klen = klen;
+    }
+    if (i == count)
+      return;
+    s->seed += TINY_HASH_K;
+    if (++tries % TINY_SCHEMA_SEED_TRIES == 0)
+      n <<= 1;
+  }
+}
+
+void tiny_schema_destroy(tiny_schema *s)
+{
+  assert(s != NULL);
+  TINY_FREE(tiny_global_allocator, s->slots);
+  s->slots = NULL;
+}
+
+static const tiny_field *tiny_schema_find(const tiny_schema *s, const char *key, size_t klen)
+{
+  const struct tiny_schema_slot *slot = &s->slots[(size_t) tiny_hash_bytes(key, klen, s->seed) & s->mask];
+  const tiny_field *f;
+  if (slot->field == 0 || slot->klen != klen)
+    return NULL;
+  f = &s->fields[slot->field - 1];
+  return memcmp(f->key, key, klen) == 0 ? f : NULL;
+}
+
+static int tiny_parse_fields(tiny_context *c, const tiny_schema *s, char *out);
+
+// 把一个值直接写进字段；类型对不上返回 TINY_PARSE_SCHEMA_MISMATCH
+static int tiny_parse_field(tiny_context *c, const tiny_field *f, char *p)
+{
+  int ret;
+  char *raw, *str;
+  size_t len;
+  tiny_value e;
+  tiny_init(&e);
+  switch (f->type)
+  {
+  case TINY_FIELD_BOOL:
+  case TINY_FIELD_NUMBER:
+  case TINY_FIELD_INT:
+    if (*c->json == '"' || *c->json == '[' || *c->json == '{')
+      return TINY_PARSE_SCHEMA_MISMATCH;
+    if ((ret = tiny_parse_scalar(c, &e)) != TINY_PARSE_OK)
+      return ret;
+    if (f->type == TINY_FIELD_BOOL && (e.type == TINY_TRUE || e.type == TINY_FALSE))
+      *(int *) p = e.type == TINY_TRUE;
+    else if (f->type == TINY_FIELD_NUMBER && e.type == TINY_NUMBER)
+      *(double *) p = e.u.n;
+    else if (f->type == TINY_FIELD_INT && e.type == TINY_NUMBER && e.u.n >= INT_MIN && e.u.n <= INT_MAX && e.u.n == (int) e.u.n)
+      *(int *) p = (int) e.u.n;
+    else
+      return TINY_PARSE_SCHEMA_MISMATCH;
+    return TINY_PARSE_OK;
+  case TINY_FIELD_STRING:
+    if (*c->json == 'n')
+    {
+      if ((ret = tiny_parse_literal(c, &e, "null", TINY_NULL)) != TINY_PARSE_OK)
+        return ret;
+      str = NULL;
+    }
+    else if (*c->json == '"')
+    {
+      if ((ret = tiny_parse_string_raw(c, &raw, &len)) != TINY_PARSE_OK)
+        return ret;
+      str = (char *) TINY_MALLOC(c->a, len + 1);
+      if (len > 0)
+        memcpy(str, raw, len);
+      str[len] = '\0';
+    }
+    else
+    {
+      return TINY_PARSE_SCHEMA_MISMATCH;
+    }
+    TINY_FREE(c->a, *(char **) p);
+    *(char **) p = str;
+    return TINY_PARSE_OK;
+  case TINY_FIELD_OBJECT:
+    return tiny_parse_fields(c, f->schema, p);
+  case TINY_FIELD_VALUE:
+    if ((ret = tiny_parse_value(c, &e)) != TINY_PARSE_OK)
+      return ret;
+    tiny_free_value(c->a, (tiny_value *) p);
+    memcpy(p, &e, sizeof(tiny_value));
+    return TINY_PARSE_OK;
+  default:
+    assert(0 && "invalid field type");
+    return TINY_PARSE_SCHEMA_MISMATCH;
+  }
+}
+
+// 嵌套深度由描述符决定，可以递归；未知的键直接跳过，它的值不产生任何节点
+static int tiny_parse_fields(tiny_context *c, const tiny_schema *s, char *out)
+{
+  int ret;
+  char *key;
+  size_t klen;
+  const tiny_field *f;
+  if (*c->json != '{')
+    return *c->json == '\0' ? TINY_PARSE_EXPECT_VALUE : TINY_PARSE_SCHEMA_MISMATCH;
+  c->json++;
+  tiny_parse_whitespace(c);
+  if (*c->json == '}')
+  {
+    c->json++;
+    return TINY_PARSE_OK;
+  }
+  for (;;)
+  {
+    if (*c->json != '"')
+      return TINY_PARSE_MISS_KEY;
+    if ((ret = tiny_parse_string_raw(c, &key, &klen)) != TINY_PARSE_OK)
+      return ret;
+    f = tiny_schema_find(s, key, klen);
+    tiny_parse_whitespace(c);
+    if (*c->json != ':')
+      return TINY_PARSE_MISS_COLON;
+    c->json++;
+    tiny_parse_whitespace(c);
+    if ((ret = f != NULL ? tiny_parse_field(c, f, out + f->offset) : tiny_skip_value(c)) != TINY_PARSE_OK)
+      return ret;
+    tiny_parse_whitespace(c);
+    if (*c->json == '}')
+    {
+      c->json++;
+      return TINY_PARSE_OK;
+    }
+    if (*c->json != ',')
+      return TINY_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+    c->json++;
+    tiny_parse_whitespace(c);
+  }
+}
+
+void tiny_free_struct(void *out, const tiny_schema *s)
+{
+  size_t i;
+  char *p;
+  assert(out != NULL && s != NULL);
+  for (i = 0; i < s->count; i++)
+  {
+    p = (char *) out + s->fields[i].offset;
+    switch (s->fields[i].type)
+    {
+    case TINY_FIELD_STRING:
+      TINY_FREE(tiny_global_allocator, *(char **) p);
+      *(char **) p = NULL;
+      break;
+    case TINY_FIELD_OBJECT:
+      tiny_free_struct(p, s->fields[i].schema);
+      break;
+    case TINY_FIELD_VALUE:
+      tiny_free_value(tiny_global_allocator, (tiny_value *) p);
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+int tiny_parse_struct(void *out, const tiny_schema *s, const char *json)
+{
+  int ret;
+  tiny_context c;
+  assert(out != NULL && s != NULL && s->slots != NULL && json != NULL);
+  tiny_work_init(&c, tiny_global_allocator);
+  c.json = json;
+  tiny_parse_whitespace(&c);
+  if ((ret = tiny_parse_fields(&c, s, (char *) out)) == TINY_PARSE_OK)
+  {
+    tiny_parse_whitespace(&c);
+    if (*c.json != '\0')
+      ret = TINY_PARSE_ROOT_NOT_SINGULAR;
+  }
+  if (ret != TINY_PARSE_OK)
+    tiny_free_struct(out, s);
+  TINY_FREE(c.a, c.stack);
+  return ret;
+}
+
+enum
+{
+  TINY_STEP_KEY,
+  TINY_STEP_ANY_MEMBER,
+  TINY_STEP_INDEX,
+  TINY_STEP_ANY_ELEMENT
+};
+
+struct tiny_filter_step
+{
+  int kind;
+  const char *key;  // TINY_STEP_KEY，指向选择器的原文
+  size_t len;       // 键长，或者 TINY_STEP_INDEX 的下标
+};
+
+// 读一个选择器的所有步骤，返回步数；写到 steps（可以是 NULL，只数步数）。格式不对返回 -1
+static long tiny_filter_steps(const char *s, struct tiny_filter_step *steps)
+{
+  long n = 0;
+  struct tiny_filter_step t;
+  if (*s++ != '$')
+    return -1;
+  while (*s != '\0')
+  {
+    if (*s == '.' && s[1] == '*')
+    {
+      t.kind = TINY_STEP_ANY_MEMBER;
+      s += 2;
+    }
+    else if (*s == '.')
+    {
+      t.kind = TINY_STEP_KEY;
+      t.key = ++s;
+      while (*s != '\0' && *s != '.' && *s != '[')
+        s++;
+      if ((t.len = s - t.key) == 0)
+        return -1;
+    }
+    else if (*s == '[' && s[1] == '*' && s[2] == ']')
+    {
+      t.kind = TINY_STEP_ANY_ELEMENT;
+      s += 3;
+    }
+    else if (*s == '[' && ISDIGIT(s[1]))
+    {
+      t.kind = TINY_STEP_INDEX;
+      for (t.len = 0, s++; ISDIGIT(*s); s++)
+      {
+        if (t.len > ((size_t) -1 - (*s - '0')) / 10)
+          return -1;
+        t.len = t.len * 10 + (*s - '0');
+      }
+      if (*s++ != ']')
+        return -1;
+    }
+    else
+    {
+      return -1;
+    }
+    if (steps != NULL)
+      steps[n] = t;
+    n++;
+  }
+  return n;
+}
+
+int tiny_filter_init(tiny_filter *f, const char *const *selectors, size_t count)
+{
+  size_t i, total = 0;
+  long n;
+  assert(f != NULL && (selectors != NULL || count == 0));
+  f->steps = NULL;
+  f->first = NULL;
+  f->count = 0;
+  for (i = 0; i < count; i++)
+  {
+    if ((n = tiny_filter_steps(selectors[i], NULL)) < 0)
+      return TINY_PARSE_INVALID_SELECTOR;
+    total += (size_t) n;
+  }
+  // 下标表和步骤放在同一块里
+  f->first = (size_t *) TINY_MALLOC(tiny_global_allocator, (count + 1) * sizeof(size_t) + total * sizeof(struct tiny_filter_step));
+  f->steps = (struct tiny_filter_step *) (f->first + count + 1);
+  f->count = count;
+  f->first[0] = 0;
+  for (i = 0; i < count; i++)
+    f->first[i + 1] = f->first[i] + (size_t) tiny_filter_steps(selectors[i], f->steps + f->first[i]);
+  return TINY_PARSE_OK;
+}
+
+void tiny_filter_destroy(tiny_filter *f)
+{
+  assert(f != NULL);
+  TINY_FREE(tiny_global_allocator, f->first);
+  f->first = NULL;
+  f->steps = NULL;
+  f->count = 0;
+}
+
+enum
+{
+  TINY_MATCH_NONE,
+  TINY_MATCH_PARTIAL,  // 还有选择器要往下走
+  TINY_MATCH_FULL      // 某个选择器到这里走完了，整棵子树都要
+};
+
+// 路径再往下走一步（对象成员 key，或者数组元素 index）。alive 标出在当前容器还跟得上的选择器，
+// next 写出在子节点还跟得上、而且没走完的那些
+static int tiny_filter_match(const tiny_filter *f, const char *alive, char *next, size_t depth, const char *key, size_t klen, size_t index)
+{
+  const struct tiny_filter_step *s;
+  size_t i;
+  int ret = TINY_MATCH_NONE, hit;
+  for (i = 0; i < f->count; i++)
+  {
+    next[i] = 0;
+    if (!alive[i])
+      continue;
+    s = &f->steps[f->first[i] + depth];
+    if (key != NULL)
+      hit = s->kind == TINY_STEP_ANY_MEMBER || (s->kind == TINY_STEP_KEY && s->len == klen && memcmp(s->key, key, klen) == 0);
+    else
+      hit = s->kind == TINY_STEP_ANY_ELEMENT || (s->kind == TINY_STEP_INDEX && s->len == index);
+    if (!hit)
+      continue;
+    if (f->first[i] + depth + 1 == f->first[i + 1])
+      return TINY_MATCH_FULL;
+    next[i] = 1;
+    ret = TINY_MATCH_PARTIAL;
+  }
+  return ret;
+}
+
+// 在过滤结果的容器后面加一个空位；对象的键 k 归容器所有
+static tiny_value *tiny_filter_append(const tiny_allocator *a, tiny_value *v, char *k, size_t klen)
+{
+  size_t n = v->u.a.size, unit = v->type == TINY_ARRAY ? sizeof(tiny_value) : sizeof(tiny_member);
+  if (n == v->u.a.capacity)
+  {
+    v->u.a.capacity = n == 0 ? 4 : n * 2;
+    v->u.a.e = (tiny_value *) TINY_REALLOC(a, v->u.a.e, n * unit, v->u.a.capacity * unit);
+  }
+  v->u.a.size++;
+  if (v->type == TINY_ARRAY)
+    return &v->u.a.e[n];
+  v->u.o.m[n].k = k;
+  v->u.o.m[n].klen = klen;
+  return &v->u.o.m[n].v;
+}
+
+// alive 标记占的栈空间。解析器直接在栈上读写帧，栈顶要保持对齐
+static size_t tiny_filter_alive_size(const tiny_filter *f)
+{
+  return (f->count + sizeof(tiny_value) - 1) / sizeof(tiny_value) * sizeof(tiny_value);
+}
+
+// 过滤解析一个部分匹配的值。栈上偏移 at 处的 count 个标记是上一层为它算好的 alive，depth 是它在路径里的层数。
+// 和 tiny_parse_fields() 一样可以递归：深度不超过最长的选择器，更深的子树交给非递归的解析和跳过。
+// 出错时 v 已经释放
+static int tiny_filter_value(tiny_context *c, const tiny_filter *f, size_t at, size_t depth, tiny_value *v)
+{
+  size_t next = c->top, klen = 0, index = 0;
+  char open = *c->json, close = open == '[' ? ']' : '}', *key = NULL, *k;
+  tiny_value e;
+  int ret = TINY_PARSE_OK, match;
+  if (open != '[' && open != '{')
+    return tiny_skip_value(c);  // 还有步骤要走，标量不可能匹配
+  if (f->count > 0)
+    tiny_context_push(c, tiny_filter_alive_size(f));
+  v->type = open == '[' ? TINY_ARRAY : TINY_OBJECT;
+  v->u.a.e = NULL;
+  v->u.a.size = v->u.a.capacity = 0;
+  c->json++;
+  tiny_parse_whitespace(c);
+  if (*c->json == close)
+    c->json++;
+  else
+  {
+    for (;;)
+    {
+      if (open == '{')
+      {
+        if (*c->json != '"')
+        {
+          ret = TINY_PARSE_MISS_KEY;
+          break;
+        }
+        if ((ret = tiny_parse_string_raw(c, &key, &klen)) != TINY_PARSE_OK)
+          break;
+        tiny_parse_whitespace(c);
+        if (*c->json != ':')
+        {
+          ret = TINY_PARSE_MISS_COLON;
+          break;
+        }
+        c->json++;
+        tiny_parse_whitespace(c);
+      }
+      // 键在栈顶之上，解析子节点会覆盖它，要留下的先拷出来
+      match = tiny_filter_match(f, c->stack + at, c->stack + next, depth, key, klen, index++);
+      k = match != TINY_MATCH_NONE && key != NULL ? tiny_copy_chars(c->a, key, klen) : NULL;
+      tiny_init(&e);
+      if (match == TINY_MATCH_NONE)
+        ret = tiny_skip_value(c);
+      else if (match == TINY_MATCH_FULL)
+        ret = tiny_parse_value(c, &e);
+      else
+        ret = tiny_filter_value(c, f, next, depth + 1, &e);
+      if (ret != TINY_PARSE_OK)
+      {
+        TINY_FREE(c->a, k);
+        break;
+      }
+      // 部分匹配却什么都没留下的不放进结果
+      if (match == TINY_MATCH_FULL || (e.type != TINY_NULL && e.u.a.size > 0))
+        memcpy(tiny_filter_append(c->a, v, k, klen), &e, sizeof(tiny_value));
+      else if (match == TINY_MATCH_PARTIAL)
+      {
+        tiny_free_value(c->a, &e);
+        TINY_FREE(c->a, k);
+      }
+      tiny_parse_whitespace(c);
+      if (*c->json == close)
+      {
+        c->json++;
+        break;
+      }
+      if (*c->json != ',')
+      {
+        ret = open == '[' ? TINY_PARSE_MISS_COMMA_OR_SQUARE_BRACKET : TINY_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+        break;
+      }
+      c->json++;
+      tiny_parse_whitespace(c);
+    }
+  }
+  if (ret != TINY_PARSE_OK)
+    tiny_free_value(c->a, v);
+  c->top = next;
+  return ret;
+}
+
+int tiny_parse_filtered(tiny_value *v, const tiny_filter *f, const char *json)
+{
+  tiny_context c;
+  size_t i;
+  int ret;
+  assert(v != NULL && f != NULL && json != NULL);
+  tiny_work_init(&c, tiny_global_allocator);
+  c.json = json;
+  tiny_init(v);
+  tiny_parse_whitespace(&c);
+  // 只有 "$" 的选择器要整份文档
+  for (i = 0; i < f->count && f->first[i] != f->first[i + 1]; i++)
+  {
+  }
+  if (i < f->count)
+    ret = tiny_parse_value(&c, v);
+  else
+  {
+    if (f->count > 0)
+      memset(tiny_context_push(&c, tiny_filter_alive_size(f)), 1, f->count);
+    ret = tiny_filter_value(&c, f, 0, 0, v);
+  }
+  if (ret == TINY_PARSE_OK)
+  {
+    tiny_parse_whitespace(&c);
+    if (*c.json != '\0')
+    {
+      tiny_free_value(c.a, v);
+      ret = TINY_PARSE_ROOT_NOT_SINGULAR;
+    }
+  }
+  TINY_FREE(c.a, c.stack);
+  return ret;
+}
+
+typedef struct
+{
+  const tiny_value *src;
+  tiny_value *dst;  // 和 src 同类型的空容器，存储还没有分配
+} tiny_copy_work;
+
+static void tiny_copy_child(tiny_context *c, const tiny_value *src, tiny_value *dst)
+{
+  tiny_copy_work w;
+  switch (src->type)
+  {
+  case TINY_STRING:
+    tiny_unescape(src);
+    dst->u.s.s = tiny_copy_chars(c->a, src->u.s.s, src->u.s.len);
+    dst->u.s.len = src->u.s.len;
+    dst->type = TINY_STRING;
+    dst->flags = 0;
+    break;
+  case TINY_ARRAY:
+  case TINY_OBJECT:
+    // 先放一个空壳，保证工作栈处理到它之前整棵树都是可释放的
+    dst->type = src->type;
+    dst->flags = 0;
+    dst->u.a.e = NULL;
+    dst->u.a.size = dst->u.a.capacity = 0;
+    w.src = src;
+    w.dst = dst;
+    memcpy(tiny_context_push(c, sizeof(tiny_copy_work)), &w, sizeof(tiny_copy_work));
+    break;
+  default:
+    memcpy(dst, src, sizeof(tiny_value));
+    dst->flags = src->flags & (TINY_FLAG_LAZY_NUMBER | TINY_FLAG_RAW_NUMBER);
+    break;
+  }
+}
+
+static void tiny_copy_children(tiny_context *c, const tiny_value *src, tiny_value *dst)
+{
+  size_t i, n;
+  if (src->type == TINY_ARRAY)
+  {
+    n = src->u.a.size;
+    dst->u.a.e = n > 0 ? (tiny_value *) TINY_MALLOC(c->a, n * sizeof(tiny_value)) : NULL;
+    dst->u.a.size = dst->u.a.capacity = n;
+    for (i = 0; i < n; i++)
+      tiny_copy_child(c, &src->u.a.e[i], &dst->u.a.e[i]);
+  }
+  else
+  {
+    n = src->u.o.size;
+    dst->u.o.m = n > 0 ? (tiny_member *) TINY_MALLOC(c->a, n * sizeof(tiny_member)) : NULL;
+    dst->u.o.size = dst->u.o.capacity = n;
+    for (i = 0; i < n; i++)
+    {
+      const tiny_member *sm = &src->u.o.m[i];
+      tiny_member *dm = &dst->u.o.m[i];
+      dm->k = tiny_copy_chars(c->a, sm->k, sm->klen);
+      dm->klen = sm->klen;
+      tiny_copy_child(c, &sm->v, &dm->v);
+    }
+  }
+}
+
+static void tiny_copy_value(const tiny_allocator *a, tiny_value *dst, const tiny_value *src)
+{
+  tiny_context c;
+  tiny_copy_work w;
+  tiny_free_value(a, dst);
+  tiny_work_init(&c, a);
+  tiny_copy_child(&c, src, dst);
+  while (c.top > 0)
+  {
+    memcpy(&w, tiny_context_pop(&c, sizeof(tiny_copy_work)), sizeof(tiny_copy_work));
+    tiny_copy_children(&c, w.src, w.dst);
+  }
+  TINY_FREE(a, c.stack);
+}
+
+void tiny_copy_ex(tiny_value *dst, const tiny_value *src, const tiny_allocator *a)
+{
+  assert(src != NULL && dst != NULL && src != dst && a != NULL);
+  tiny_copy_value(a, dst, src);
+}
+
+// 紧凑拷贝分两遍：先量出所有节点数组和字符的总大小，再在一块内存里按顺序摆放。
+// 节点数组放在前面保证对齐，键和字符串放在后面；根的存储就是整块的起点
+typedef struct
+{
+  char *nodes;  // 下一个节点数组的位置
+  char *chars;  // 下一个键/字符串的位置
+} tiny_compact;
+
+static void tiny_measure_children(tiny_context *c, const tiny_value *v, size_t *nodes, size_t *chars)
+{
+  size_t i, n;
+  const tiny_value *e;
+  if (v->type == TINY_ARRAY)
+  {
+    *nodes += v->u.a.size * sizeof(tiny_value);
+    n = v->u.a.size;
+  }
+  else
+  {
+    *nodes += v->u.o.size * sizeof(tiny_member);
+    n = v->u.o.size;
+  }
+  for (i = 0; i < n; i++)
+  {
+    if (v->type == TINY_ARRAY)
+    {
+      e = &v->u.a.e[i];
+    }
+    else
+    {
+      *chars += v->u.o.m[i].klen + 1;
+      e = &v->u.o.m[i].v;
+    }
+    if (e->type == TINY_STRING)
+    {
+      tiny_unescape(e);
+      *chars += e->u.s.len + 1;
+    }
+    else if ((e->type == TINY_ARRAY || e->type == TINY_OBJECT) && e->u.a.size > 0)
+      memcpy(tiny_context_push(c, sizeof(const tiny_value *)), &e, sizeof(const tiny_value *));
+  }
+}
+
+// 整块拷贝 src 需要的节点字节数和字符字节数，src 是非空的容器
+static void tiny_compact_measure(tiny_context *c, const tiny_value *src, size_t *nodes, size_t *chars)
+{
+  const tiny_value *e;
+  for (e = src;;)
+  {
+    tiny_measure_children(c, e, nodes, chars);
+    if (c->top == 0)
+      break;
+    memcpy(&e, tiny_context_pop(c, sizeof(const tiny_value *)), sizeof(const tiny_value *));
+  }
+}
+
+static void tiny_compact_child(tiny_context *c, tiny_compact *b, const tiny_value *src, tiny_value *dst)
+{
+  tiny_copy_work w;
+  memcpy(dst, src, sizeof(tiny_value));
+  switch (src->type)
+  {
+  case TINY_STRING:
+    memcpy(dst->u.s.s = b->chars, src->u.s.s, src->u.s.len);
+    dst->u.s.s[src->u.s.len] = '\0';
+    b->chars += src->u.s.len + 1;
+    dst->flags = TINY_FLAG_BORROWED;
+    break;
+  case TINY_ARRAY:
+  case TINY_OBJECT:
+    dst->flags = TINY_FLAG_BORROWED;
+    if (src->u.a.size == 0)
+    {
+      dst->u.a.e = NULL;
+      dst->u.a.capacity = 0;
+      break;
+    }
+    w.src = src;
+    w.dst = dst;
+    memcpy(tiny_context_push(c, sizeof(tiny_copy_work)), &w, sizeof(tiny_copy_work));
+    break;
+  default:
+    dst->flags = src->flags & (TINY_FLAG_LAZY_NUMBER | TINY_FLAG_RAW_NUMBER);
+    break;
+  }
+}
+
+static void tiny_compact_children(tiny_context *c, tiny_compact *b, const tiny_value *src, tiny_value *dst)
+{
+  size_t i, n;
+  if (src->type == TINY_ARRAY)
+  {
+    n = src->u.a.size;
+    dst->u.a.e = (tiny_value *) b->nodes;
+    dst->u.a.size = dst->u.a.capacity = n;
+    b->nodes += n * sizeof(tiny_value);
+    for (i = 0; i < n; i++)
+      tiny_compact_child(c, b, &src->u.a.e[i], &dst->u.a.e[i]);
+  }
+  else
+  {
+    n = src->u.o.size;
+    dst->u.o.m = (tiny_member *) b->nodes;
+    dst->u.o.size = dst->u.o.capacity = n;
+    b->nodes += n * sizeof(tiny_member);
+    for (i = 0; i < n; i++)
+    {
+      const tiny_member *sm = &src->u.o.m[i];
+      tiny_member *dm = &dst->u.o.m[i];
+      memcpy(dm->k = b->chars, sm->k, sm->klen);
+      dm->k[sm->klen] = '\0';
+      b->chars += sm->klen + 1;
+      dm->klen = sm->klen;
+      tiny_compact_child(c, b, &sm->v, &dm->v);
+    }
+  }
+}
+
+void tiny_copy_compact_ex(tiny_value *dst, const tiny_value *src, const tiny_allocator *a)
+{
+  tiny_context c;
+  tiny_compact b;
+  tiny_copy_work w;
+  size_t nodes = 0, chars = 0;
+  assert(src != NULL && dst != NULL && src != dst && a != NULL);
+  if ((src->type != TINY_ARRAY && src->type != TINY_OBJECT) || src->u.a.size == 0)
+  {
+    // 没有子节点，普通拷贝本来就只有一次分配
+    tiny_copy_value(a, dst, src);
+    return;
+  }
+  tiny_free_value(a, dst);
+  tiny_work_init(&c, a);
+  tiny_compact_measure(&c, src, &nodes, &chars);
+  b.nodes = (char *) TINY_MALLOC(a, nodes + chars);
+  b.chars = b.nodes + nodes;
+  tiny_compact_child(&c, &b, src, dst);
+  while (c.top > 0)
+  {
+    memcpy(&w, tiny_context_pop(&c, sizeof(tiny_copy_work)), sizeof(tiny_copy_work));
+    tiny_compact_children(&c, &b, w.src, w.dst);
+  }
+  TINY_FREE(a, c.stack);
+  dst->flags = TINY_FLAG_BLOCK;
+}
+
+void tiny_copy_compact(tiny_value *dst, const tiny_value *src)
+{
+  tiny_copy_compact_ex(dst, src, tiny_global_allocator);
+}
+
+void tiny_copy(tiny_value *dst, const tiny_value *src)
+{
+  tiny_copy_ex(dst, src, tiny_global_allocator);
+}
+
+void tiny_move(tiny_value *dst, tiny_value *src)
+{
+  tiny_move_ex(dst, src, tiny_global_allocator);
+}
+
+void tiny_move_ex(tiny_value *dst, tiny_value *src, const tiny_allocator *a)
+{
+  assert(dst != NULL && src != NULL && src != dst && a != NULL);
+  tiny_detach(a, src);
+  tiny_free_value(a, dst);
+  memcpy(dst, src, sizeof(tiny_value));
+  tiny_init(src);
+}
+
+void tiny_swap(tiny_value *lhs, tiny_value *rhs)
+{
+  tiny_swap_ex(lhs, rhs, tiny_global_allocator);
+}
+
+void tiny_swap_ex(tiny_value *lhs, tiny_value *rhs, const tiny_allocator *a)
+{
+  assert(lhs != NULL && rhs != NULL && a != NULL);
+  if (lhs != rhs)
+  {
+    tiny_value temp;
+    // 两边可能在不同的整块里
+    tiny_detach(a, lhs);
+    tiny_detach(a, rhs);
+    memcpy(&temp, lhs, sizeof(tiny_value));
+    memcpy(lhs, rhs, sizeof(tiny_value));
+    memcpy(rhs, &temp, sizeof(tiny_value));
+  }
+}
+
+tiny_type tiny_get_type(const tiny_value *v)
+{
+  assert(v != NULL);
+  return v->type;
+}
+
+typedef struct
+{
+  const tiny_value *lhs, *rhs;
+  size_t link;  // 最近一层按键配对在 links 里的下标，没有为 TINY_NO_FRAME
+} tiny_equal_work;
+
+// 按键配上的一对容器：右边的对象、配上的成员，以及外面一层的配对
+typedef struct
+{
+  const tiny_value *o;
+  size_t index, up;
+} tiny_equal_link;
+
+typedef struct
+{
+  tiny_context work, links;
+  int exact;  // 为 1 时有重复键的对象一律按多重集合比较
+} tiny_equal_state;
+
+// 只比较类型、标量和容器大小；非空容器的内容交给工作栈
+static int tiny_is_equal_shallow(tiny_context *c, const tiny_value *lhs, const tiny_value *rhs, size_t link)
+{
+  tiny_equal_work w;
+  if (lhs->type != rhs->type)
+    return 0;
+  switch (lhs->type)
+  {
+  case TINY_STRING:
+    tiny_unescape(lhs);
+    tiny_unescape(rhs);
+    return lhs->u.s.len == rhs->u.s.len && memcmp(lhs->u.s.s, rhs->u.s.s, lhs->u.s.len) == 0;
+  case TINY_NUMBER:
+    return tiny_number(lhs) == tiny_number(rhs);
+  case TINY_ARRAY:
+    if (lhs->u.a.size != rhs->u.a.size)
+      return 0;
+    break;
+  case TINY_OBJECT:
+    if (lhs->u.o.size != rhs->u.o.size)
+      return 0;
+    break;
+  default:
+    return 1;
+  }
+  if (lhs->u.a.size > 0 && lhs->u.a.e != rhs->u.a.e)  // a.size 和 o.size 在 union 中位置相同；共享同一份存储的一定相等
+  {
+    w.lhs = lhs;
+    w.rhs = rhs;
+    w.link = link;
+    memcpy(tiny_context_push(c, sizeof(tiny_equal_work)), &w, sizeof(tiny_equal_work));
+  }
+  return 1;
+}
+
+static unsigned long long tiny_hash_mix(unsigned long long h);
+
+typedef struct
+{
+  unsigned long long h;  // 键和值一起的哈希，和 tiny_hash() 里成员的算法相同
+  size_t i;
+} tiny_member_hash;
+
+static int tiny_member_hash_compare(const void *lhs, const void *rhs)
+{
+  const tiny_member_hash *a = (const tiny_member_hash *) lhs, *b = (const tiny_member_hash *) rhs;
+  if (a->h != b->h)
+    return a->h < b->h ? -1 : 1;
+  return a->i < b->i ? -1 : a->i > b->i;
+}
+
+// 有重复键的对象按成员（键和值）的多重集合比较，和 tiny_hash() 的含义一致：
+// 两边的成员按哈希排序后依次配对，哈希相同的成员只要不碰撞就相等，配好的值照常交给工作栈
+static int tiny_is_equal_members(tiny_context *c, const tiny_equal_work *w)
+{
+  const tiny_value *lhs = w->lhs, *rhs = w->rhs;
+  size_t i, n = lhs->u.o.size;
+  tiny_member_hash *h = (tiny_member_hash *) TINY_MALLOC(c->a, 2 * n * sizeof(tiny_member_hash));
+  const tiny_member *l, *r;
+  int ret = 1;
+  for (i = 0; i < 2 * n; i++)
+  {
+    l = i < n ? &lhs->u.o.m[i] : &rhs->u.o.m[i - n];
+    h[i].h = tiny_hash_mix(tiny_hash_bytes(l->k, l->klen, tiny_hash(&l->v)));
+    h[i].i = i < n ? i : i - n;
+  }
+  qsort(h, n, sizeof(tiny_member_hash), tiny_member_hash_compare);
+  qsort(h + n, n, sizeof(tiny_member_hash), tiny_member_hash_compare);
+  for (i = 0; i < n && ret; i++)
+  {
+    l = &lhs->u.o.m[h[i].i];
+    r = &rhs->u.o.m[h[n + i].i];
+    ret = h[i].h == h[n + i].h && l->klen == r->klen && memcmp(l->k, r->k, l->klen) == 0 && tiny_is_equal_shallow(c, &l->v, &r->v, w->link);
+  }
+  TINY_FREE(c->a, h);
+  return ret;
+}
+
+static int tiny_is_equal_children(tiny_equal_state *s, const tiny_equal_work *w)
+{
+  const tiny_value *lhs = w->lhs, *rhs = w->rhs;
+  tiny_context *c = &s->work;
+  tiny_equal_link l;
+  size_t i, j, n, top = c->top, links = s->links.top, before;
+  int ret = 1, dup = 0;
+  tiny_key_index index;
+  unsigned char local[64], *used;
+  if (lhs->type == TINY_ARRAY)
+  {
+    for (i = 0; i < lhs->u.a.size; i++)
+      if (!tiny_is_equal_shallow(c, &lhs->u.a.e[i], &rhs->u.a.e[i], w->link))
+        return 0;
+    return 1;
+  }
+  // 对象与成员顺序无关。小对象线性查找，大对象先给右边的键建一个临时哈希表。
+  // 右边的每个成员只能配一次，配成功一定相等；重复的键可能配错，所以失败时要按多重集合重新比较
+  n = lhs->u.o.size;
+  index.slots = NULL;
+  if (n >= TINY_EQUAL_HASH_THRESHOLD)
+    dup = tiny_key_index_build(c->a, &index, rhs);
+  else if (s->exact)
+    dup = tiny_has_duplicate_keys(rhs);
+  used = n <= sizeof(local) ? local : (unsigned char *) TINY_MALLOC(c->a, n);
+  memset(used, 0, n);
+  l.o = rhs;
+  l.up = w->link;
+  for (i = 0; i < n && ret && !(s->exact && dup); i++)
+  {
+    const tiny_member *m = &lhs->u.o.m[i];
+    // 同一位置的键通常就是同一个
+    if (rhs->u.o.m[i].klen == m->klen && memcmp(rhs->u.o.m[i].k, m->k, m->klen) == 0)
+      j = i;
+    else if (index.slots != NULL)
+      j = tiny_key_index_find(&index, rhs, m->k, m->klen);
+    else
+      j = tiny_find_object_index(rhs, m->k, m->klen);
+    before = c->top;
+    ret = j != TINY_KEY_NOT_EXIST && !used[j] && tiny_is_equal_shallow(c, &m->v, &rhs->u.o.m[j].v, s->links.top / sizeof(tiny_equal_link));
+    if (!ret)
+      break;
+    used[j] = 1;
+    // 留到后面比较的容器记下是怎么配上的，它失败时再回头看这一层的键有没有重复
+    if (c->top != before)
+    {
+      l.index = j;
+      memcpy(tiny_context_push(&s->links, sizeof(tiny_equal_link)), &l, sizeof(tiny_equal_link));
+    }
+  }
+  if (!ret && !s->exact && index.slots == NULL)
+    dup = tiny_has_duplicate_keys(rhs);
+  if (used != local)
+    TINY_FREE(c->a, used);
+  if (index.slots != NULL)
+    tiny_key_index_free(c->a, &index);
+  if (ret && !(s->exact && dup))
+    return 1;
+  if (!dup)
+    return 0;
+  // 扔掉按键配对时压进去的比较
+  c->top = top;
+  s->links.top = links;
+  return tiny_is_equal_members(c, w);
+}
+
+// 失败的比较经过的各层按键配对里有没有重复的键；有的话那一层可能配错了
+static int tiny_is_equal_suspect(const tiny_equal_state *s, size_t link)
+{
+  const tiny_equal_link *l;
+  for (; link != TINY_NO_FRAME; link = l->up)
+  {
+    l = (const tiny_equal_link *) s->links.stack + link;
+    if (tiny_key_repeats(l->o, l->index))
+      return 1;
+  }
+  return 0;
+}
+
+int tiny_is_equal(const tiny_value *lhs, const tiny_value *rhs)
+{
+  tiny_equal_state s;
+  tiny_equal_work w;
+  size_t failed;
+  int ret;
+  assert(lhs != NULL && rhs != NULL);
+  tiny_work_init(&s.work, tiny_global_allocator);
+  tiny_work_init(&s.links, tiny_global_allocator);
+  for (s.exact = 0;; s.exact = 1)
+  {
+    s.work.top = s.links.top = 0;
+    failed = TINY_NO_FRAME;
+    ret = tiny_is_equal_shallow(&s.work, lhs, rhs, TINY_NO_FRAME);
+    while (ret && s.work.top > 0)
+    {
+      memcpy(&w, tiny_context_pop(&s.work, sizeof(tiny_equal_work)), sizeof(tiny_equal_work));
+      // 工作栈后进先出，比 w.link 新的配对都属于已经比完的子树（TINY_NO_FRAME + 1 为 0）
+      s.links.top = (w.link + 1) * sizeof(tiny_equal_link);
+      ret = tiny_is_equal_children(&s, &w);
+      if (!ret)
+        failed = w.link;
+    }
+    // 经过的配对都没有重复的键，结果就是确定的；否则重新比较，有重复键的对象一开始就按多重集合比较
+    if (ret || s.exact || !tiny_is_equal_suspect(&s, failed))
+      break;
+  }
+  TINY_FREE(s.work.a, s.work.stack);
+  TINY_FREE(s.links.a, s.links.stack);
+  return ret;
+}
+
+typedef struct
+{
+  const tiny_value *v;  // 正在计算的容器
+  size_t i;             // 下一个要处理的子节点
+  size_t nodes;         // 已经算完的节点数，包括它自己
+  unsigned long long h;
+} tiny_hash_work;
+
+static unsigned long long tiny_hash_mix(unsigned long long h)
+{
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// 标量直接算出哈希；容器返回 0，交给工作栈展开
+static int tiny_hash_scalar(const tiny_value *v, unsigned long long *h)
+{
+  unsigned long long bits;
+  double n;
+  switch (v->type)
+  {
+  case TINY_NUMBER:
+    n = tiny_number(v);
+    if (n == 0)
+      n = 0.0;  // -0 == 0，两者的哈希也要相同
+    memcpy(&bits, &n, sizeof(bits));
+    *h = tiny_hash_mix(bits ^ TINY_NUMBER * TINY_HASH_K);
+    return 1;
+  case TINY_STRING:
+    tiny_unescape(v);
+    *h = tiny_hash_bytes(v->u.s.s, v->u.s.len, TINY_STRING);
+    return 1;
+  case TINY_ARRAY:
+  case TINY_OBJECT:
+    return 0;
+  default:
+    *h = tiny_hash_mix((v->type + 1) * TINY_HASH_K);
+    return 1;
+  }
+}
+
+static void tiny_hash_push(tiny_context *c, const tiny_value *v)
+{
+  tiny_hash_work w;
+  w.v = v;
+  w.i = 0;
+  w.nodes = 1;
+  w.h = v->type * TINY_HASH_K;
+  memcpy(tiny_context_push(c, sizeof(tiny_hash_work)), &w, sizeof(tiny_hash_work));
+}
+
+// 把刚算完的第 i - 1 个子节点的哈希并进容器：数组依赖顺序，对象的成员求和，与顺序无关
+static void tiny_hash_fold(tiny_hash_work *w, unsigned long long h)
+{
+  const tiny_member *m;
+  if (w->v->type == TINY_ARRAY)
+  {
+    w->h = (w->h ^ h) * TINY_HASH_K;
+    w->h ^= w->h >> 32;
+  }
+  else
+  {
+    m = &w->v->u.o.m[w->i - 1];
+    w->h += tiny_hash_mix(tiny_hash_bytes(m->k, m->klen, h));
+  }
+}
+
+// 按节点地址记下较大子树的哈希，tiny_diff() 用它避免反复比较同一棵子树
+#define TINY_HASH_MEMO_NODES 32
+
+typedef struct
+{
+  const tiny_value *v;
+  unsigned long long h;
+} tiny_hash_slot;
+
+typedef struct
+{
+  tiny_hash_slot *slots;
+  size_t mask, count;
+} tiny_hash_memo;
+
+static size_t tiny_hash_memo_slot(const tiny_hash_memo *t, const tiny_value *v)
+{
+  size_t j;
+  for (j = (size_t) tiny_hash_mix((unsigned long long) (size_t) v) & t->mask; t->slots[j].v != NULL && t->slots[j].v != v;
+       j = (j + 1) & t->mask)
+  {
+  }
+  return j;
+}
+
+static void tiny_hash_memo_init(const tiny_allocator *a, tiny_hash_memo *t)
+{
+  t->slots = (tiny_hash_slot *) TINY_MALLOC(a, 16 * sizeof(tiny_hash_slot));
+  memset(t->slots, 0, 16 * sizeof(tiny_hash_slot));
+  t->mask = 15;
+  t->count = 0;
+}
+
+static void tiny_hash_memo_put(const tiny_allocator *a, tiny_hash_memo *t, const tiny_value *v, unsigned long long h)
+{
+  tiny_hash_slot *old = t->slots;
+  size_t i, j, n = t->mask + 1;
+  if ((t->count + 1) * 2 > n)  // 装载率不超过一半
+  {
+    t->slots = (tiny_hash_slot *) TINY_MALLOC(a, n * 2 * sizeof(tiny_hash_slot));
+    memset(t->slots, 0, n * 2 * sizeof(tiny_hash_slot));
+    t->mask = n * 2 - 1;
+    for (i = 0; i < n; i++)
+      if (old[i].v != NULL)
+        t->slots[tiny_hash_memo_slot(t, old[i].v)] = old[i];
+    TINY_FREE(a, old);
+  }
+  j = tiny_hash_memo_slot(t, v);
+  if (t->slots[j].v == NULL)
+    t->count++;
+  t->slots[j].v = v;
+  t->slots[j].h = h;
+}
+
+// 用空的工作栈 c 计算 v 的哈希。memo 不为 NULL 时，顺带记下 v 里不少于 TINY_HASH_MEMO_NODES 个节点的子树：
+// 更小的子树重算一遍的代价有上限，不值得占用表
+static unsigned long long tiny_hash_value(tiny_context *c, const tiny_value *v, tiny_hash_memo *memo)
+{
+  tiny_hash_work *top;
+  const tiny_value *e;
+  unsigned long long h;
+  size_t nodes;
+  if (tiny_hash_scalar(v, &h))
+    return h;
+  assert(c->top == 0);
+  tiny_hash_push(c, v);
+  for (;;)
+  {
+    top = (tiny_hash_work *) (c->stack + c->top - sizeof(tiny_hash_work));
+    if (top->i < top->v->u.a.size)  // a.size 和 o.size 在 union 中位置相同
+    {
+      e = top->v->type == TINY_ARRAY ? &top->v->u.a.e[top->i] : &top->v->u.o.m[top->i].v;
+      top->i++;
+      if (!tiny_hash_scalar(e, &h))
+      {
+        tiny_hash_push(c, e);
+        continue;
+      }
+      nodes = 1;
+    }
+    else
+    {
+      h = tiny_hash_mix(top->h ^ top->v->u.a.size);
+      nodes = top->nodes;
+      if (memo != NULL && nodes >= TINY_HASH_MEMO_NODES)
+        tiny_hash_memo_put(c->a, memo, top->v, h);
+      tiny_context_pop(c, sizeof(tiny_hash_work));
+      if (c->top == 0)
+        break;
+      top = (tiny_hash_work *) (c->stack + c->top - sizeof(tiny_hash_work));
+    }
+    top->nodes += nodes;
+    tiny_hash_fold(top, h);
+  }
+  return h;
+}
+
+unsigned long long tiny_hash(const tiny_value *v)
+{
+  tiny_context c;
+  unsigned long long h;
+  assert(v != NULL);
+  tiny_work_init(&c, tiny_global_allocator);
+  h = tiny_hash_value(&c, v, NULL);
+  TINY_FREE(c.a, c.stack);
+  return h;
+}
+
+double tiny_get_number(const tiny_value *v)
+{
+  assert(v != NULL && v->type == TINY_NUMBER);
+  return tiny_number(v);
+}
+
+const char *tiny_get_number_text(const tiny_value *v, size_t *len)
+{
+  assert(v != NULL && v->type == TINY_NUMBER);
+  if ((v->flags & TINY_FLAG_RAW_NUMBER) == 0)
+    return NULL;
+  if (len != NULL)
+    *len = v->u.r.len;
+  return v->u.r.p;
+}
+
+static void tiny_materialize_child(tiny_context *c, tiny_value *e)
+{
+  const tiny_allocator *a = c->a;
+  if (e->flags & TINY_FLAG_SHARED)
+    return;  // tiny_persist() 已经处理过整棵子树
+  if (e->type == TINY_NUMBER)
+  {
+    tiny_number(e);
+    e->flags &= ~TINY_FLAG_RAW_NUMBER;
+  }
+  else if (e->type == TINY_STRING && (e->flags & TINY_FLAG_BORROWED))
+  {
+    tiny_own_storage(a, e);  // 整块里的字符串也会被拷出来，释放时单独释放，不影响正确性
+  }
+  else if ((e->type == TINY_ARRAY || e->type == TINY_OBJECT) && e->u.a.size > 0)
+  {
+    if (e->flags & TINY_FLAG_KEY_VIEWS)
+      tiny_own_storage(a, e);
+    memcpy(tiny_context_push(c, sizeof(tiny_value *)), &e, sizeof(tiny_value *));
+  }
+}
+
+void tiny_materialize(tiny_value *v)
+{
+  tiny_materialize_ex(v, tiny_global_allocator);
+}
+
+void tiny_materialize_ex(tiny_value *v, const tiny_allocator *a)
+{
+  tiny_context c;
+  size_t i;
+  assert(v != NULL && a != NULL);
+  tiny_work_init(&c, a);
+  tiny_materialize_child(&c, v);
+  while (c.top > 0)
+  {
+    memcpy(&v, tiny_context_pop(&c, sizeof(tiny_value *)), sizeof(tiny_value *));
+    if (v->type == TINY_ARRAY)
+      for (i = 0; i < v->u.a.size; i++)
+        tiny_materialize_child(&c, &v->u.a.e[i]);
+    else
+      for (i = 0; i < v->u.o.size; i++)
+        tiny_materialize_child(&c, &v->u.o.m[i].v);
+  }
+  TINY_FREE(c.a, c.stack);
+}
+
+// 把还没共享的节点换成带计数头的存储。共享节点的子孙一定也是共享的，遇到就不用往下走，
+// 所以改过几处之后再共享，只需要处理改过的那几条路径
+static void tiny_persist_child(tiny_context *c, tiny_value *e)
+{
+  const tiny_allocator *a = tiny_global_allocator;
+  tiny_type type = e->type;
+  size_t s;
+  char *p;
+  if (e->flags & TINY_FLAG_SHARED)
+    return;
+  if (type == TINY_NUMBER)
+  {
+    tiny_number(e);
+    e->flags = 0;  // 不再指向输入
+    return;
+  }
+  if (type != TINY_STRING && type != TINY_ARRAY && type != TINY_OBJECT)
+    return;
+  if (type != TINY_STRING && e->u.a.size == 0)
+  {
+    // 空容器没有存储，按值拷贝就能共享
+    tiny_free_value(a, e);
+    e->type = type;
+    e->u.a.e = NULL;
+    e->u.a.size = e->u.a.capacity = 0;
+    return;
+  }
+  tiny_own_storage(a, e);  // 借用、整块和键视图先变成自己的
+  if (type == TINY_STRING)
+    s = e->u.s.len + 1;
+  else if (type == TINY_ARRAY)
+    s = e->u.a.size * sizeof(tiny_value);
+  else
+    s = e->u.o.size * sizeof(tiny_member);
+  p = (char *) TINY_MALLOC(a, sizeof(tiny_shared_header) + s);
+  ((tiny_shared_header *) p)->refs = 1;
+  memcpy(p + sizeof(tiny_shared_header), tiny_storage(e), s);
+  TINY_FREE(a, tiny_storage(e));
+  e->flags = TINY_FLAG_SHARED;
+  if (type == TINY_STRING)
+  {
+    e->u.s.s = p + sizeof(tiny_shared_header);
+    return;
+  }
+  e->u.a.e = (tiny_value *) (p + sizeof(tiny_shared_header));
+  e->u.a.capacity = e->u.a.size;
+  memcpy(tiny_context_push(c, sizeof(tiny_value *)), &e, sizeof(tiny_value *));
+}
+
+void tiny_persist(tiny_value *v)
+{
+  tiny_context c;
+  size_t i;
+  assert(v != NULL);
+  tiny_work_init(&c, tiny_global_allocator);
+  tiny_persist_child(&c, v);
+  while (c.top > 0)
+  {
+    memcpy(&v, tiny_context_pop(&c, sizeof(tiny_value *)), sizeof(tiny_value *));
+    if (v->type == TINY_ARRAY)
+      for (i = 0; i < v->u.a.size; i++)
+        tiny_persist_child(&c, &v->u.a.e[i]);
+    else
+      for (i = 0; i < v->u.o.size; i++)
+        tiny_persist_child(&c, &v->u.o.m[i].v);
+  }
+  TINY_FREE(c.a, c.stack);
+}
+
+void tiny_share(tiny_value *dst, tiny_value *src)
+{
+  assert(dst != NULL && src != NULL && dst != src);
+  tiny_persist(src);
+  tiny_free(dst);
+  memcpy(dst, src, sizeof(tiny_value));
+  if (dst->flags & TINY_FLAG_SHARED)
+    tiny_shared_retain(dst);
+}
+
+int tiny_get_boolean(const tiny_value *v)
+{
+  assert(v != NULL && (v->type == TINY_TRUE || v->type == TINY_FALSE));
+  return v->type == TINY_TRUE;
+}
+
+void tiny_set_boolean(tiny_value *v, int b)
+{
+  tiny_set_boolean_ex(v, b, tiny_global_allocator);
+}
+
+void tiny_set_boolean_ex(tiny_value *v, int b, const tiny_allocator *a)
+{
+  // valgrind --leak-check=full  ./tinyjson_test
+  // catch no free
+  assert(v != NULL && a != NULL);
+  tiny_free_value(a, v);
+  v->type = b ? TINY_TRUE : TINY_FALSE;
+}
+
+void tiny_set_number(tiny_value *v, double n)
+{
+  tiny_set_number_ex(v, n, tiny_global_allocator);
+}
+
+void tiny_set_number_ex(tiny_value *v, double n, const tiny_allocator *a)
+{
+  assert(v != NULL && a != NULL);
+  tiny_free_value(a, v);
+  v->u.n = n;
+  v->type = TINY_NUMBER;
+}
+
+tiny_value *tiny_get_array_element(const tiny_value *v, size_t index)
+{
+  assert(v != NULL && v->type == TINY_ARRAY);
+  assert(index < v->u.a.size);
+  return &v->u.a.e[index];
+}
+
+tiny_value *tiny_get_object_value(const tiny_value *v, size_t index)
+{
+  assert(v != NULL && v->type == TINY_OBJECT);
+  assert(index < v->u.o.size);
+  return &v->u.o.m[index].v;
+}
+
+tiny_value *tiny_edit_array_element(tiny_value *v, size_t index)
+{
+  assert(v != NULL && v->type == TINY_ARRAY);
+  assert(index < v->u.a.size);
+  if (v->flags & TINY_FLAG_SHARED)
+    tiny_own_storage(tiny_global_allocator, v);
+  return &v->u.a.e[index];
+}
+
+tiny_value *tiny_edit_object_value(tiny_value *v, size_t index)
+{
+  assert(v != NULL && v->type == TINY_OBJECT);
+  assert(index < v->u.o.size);
+  if (v->flags & TINY_FLAG_SHARED)
+    tiny_own_storage(tiny_global_allocator, v);
+  return &v->u.o.m[index].v;
+}
+
+void tiny_erase_array_element(tiny_value *v, size_t index, size_t count)
+{
+  tiny_erase_array_element_ex(v, index, count, tiny_global_allocator);
+}
+
+void tiny_erase_array_element_ex(tiny_value *v, size_t index, size_t count, const tiny_allocator *a)
+{
+  size_t i;
+  assert(v != NULL && v->type == TINY_ARRAY && index + count <= v->u.a.size && a != NULL);
+  if (count == 0)
+    return;
+  tiny_own_storage(a, v);
+  for (i = index; i < index + count; i++)
+    tiny_free_value(a, &v->u.a.e[i]);
+  memmove(&v->u.a.e[index], &v->u.a.e[index + count], (v->u.a.size - index - count) * sizeof(tiny_value));
+  v->u.a.size -= count;
+}
+
+void tiny_apply_merge_patch(tiny_value *target, const tiny_value *patch)
+{
+  tiny_apply_merge_patch_ex(target, patch, tiny_global_allocator);
+}
+
+void tiny_apply_merge_patch_ex(tiny_value *target, const tiny_value *patch, const tiny_allocator *a)
+{
+  tiny_context c;
+  tiny_copy_work w;
+  const tiny_member *pm;
+  tiny_value *e;
+  size_t i, index;
+  assert(target != NULL && patch != NULL && target != patch && a != NULL);
+  tiny_work_init(&c, a);
+  w.src = patch;
+  w.dst = target;
+  memcpy(tiny_context_push(&c, sizeof(tiny_copy_work)), &w, sizeof(tiny_copy_work));
+  while (c.top > 0)
+  {
+    memcpy(&w, tiny_context_pop(&c, sizeof(tiny_copy_work)), sizeof(tiny_copy_work));
+    if (w.src->type != TINY_OBJECT)
+    {
+      tiny_copy_value(a, w.dst, w.src);
+      continue;
+    }
+    if (w.dst->type != TINY_OBJECT)
+      tiny_set_object_ex(w.dst, 0, a);
+    // 先把这一层改完再下到子对象，子对象的指针要等这一层的成员数组不再变动才能取
+    for (i = 0; i < w.src->u.o.size; i++)
+    {
+      pm = &w.src->u.o.m[i];
+      if (pm->v.type == TINY_NULL)
+      {
+        if ((index = tiny_find_object_index(w.dst, pm->k, pm->klen)) != TINY_KEY_NOT_EXIST)
+          tiny_remove_object_value_ex(w.dst, index, a);
+      }
+      else
+      {
+        e = tiny_set_object_value_ex(w.dst, pm->k, pm->klen, a);
+        if (pm->v.type != TINY_OBJECT)
+          tiny_copy_value(a, e, &pm->v);
+      }
+    }
+    for (i = 0; i < w.src->u.o.size; i++)
+    {
+      pm = &w.src->u.o.m[i];
+      if (pm->v.type == TINY_OBJECT && (e = tiny_find_object_value(w.dst, pm->k, pm->klen)) != NULL)
+      {
+        tiny_copy_work child;
+        child.src = &pm->v;
+        child.dst = e;
+        memcpy(tiny_context_push(&c, sizeof(tiny_copy_work)), &child, sizeof(tiny_copy_work));
+      }
+    }
+  }
+  TINY_FREE(c.a, c.stack);
+}
+
+// JSON Patch 的撤销日志。每一步原子修改记一条，失败时逆序撤销。
+// 记录里存父容器的 JSON Pointer 而不是指针：逆序撤销到这一条时，树的形状和刚做完这一步时相同，
+// 重新解析路径一定找得到同一个容器，不怕中间的扩容让指针失效
+enum
+{
+  TINY_UNDO_ADDED,     // 在 index 处新插入了一个值
+  TINY_UNDO_REPLACED,  // index 处原来的值存在 m.v 里
+  TINY_UNDO_REMOVED,   // 移出的成员（或元素）存在 m 里
+  TINY_UNDO_TAKEN      // 同上，但值被 move 拿走了，撤销时从 carry 取回
+};
+
+typedef struct
+{
+  int kind;
+  const char *path;  // 父容器，NULL 表示替换了根本身
+  size_t len;
+  size_t index;
+  tiny_member m;  // 数组元素的 m.k 为 NULL
+} tiny_undo;
+
+typedef struct
+{
+  tiny_value *root;
+  const tiny_allocator *a;
+  tiny_context log;    // tiny_undo 记录
+  tiny_context token;  // 解码指针片段的暂存区
+  tiny_value carry;    // 撤销时被取出的值，交给 TINY_UNDO_TAKEN
+} tiny_patcher;
+
+// 按 RFC 6901 解码一个片段：~1 是 /，~0 是 ~；其他的 ~ 转义返回 NULL
+static const char *tiny_pointer_token(tiny_context *c, const char *s, size_t len, size_t *klen)
+{
+  size_t i;
+  c->top = 0;
+  for (i = 0; i < len; i++)
+  {
+    if (s[i] != '~')
+      PUTC(c, s[i]);
+    else if (i + 1 < len && (s[i + 1] == '0' || s[i + 1] == '1'))
+      PUTC(c, s[++i] == '0' ? '~' : '/');
+    else
+      return NULL;
+  }
+  *klen = c->top;
+  return c->top > 0 ? c->stack : "";
+}
+
+// 数组下标：0 或者不带前导 0 的十进制数；不合法返回 TINY_KEY_NOT_EXIST
+static size_t tiny_pointer_index(const char *s, size_t len)
+{
+  size_t i, n = 0;
+  if (len == 0 || (s[0] == '0' && len > 1))
+    return TINY_KEY_NOT_EXIST;
+  for (i = 0; i < len; i++)
+  {
+    if (!ISDIGIT(s[i]) || n > ((size_t) -2 - (s[i] - '0')) / 10)
+      return TINY_KEY_NOT_EXIST;
+    n = n * 10 + (s[i] - '0');
+  }
+  return n;
+}
+
+// 在容器 v 里找片段 s 对应的位置，找不到返回 TINY_KEY_NOT_EXIST
+static size_t tiny_pointer_child(tiny_context *c, const tiny_value *v, const char *s, size_t len)
+{
+  const char *key;
+  size_t klen, index;
+  if (v->type == TINY_ARRAY)
+    return (index = tiny_pointer_index(s, len)) < v->u.a.size ? index : TINY_KEY_NOT_EXIST;
+  if (v->type == TINY_OBJECT && (key = tiny_pointer_token(c, s, len, &klen)) != NULL)
+    return tiny_find_object_index(v, key, klen);
+  return TINY_KEY_NOT_EXIST;
+}
+
+static tiny_value *tiny_pointer_at(tiny_value *v, size_t index)
+{
+  return v->type == TINY_ARRAY ? &v->u.a.e[index] : &v->u.o.m[index].v;
+}
+
+// 要往下改的容器先换成自己的存储：共享的存储不能改；紧凑拷贝的根第一次变动时会整块换掉，
+// 之前从里面记进撤销日志的节点会跟着失效，所以在记日志之前就换
+static void tiny_pointer_own(tiny_context *c, tiny_value *v)
+{
+  if (v->flags & TINY_FLAG_SHARED)
+    tiny_own_storage(tiny_global_allocator, v);
+  else if (v->flags & TINY_FLAG_BLOCK)
+    tiny_own_storage(c->a, v);
+}
+
+// write 非 0 时路上的共享容器和紧凑拷贝的根（连同找到的那个）都换成自己的存储，返回的节点可以直接改
+static tiny_value *tiny_pointer_find(tiny_context *c, tiny_value *v, const char *path, size_t len, int write)
+{
+  size_t i, j, index;
+  if (len > 0 && path[0] != '/')
+    return NULL;
+  for (i = 0; i < len; i = j)
+  {
+    for (j = i + 1; j < len && path[j] != '/'; j++)
+    {
+    }
+    if ((index = tiny_pointer_child(c, v, path + i + 1, j - i - 1)) == TINY_KEY_NOT_EXIST)
+      return NULL;
+    if (write)
+      tiny_pointer_own(c, v);
+    v = tiny_pointer_at(v, index);
+  }
+  if (write && v->type != TINY_STRING)
+    tiny_pointer_own(c, v);
+  return v;
+}
+
+tiny_value *tiny_find_pointer(tiny_value *v, const char *pointer, size_t len)
+{
+  tiny_context c;
+  tiny_value *e;
+  assert(v != NULL && (pointer != NULL || len == 0));
+  tiny_work_init(&c, tiny_global_allocator);
+  e = tiny_pointer_find(&c, v, pointer, len, 0);
+  TINY_FREE(c.a, c.stack);
+  return e;
+}
+
+// 父容器路径的长度，也就是最后一个 '/' 的位置
+static size_t tiny_pointer_parent(const char *path, size_t len)
+{
+  while (path[--len] != '/')
+  {
+  }
+  return len;
+}
+
+static void tiny_patch_log(tiny_patcher *p, int kind, const char *path, size_t len, size_t index, const tiny_member *m)
+{
+  tiny_undo u;
+  u.kind = kind;
+  u.path = path;
+  u.len = len;
+  u.index = index;
+  if (m != NULL)
+  {
+    memcpy(&u.m, m, sizeof(tiny_member));
+  }
+  else
+  {
+    u.m.k = NULL;
+    u.m.klen = 0;
+    tiny_init(&u.m.v);
+  }
+  memcpy(tiny_context_push(&p->log, sizeof(tiny_undo)), &u, sizeof(tiny_undo));
+}
+
+// 把 value 移到 path 处，成功后 value 变成 null
+static int tiny_patch_add(tiny_patcher *p, const char *path, size_t len, tiny_value *value)
+{
+  tiny_value *parent, *e;
+  tiny_member old;
+  const char *key;
+  size_t plen, index, klen;
+  if (len == 0)
+  {
+    old.k = NULL;
+    memcpy(&old.v, p->root, sizeof(tiny_value));
+    tiny_patch_log(p, TINY_UNDO_REPLACED, NULL, 0, 0, &old);
+    memcpy(p->root, value, sizeof(tiny_value));
+    tiny_init(value);
+    return TINY_PARSE_OK;
+  }
+  if (path[0] != '/')
+    return TINY_PATCH_INVALID_OPERATION;
+  plen = tiny_pointer_parent(path, len);
+  if ((parent = tiny_pointer_find(&p->token, p->root, path, plen, 1)) == NULL)
+    return TINY_PATCH_PATH_NOT_FOUND;
+  if (parent->type == TINY_ARRAY)
+  {
+    if (len - plen == 2 && path[plen + 1] == '-')
+      index = parent->u.a.size;
+    else if ((index = tiny_pointer_index(path + plen + 1, len - plen - 1)) == TINY_KEY_NOT_EXIST || index > parent->u.a.size)
+      return TINY_PATCH_PATH_NOT_FOUND;
+    tiny_move_ex(tiny_insert_array_element_ex(parent, index, p->a), value, p->a);
+    tiny_patch_log(p, TINY_UNDO_ADDED, path, plen, index, NULL);
+    return TINY_PARSE_OK;
+  }
+  if (parent->type != TINY_OBJECT || (key = tiny_pointer_token(&p->token, path + plen + 1, len - plen - 1, &klen)) == NULL)
+    return TINY_PATCH_PATH_NOT_FOUND;
+  if ((index = tiny_find_object_index(parent, key, klen)) != TINY_KEY_NOT_EXIST)
+  {
+    // 已有的键：原地替换，旧值进日志
+    e = &parent->u.o.m[index].v;
+    old.k = NULL;
+    memcpy(&old.v, e, sizeof(tiny_value));
+    tiny_patch_log(p, TINY_UNDO_REPLACED, path, plen, index, &old);
+    memcpy(e, value, sizeof(tiny_value));
+    tiny_init(value);
+    return TINY_PARSE_OK;
+  }
+  tiny_move_ex(tiny_set_object_value_ex(parent, key, klen, p->a), value, p->a);
+  tiny_patch_log(p, TINY_UNDO_ADDED, path, plen, parent->u.o.size - 1, NULL);
+  return TINY_PARSE_OK;
 }
 
-tiny_type tiny_get_type(const tiny_value *v)
+// 把 path 处的值整个移出树；out 为 NULL 时值留在日志里，否则交给调用者
+static int tiny_patch_take(tiny_patcher *p, const char *path, size_t len, tiny_value *out)
 {
-  assert(v != NULL);
-  return v->type;
+  tiny_value *parent;
+  tiny_member m;
+  size_t plen, index;
+  if (len == 0 || path[0] != '/')
+    return TINY_PATCH_INVALID_OPERATION;
+  plen = tiny_pointer_parent(path, len);
+  if ((parent = tiny_pointer_find(&p->token, p->root, path, plen, 1)) == NULL ||
+      (index = tiny_pointer_child(&p->token, parent, path + plen + 1, len - plen - 1)) == TINY_KEY_NOT_EXIST)
+    return TINY_PATCH_PATH_NOT_FOUND;
+  tiny_own_storage(p->a, parent);
+  if (parent->type == TINY_ARRAY)
+  {
+    m.k = NULL;
+    m.klen = 0;
+    memcpy(&m.v, &parent->u.a.e[index], sizeof(tiny_value));
+    memmove(&parent->u.a.e[index], &parent->u.a.e[index + 1], (--parent->u.a.size - index) * sizeof(tiny_value));
+  }
+  else
+  {
+    memcpy(&m, &parent->u.o.m[index], sizeof(tiny_member));
+    memmove(&parent->u.o.m[index], &parent->u.o.m[index + 1], (--parent->u.o.size - index) * sizeof(tiny_member));
+  }
+  if (out != NULL)
+  {
+    memcpy(out, &m.v, sizeof(tiny_value));
+    tiny_init(&m.v);
+  }
+  tiny_patch_log(p, out != NULL ? TINY_UNDO_TAKEN : TINY_UNDO_REMOVED, path, plen, index, &m);
+  return TINY_PARSE_OK;
 }
 
-int tiny_is_equal(const tiny_value *lhs, const tiny_value *rhs)
+static int tiny_patch_replace(tiny_patcher *p, const char *path, size_t len, tiny_value *value)
 {
-  size_t i;
-  assert(lhs != NULL && rhs != NULL);
-  if (lhs->type != rhs->type)
-    return 0;
-  switch (lhs->type)
+  tiny_value *parent = p->root, *e = p->root;
+  tiny_member old;
+  size_t plen = 0, index = 0;
+  if (len > 0)
   {
-  case TINY_STRING:
-    return lhs->u.s.len == rhs->u.s.len && memcmp(lhs->u.s.s, rhs->u.s.s, lhs->u.s.len) == 0;
-  case TINY_NUMBER:
-    return lhs->u.n == rhs->u.n;
-  case TINY_ARRAY:
-    if (lhs->u.a.size != rhs->u.a.size)
-      return 0;
-    for (i = 0; i < lhs->u.a.size; i++)
-      if (!tiny_is_equal(&lhs->u.a.e[i], &rhs->u.a.e[i]))
-        return 0;
-    return 1;
-  case TINY_OBJECT:
-    /* \todo */
-    return 1;
+    if (path[0] != '/')
+      return TINY_PATCH_INVALID_OPERATION;
+    plen = tiny_pointer_parent(path, len);
+    if ((parent = tiny_pointer_find(&p->token, p->root, path, plen, 1)) == NULL ||
+        (index = tiny_pointer_child(&p->token, parent, path + plen + 1, len - plen - 1)) == TINY_KEY_NOT_EXIST)
+      return TINY_PATCH_PATH_NOT_FOUND;
+    e = tiny_pointer_at(parent, index);
+  }
+  old.k = NULL;
+  memcpy(&old.v, e, sizeof(tiny_value));
+  tiny_patch_log(p, TINY_UNDO_REPLACED, len > 0 ? path : NULL, plen, index, &old);
+  memcpy(e, value, sizeof(tiny_value));
+  tiny_init(value);
+  return TINY_PARSE_OK;
+}
+
+// 撤销一条日志。从树里拿出来的值放进 carry，TINY_UNDO_TAKEN 再从 carry 取回
+static void tiny_patch_undo(tiny_patcher *p, tiny_undo *u)
+{
+  tiny_value *parent = u->path != NULL ? tiny_pointer_find(&p->token, p->root, u->path, u->len, 1) : NULL, *e;
+  assert(u->path == NULL || parent != NULL);
+  switch (u->kind)
+  {
+  case TINY_UNDO_ADDED:
+    tiny_move_ex(&p->carry, tiny_pointer_at(parent, u->index), p->a);
+    if (parent->type == TINY_ARRAY)
+      tiny_erase_array_element_ex(parent, u->index, 1, p->a);
+    else
+      tiny_remove_object_value_ex(parent, u->index, p->a);
+    break;
+  case TINY_UNDO_REPLACED:
+    e = parent != NULL ? tiny_pointer_at(parent, u->index) : p->root;
+    tiny_move_ex(&p->carry, e, p->a);
+    memcpy(e, &u->m.v, sizeof(tiny_value));
+    break;
   default:
+    if (u->kind == TINY_UNDO_TAKEN)
+      tiny_move_ex(&u->m.v, &p->carry, p->a);
+    if (parent->type == TINY_ARRAY)
+    {
+      memcpy(tiny_open_array_gap(p->a, parent, u->index, 1), &u->m.v, sizeof(tiny_value));
+    }
+    else
+    {
+      if (parent->u.o.size == parent->u.o.capacity)
+        tiny_reserve_object_ex(parent, parent->u.o.capacity == 0 ? 1 : parent->u.o.capacity * 2, p->a);
+      memmove(&parent->u.o.m[u->index + 1], &parent->u.o.m[u->index], (parent->u.o.size++ - u->index) * sizeof(tiny_member));
+      memcpy(&parent->u.o.m[u->index], &u->m, sizeof(tiny_member));
+    }
+    break;
+  }
+  tiny_init(&u->m.v);
+  u->m.k = NULL;
+}
+
+static const tiny_value *tiny_patch_member(const tiny_value *op, const char *key, tiny_type type)
+{
+  size_t index = tiny_find_object_index(op, key, strlen(key));
+  if (index == TINY_KEY_NOT_EXIST || (type != TINY_NULL && op->u.o.m[index].v.type != type))
+    return NULL;
+  if (type == TINY_STRING)
+    tiny_unescape(&op->u.o.m[index].v);
+  return &op->u.o.m[index].v;
+}
+
+#define TINY_PATCH_IS(op, name) ((op)->u.s.len == sizeof(name) - 1 && memcmp((op)->u.s.s, name, sizeof(name) - 1) == 0)
+
+static int tiny_patch_apply_one(tiny_patcher *p, const tiny_value *op)
+{
+  const tiny_value *name, *path, *from = NULL, *value = NULL;
+  tiny_value t, *e;
+  int ret;
+  if (op->type != TINY_OBJECT || (name = tiny_patch_member(op, "op", TINY_STRING)) == NULL || (path = tiny_patch_member(op, "path", TINY_STRING)) == NULL)
+    return TINY_PATCH_INVALID_OPERATION;
+  if ((TINY_PATCH_IS(name, "move") || TINY_PATCH_IS(name, "copy")) && (from = tiny_patch_member(op, "from", TINY_STRING)) == NULL)
+    return TINY_PATCH_INVALID_OPERATION;
+  if ((TINY_PATCH_IS(name, "add") || TINY_PATCH_IS(name, "replace") || TINY_PATCH_IS(name, "test")) && (value = tiny_patch_member(op, "value", TINY_NULL)) == NULL)
+    return TINY_PATCH_INVALID_OPERATION;
+  tiny_init(&t);
+  if (TINY_PATCH_IS(name, "add") || TINY_PATCH_IS(name, "replace"))
+  {
+    tiny_copy_value(p->a, &t, value);
+    ret = TINY_PATCH_IS(name, "add") ? tiny_patch_add(p, path->u.s.s, path->u.s.len, &t) : tiny_patch_replace(p, path->u.s.s, path->u.s.len, &t);
+    tiny_free_value(p->a, &t);
+    return ret;
+  }
+  if (TINY_PATCH_IS(name, "remove"))
+    return tiny_patch_take(p, path->u.s.s, path->u.s.len, NULL);
+  if (TINY_PATCH_IS(name, "test"))
+  {
+    if ((e = tiny_pointer_find(&p->token, p->root, path->u.s.s, path->u.s.len, 0)) == NULL)
+      return TINY_PATCH_PATH_NOT_FOUND;
+    return tiny_is_equal(e, value) ? TINY_PARSE_OK : TINY_PATCH_TEST_FAILED;
+  }
+  if (TINY_PATCH_IS(name, "copy"))
+  {
+    if ((e = tiny_pointer_find(&p->token, p->root, from->u.s.s, from->u.s.len, 0)) == NULL)
+      return TINY_PATCH_PATH_NOT_FOUND;
+    tiny_copy_value(p->a, &t, e);
+    ret = tiny_patch_add(p, path->u.s.s, path->u.s.len, &t);
+    tiny_free_value(p->a, &t);
+    return ret;
+  }
+  if (TINY_PATCH_IS(name, "move"))
+  {
+    if (from->u.s.len == path->u.s.len && memcmp(from->u.s.s, path->u.s.s, from->u.s.len) == 0)
+      return tiny_pointer_find(&p->token, p->root, from->u.s.s, from->u.s.len, 0) != NULL ? TINY_PARSE_OK : TINY_PATCH_PATH_NOT_FOUND;
+    // 不能把一个值移到它自己的子孙里
+    if (from->u.s.len < path->u.s.len && path->u.s.s[from->u.s.len] == '/' && memcmp(from->u.s.s, path->u.s.s, from->u.s.len) == 0)
+      return TINY_PATCH_INVALID_OPERATION;
+    if ((ret = tiny_patch_take(p, from->u.s.s, from->u.s.len, &t)) != TINY_PARSE_OK)
+      return ret;
+    if ((ret = tiny_patch_add(p, path->u.s.s, path->u.s.len, &t)) != TINY_PARSE_OK)
+      tiny_move_ex(&p->carry, &t, p->a);  // 回滚时 TINY_UNDO_TAKEN 从 carry 取回
+    return ret;
+  }
+  return TINY_PATCH_INVALID_OPERATION;
+}
+
+int tiny_apply_patch(tiny_value *target, const tiny_value *patch)
+{
+  return tiny_apply_patch_ex(target, patch, tiny_global_allocator);
+}
+
+int tiny_apply_patch_ex(tiny_value *target, const tiny_value *patch, const tiny_allocator *a)
+{
+  tiny_patcher p;
+  tiny_undo *u;
+  size_t i;
+  int ret = TINY_PARSE_OK;
+  assert(target != NULL && patch != NULL && target != patch && a != NULL);
+  if (patch->type != TINY_ARRAY)
+    return TINY_PATCH_INVALID_OPERATION;
+  p.root = target;
+  p.a = a;
+  tiny_work_init(&p.log, a);
+  tiny_work_init(&p.token, a);
+  tiny_init(&p.carry);
+  for (i = 0; i < patch->u.a.size && ret == TINY_PARSE_OK; i++)
+    ret = tiny_patch_apply_one(&p, &patch->u.a.e[i]);
+  while (p.log.top > 0)
+  {
+    u = (tiny_undo *) tiny_context_pop(&p.log, sizeof(tiny_undo));
+    if (ret != TINY_PARSE_OK)
+      tiny_patch_undo(&p, u);
+    TINY_FREE(a, u->m.k);
+    tiny_free_value(a, &u->m.v);
+  }
+  tiny_free_value(a, &p.carry);
+  TINY_FREE(p.log.a, p.log.stack);
+  TINY_FREE(p.token.a, p.token.stack);
+  return ret;
+}
+
+// LCS 表最多这么多格，再大的数组只按位置配对
+#ifndef TINY_DIFF_LCS_LIMIT
+#define TINY_DIFF_LCS_LIMIT ((size_t) 1 << 18)
+#endif
+
+// 一对需要继续比较的同类型容器；路径存在 paths 暂存区里
+typedef struct
+{
+  const tiny_value *a, *b;
+  size_t path, len;
+} tiny_diff_work;
+
+typedef struct
+{
+  tiny_value *patch;
+  const tiny_allocator *a;  // patch 和暂存区都用它分配
+  tiny_context work;
+  tiny_context paths;
+  tiny_context hashing;   // tiny_hash_value() 的工作栈
+  tiny_hash_memo hashes;  // 已经算过的较大子树的哈希
+} tiny_differ;
+
+// 较大的子树第一次用到时连同它里面较大的子树一起记下，之后往下走只是查表
+static unsigned long long tiny_diff_hash(tiny_differ *d, const tiny_value *v)
+{
+  unsigned long long h;
+  size_t j;
+  if (tiny_hash_scalar(v, &h))
+    return h;
+  j = tiny_hash_memo_slot(&d->hashes, v);
+  if (d->hashes.slots[j].v == v)
+    return d->hashes.slots[j].h;
+  return tiny_hash_value(&d->hashing, v, &d->hashes);
+}
+
+// 哈希不同一定不相等；哈希相同时才逐个比较
+static int tiny_diff_same(tiny_differ *d, const tiny_value *a, const tiny_value *b)
+{
+  return tiny_diff_hash(d, a) == tiny_diff_hash(d, b) && tiny_is_equal(a, b);
+}
+
+static void tiny_diff_op(tiny_differ *d, const char *op, size_t path, size_t len, const tiny_value *value)
+{
+  tiny_value *o = tiny_pushback_array_element_ex(d->patch, d->a);
+  tiny_set_object_ex(o, value != NULL ? 3 : 2, d->a);
+  tiny_set_string_value(d->a, tiny_set_object_value_ex(o, "op", 2, d->a), op, strlen(op));
+  tiny_set_string_value(d->a, tiny_set_object_value_ex(o, "path", 4, d->a), d->paths.stack + path, len);
+  if (value != NULL)
+    tiny_copy_value(d->a, tiny_set_object_value_ex(o, "value", 5, d->a), value);
+}
+
+// 在暂存区末尾拼出 父路径 + "/" + 转义后的片段，返回新路径的起点
+static size_t tiny_diff_path(tiny_differ *d, size_t parent, size_t plen, const char *token, size_t tlen, size_t *len)
+{
+  size_t i, at = d->paths.top;
+  tiny_context *c = &d->paths;
+  char *p;
+  if (plen > 0)
+  {
+    p = (char *) tiny_context_push(c, plen);
+    memcpy(p, c->stack + parent, plen);  // 先压栈再取源地址，压栈可能 realloc
+  }
+  PUTC(c, '/');
+  for (i = 0; i < tlen; i++)
+  {
+    if (token[i] == '~' || token[i] == '/')
+    {
+      PUTC(c, '~');
+      PUTC(c, token[i] == '~' ? '0' : '1');
+    }
+    else
+    {
+      PUTC(c, token[i]);
+    }
+  }
+  *len = d->paths.top - at;
+  return at;
+}
+
+static size_t tiny_diff_index_path(tiny_differ *d, const tiny_diff_work *w, size_t index, size_t *len)
+{
+  char buffer[32];
+  return tiny_diff_path(d, w->path, w->len, buffer, sprintf(buffer, "%lu", (unsigned long) index), len);
+}
+
+// a 和 b 放在 path 处：同类型的容器留到后面继续比，否则不相等就整个替换。
+// 返回 1 表示 path 被工作栈引用，调用者不能回收它
+static int tiny_diff_descend(tiny_differ *d, const tiny_value *a, const tiny_value *b, size_t path, size_t len)
+{
+  tiny_diff_work w;
+  if (a->type == b->type && (a->type == TINY_ARRAY || a->type == TINY_OBJECT))
+  {
+    w.a = a;
+    w.b = b;
+    w.path = path;
+    w.len = len;
+    memcpy(tiny_context_push(&d->work, sizeof(tiny_diff_work)), &w, sizeof(tiny_diff_work));
     return 1;
   }
+  if (!tiny_is_equal(a, b))
+    tiny_diff_op(d, "replace", path, len, b);
+  return 0;
 }
 
-double tiny_get_number(const tiny_value *v)
+// 先用哈希排除相同的子树，免得往下走时再把它比较一遍
+static int tiny_diff_pair(tiny_differ *d, const tiny_value *a, const tiny_value *b, size_t path, size_t len)
 {
-  assert(v != NULL && v->type == TINY_NUMBER);
-  return v->u.n;
+  if (tiny_diff_same(d, a, b))
+    return 0;
+  return tiny_diff_descend(d, a, b, path, len);
 }
 
-int tiny_get_boolean(const tiny_value *v)
+static size_t tiny_diff_find(const tiny_key_index *t, const tiny_value *o, const char *key, size_t klen)
 {
-  assert(v != NULL && (v->type == TINY_TRUE || v->type == TINY_FALSE));
-  return v->type == TINY_TRUE;
+  return t->slots != NULL ? tiny_key_index_find(t, o, key, klen) : tiny_find_object_index(o, key, klen);
 }
 
-void tiny_set_boolean(tiny_value *v, int b)
+// a 里重复的键只留最后一个，前面的都会被删掉；ai 建好后已经指向最后一个
+static size_t tiny_diff_find_kept(const tiny_key_index *t, const tiny_value *o, const char *key, size_t klen)
 {
-  // valgrind --leak-check=full  ./tinyjson_test
-  // catch no free
-  tiny_free(v);
-  v->type = b ? TINY_TRUE : TINY_FALSE;
+  size_t i, next;
+  if (t->slots != NULL)
+    return tiny_key_index_find(t, o, key, klen);
+  if ((i = tiny_find_object_index(o, key, klen)) != TINY_KEY_NOT_EXIST)
+    while ((next = tiny_find_next_key(o, i)) != TINY_KEY_NOT_EXIST)
+      i = next;
+  return i;
 }
 
-void tiny_set_number(tiny_value *v, double n)
+// 按键配对成员，大对象用哈希表查键。
+// 补丁造不出重复的键：a 里重复的键按顺序删到只剩最后一个（每次删掉的都是当前第一个），它再和 b 里的第一个配对
+static void tiny_diff_object(tiny_differ *d, const tiny_diff_work *w)
 {
-  tiny_free(v);
-  v->u.n = n;
-  v->type = TINY_NUMBER;
+  const tiny_value *a = w->a, *b = w->b;
+  const tiny_allocator *alloc = d->a;
+  tiny_key_index ai, bi;
+  size_t i, index, path, len, top = d->paths.top;
+  ai.slots = bi.slots = NULL;
+  if (a->u.o.size >= TINY_EQUAL_HASH_THRESHOLD && tiny_key_index_build(alloc, &ai, a))
+    tiny_key_index_keep_last(&ai, a);
+  if (b->u.o.size >= TINY_EQUAL_HASH_THRESHOLD)
+    tiny_key_index_build(alloc, &bi, b);
+  for (i = 0; i < a->u.o.size; i++)
+  {
+    const tiny_member *m = &a->u.o.m[i];
+    if (tiny_diff_find(&bi, b, m->k, m->klen) == TINY_KEY_NOT_EXIST || tiny_diff_find_kept(&ai, a, m->k, m->klen) != i)
+    {
+      path = tiny_diff_path(d, w->path, w->len, m->k, m->klen, &len);
+      tiny_diff_op(d, "remove", path, len, NULL);
+      d->paths.top = top;
+    }
+  }
+  for (i = 0; i < b->u.o.size; i++)
+  {
+    const tiny_member *m = &b->u.o.m[i];
+    if (tiny_diff_find(&bi, b, m->k, m->klen) != i)
+      continue;  // 重复的键以第一个为准
+    path = tiny_diff_path(d, w->path, w->len, m->k, m->klen, &len);
+    if ((index = tiny_diff_find_kept(&ai, a, m->k, m->klen)) == TINY_KEY_NOT_EXIST)
+    {
+      tiny_diff_op(d, "add", path, len, &m->v);
+      d->paths.top = top;
+    }
+    else if (!tiny_diff_pair(d, &a->u.o.m[index].v, &m->v, path, len))
+    {
+      d->paths.top = top;  // 路径没有被工作栈引用，可以回收
+    }
+    top = d->paths.top;
+  }
+  tiny_key_index_free(alloc, &ai);
+  tiny_key_index_free(alloc, &bi);
 }
 
-tiny_value *tiny_get_array_element(const tiny_value *v, size_t index)
+// 一段没有对上的区间：先按位置两两配对，多出来的删掉或补上。*index 是数组当前的下标
+static void tiny_diff_gap(tiny_differ *d, const tiny_diff_work *w, size_t *index, size_t as, size_t k, size_t bs, size_t l)
 {
-  assert(v != NULL && v->type == TINY_ARRAY);
-  assert(index < v->u.a.size);
-  return &v->u.a.e[index];
+  size_t t, path, len, top = d->paths.top;
+  for (t = 0; t < k || t < l; t++)
+  {
+    path = tiny_diff_index_path(d, w, *index, &len);
+    if (t < k && t < l)
+    {
+      if (!tiny_diff_pair(d, &w->a->u.a.e[as + t], &w->b->u.a.e[bs + t], path, len))
+        d->paths.top = top;
+      ++*index;
+    }
+    else if (t < k)
+    {
+      tiny_diff_op(d, "remove", path, len, NULL);
+      d->paths.top = top;
+    }
+    else
+    {
+      tiny_diff_op(d, "add", path, len, &w->b->u.a.e[bs + t]);
+      d->paths.top = top;
+      ++*index;
+    }
+    top = d->paths.top;
+  }
 }
 
-tiny_value *tiny_get_object_value(const tiny_value *v, size_t index)
+// 去掉相同的头尾，中间用 LCS 对齐；太大时整段按位置配对。
+// 子容器的路径用 b 中的下标：这一层的增删都发生在子容器的修改之前
+static void tiny_diff_array(tiny_differ *d, const tiny_diff_work *w)
 {
-  assert(v != NULL && v->type == TINY_OBJECT);
-  assert(index < v->u.o.size);
-  return &v->u.o.m[index].v;
+  const tiny_value *a = w->a->u.a.e, *b = w->b->u.a.e;
+  size_t n = w->a->u.a.size, m = w->b->u.a.size, head = 0, i, j, as, bs, index, cols;
+  size_t *lcs;
+  unsigned long long *ha, *hb;
+  unsigned char *eq;
+  while (head < n && head < m && tiny_diff_same(d, &a[head], &b[head]))
+    head++;
+  while (n > head && m > head && tiny_diff_same(d, &a[n - 1], &b[m - 1]))
+  {
+    n--;
+    m--;
+  }
+  index = head;
+  n -= head;
+  m -= head;
+  a += head;
+  b += head;
+  if (n == 0 || m == 0 || (n + 1) * (m + 1) > TINY_DIFF_LCS_LIMIT)
+  {
+    tiny_diff_gap(d, w, &index, head, n, head, m);
+    return;
+  }
+  // lcs[i][j] 是 a[i..] 和 b[j..] 的最长公共子序列长度
+  cols = m + 1;
+  lcs = (size_t *) TINY_MALLOC(d->a, (n + 1) * cols * sizeof(size_t));
+  eq = (unsigned char *) TINY_MALLOC(d->a, n * m);
+  // 每个元素的哈希只取一次，表里的格子只在哈希相同时才深比较
+  ha = (unsigned long long *) TINY_MALLOC(d->a, (n + m) * sizeof(unsigned long long));
+  hb = ha + n;
+  for (i = 0; i < n; i++)
+    ha[i] = tiny_diff_hash(d, &a[i]);
+  for (j = 0; j < m; j++)
+    hb[j] = tiny_diff_hash(d, &b[j]);
+  for (j = 0; j <= m; j++)
+    lcs[n * cols + j] = 0;
+  for (i = n; i-- > 0;)
+  {
+    lcs[i * cols + m] = 0;
+    for (j = m; j-- > 0;)
+    {
+      eq[i * m + j] = (unsigned char) (ha[i] == hb[j] && tiny_is_equal(&a[i], &b[j]));
+      if (eq[i * m + j])
+        lcs[i * cols + j] = lcs[(i + 1) * cols + j + 1] + 1;
+      else
+        lcs[i * cols + j] = lcs[(i + 1) * cols + j] >= lcs[i * cols + j + 1] ? lcs[(i + 1) * cols + j] : lcs[i * cols + j + 1];
+    }
+  }
+  i = j = as = bs = 0;
+  while (i < n || j < m)
+  {
+    if (i < n && j < m && eq[i * m + j])
+    {
+      tiny_diff_gap(d, w, &index, head + as, i - as, head + bs, j - bs);
+      index++;
+      as = ++i;
+      bs = ++j;
+    }
+    else if (j == m || (i < n && lcs[(i + 1) * cols + j] >= lcs[i * cols + j + 1]))
+    {
+      i++;
+    }
+    else
+    {
+      j++;
+    }
+  }
+  tiny_diff_gap(d, w, &index, head + as, i - as, head + bs, j - bs);
+  TINY_FREE(d->a, lcs);
+  TINY_FREE(d->a, eq);
+  TINY_FREE(d->a, ha);
 }
 
-void tiny_erase_array_element(tiny_value *v, size_t index, size_t count)
+void tiny_diff(tiny_value *patch, const tiny_value *a, const tiny_value *b)
+{
+  tiny_diff_ex(patch, a, b, tiny_global_allocator);
+}
+
+void tiny_diff_ex(tiny_value *patch, const tiny_value *a, const tiny_value *b, const tiny_allocator *alloc)
+{
+  tiny_differ d;
+  tiny_diff_work w;
+  assert(patch != NULL && a != NULL && b != NULL && patch != a && patch != b && alloc != NULL);
+  tiny_set_array_ex(patch, 0, alloc);
+  d.patch = patch;
+  d.a = alloc;
+  tiny_work_init(&d.work, alloc);
+  tiny_work_init(&d.paths, alloc);
+  PUTC(&d.paths, '\0');  // 保证根的空路径也有地址
+  d.paths.top = 0;
+  tiny_work_init(&d.hashing, alloc);
+  tiny_hash_memo_init(alloc, &d.hashes);
+  // 根不先整体比较，相等与否由下面逐层得出
+  tiny_diff_descend(&d, a, b, 0, 0);
+  while (d.work.top > 0)
+  {
+    memcpy(&w, tiny_context_pop(&d.work, sizeof(tiny_diff_work)), sizeof(tiny_diff_work));
+    if (w.a->type == TINY_ARRAY)
+      tiny_diff_array(&d, &w);
+    else
+      tiny_diff_object(&d, &w);
+  }
+  TINY_FREE(d.work.a, d.work.stack);
+  TINY_FREE(d.paths.a, d.paths.stack);
+  TINY_FREE(d.hashing.a, d.hashing.stack);
+  TINY_FREE(alloc, d.hashes.slots);
+}
+
+// 解析结果缓存：按输入字节的哈希分桶，再用一条双向链表维护 LRU 顺序。
+// 每项是一次分配：项头后面紧跟输入的拷贝，文档本身是 tiny_copy_compact() 的整块
+typedef struct tiny_cache_entry tiny_cache_entry;
+
+struct tiny_cache_entry
+{
+  tiny_cache_entry *next;        // 同一个桶里的下一项
+  tiny_cache_entry *newer, *older;  // LRU 链表
+  unsigned long long hash;
+  size_t len;    // 输入长度
+  size_t bytes;  // 这一项占用的内存，计入预算
+  tiny_value v;
+};
+
+struct tiny_parse_cache
+{
+  const tiny_allocator *a;
+  tiny_cache_entry **buckets;
+  size_t mask;
+  tiny_cache_entry *newest, *oldest;
+  size_t budget;
+  tiny_parse_cache_stats stats;
+};
+
+#define TINY_CACHE_JSON(e) ((char *) ((e) + 1))
+
+tiny_parse_cache *tiny_parse_cache_create(size_t budget, const tiny_allocator *a)
+{
+  tiny_parse_cache *c;
+  if (a == NULL)
+    a = tiny_global_allocator;
+  c = (tiny_parse_cache *) TINY_MALLOC(a, sizeof(tiny_parse_cache));
+  c->a = a;
+  c->mask = 15;
+  c->buckets = (tiny_cache_entry **) TINY_MALLOC(a, (c->mask + 1) * sizeof(tiny_cache_entry *));
+  memset(c->buckets, 0, (c->mask + 1) * sizeof(tiny_cache_entry *));
+  c->newest = c->oldest = NULL;
+  c->budget = budget;
+  memset(&c->stats, 0, sizeof(c->stats));
+  return c;
+}
+
+static void tiny_cache_unlink(tiny_parse_cache *c, tiny_cache_entry *e)
+{
+  if (e->newer != NULL)
+    e->newer->older = e->older;
+  else
+    c->newest = e->older;
+  if (e->older != NULL)
+    e->older->newer = e->newer;
+  else
+    c->oldest = e->newer;
+}
+
+static void tiny_cache_push_newest(tiny_parse_cache *c, tiny_cache_entry *e)
+{
+  e->newer = NULL;
+  e->older = c->newest;
+  if (c->newest != NULL)
+    c->newest->newer = e;
+  else
+    c->oldest = e;
+  c->newest = e;
+}
+
+static void tiny_cache_evict(tiny_parse_cache *c, tiny_cache_entry *e)
+{
+  tiny_cache_entry **p = &c->buckets[(size_t) e->hash & c->mask];
+  while (*p != e)
+    p = &(*p)->next;
+  *p = e->next;
+  tiny_cache_unlink(c, e);
+  c->stats.entries--;
+  c->stats.bytes -= e->bytes;
+  tiny_free_value(c->a, &e->v);
+  TINY_FREE(c->a, e);
+}
+
+// 项数超过桶数时桶数翻倍
+static void tiny_cache_grow(tiny_parse_cache *c)
+{
+  size_t i, mask = c->mask * 2 + 1;
+  tiny_cache_entry **buckets = (tiny_cache_entry **) TINY_MALLOC(c->a, (mask + 1) * sizeof(tiny_cache_entry *));
+  tiny_cache_entry *e, *next;
+  memset(buckets, 0, (mask + 1) * sizeof(tiny_cache_entry *));
+  for (i = 0; i <= c->mask; i++)
+  {
+    for (e = c->buckets[i]; e != NULL; e = next)
+    {
+      next = e->next;
+      e->next = buckets[(size_t) e->hash & mask];
+      buckets[(size_t) e->hash & mask] = e;
+    }
+  }
+  TINY_FREE(c->a, c->buckets);
+  c->buckets = buckets;
+  c->mask = mask;
+}
+
+// 整块拷贝后文档占用的字节数
+static size_t tiny_cache_document_bytes(const tiny_allocator *a, const tiny_value *v)
+{
+  tiny_context w;
+  size_t nodes = 0, chars = 0;
+  if (v->type == TINY_STRING)
+    return v->u.s.len + 1;
+  if ((v->type != TINY_ARRAY && v->type != TINY_OBJECT) || v->u.a.size == 0)
+    return 0;
+  tiny_work_init(&w, a);
+  tiny_compact_measure(&w, v, &nodes, &chars);
+  TINY_FREE(a, w.stack);
+  return nodes + chars;
+}
+
+const tiny_value *tiny_parse_cache_get(tiny_parse_cache *c, const char *json, int *ret)
+{
+  size_t len;
+  unsigned long long hash;
+  tiny_cache_entry *e, **bucket;
+  tiny_value v;
+  int r;
+  assert(c != NULL && json != NULL);
+  len = strlen(json);
+  hash = tiny_hash_bytes(json, len, 0);
+  bucket = &c->buckets[(size_t) hash & c->mask];
+  for (e = *bucket; e != NULL; e = e->next)
+  {
+    if (e->hash == hash && e->len == len && memcmp(TINY_CACHE_JSON(e), json, len) == 0)
+    {
+      c->stats.hits++;
+      tiny_cache_unlink(c, e);
+      tiny_cache_push_newest(c, e);
+      if (ret != NULL)
+        *ret = TINY_PARSE_OK;
+      return &e->v;
+    }
+  }
+  c->stats.misses++;
+  tiny_init(&v);
+  if ((r = tiny_parse_ex(&v, json, c->a)) != TINY_PARSE_OK)
+  {
+    if (ret != NULL)
+      *ret = r;
+    return NULL;  // 出错的输入不缓存
+  }
+  e = (tiny_cache_entry *) TINY_MALLOC(c->a, sizeof(tiny_cache_entry) + len);
+  memcpy(TINY_CACHE_JSON(e), json, len);
+  e->hash = hash;
+  e->len = len;
+  e->bytes = sizeof(tiny_cache_entry) + len + tiny_cache_document_bytes(c->a, &v);
+  tiny_init(&e->v);
+  tiny_copy_compact_ex(&e->v, &v, c->a);
+  tiny_free_value(c->a, &v);
+  e->next = *bucket;
+  *bucket = e;
+  tiny_cache_push_newest(c, e);
+  c->stats.entries++;
+  c->stats.bytes += e->bytes;
+  // 从最久没用的开始淘汰；比预算还大的文档留到下一次插入时再淘汰
+  while (c->stats.bytes > c->budget && c->oldest != e)
+  {
+    tiny_cache_evict(c, c->oldest);
+    c->stats.evictions++;
+  }
+  if (c->stats.entries > c->mask + 1)
+    tiny_cache_grow(c);
+  if (ret != NULL)
+    *ret = TINY_PARSE_OK;
+  return &e->v;
+}
+
+int tiny_parse_cache_parse(tiny_parse_cache *c, tiny_value *v, const char *json)
+{
+  int ret;
+  const tiny_value *doc;
+  assert(v != NULL);
+  if ((doc = tiny_parse_cache_get(c, json, &ret)) != NULL)
+  {
+    tiny_init(v);
+    tiny_copy_compact_ex(v, doc, c->a);
+  }
+  return ret;
+}
+
+void tiny_parse_cache_get_stats(const tiny_parse_cache *c, tiny_parse_cache_stats *stats)
+{
+  assert(c != NULL && stats != NULL);
+  memcpy(stats, &c->stats, sizeof(tiny_parse_cache_stats));
+}
+
+void tiny_parse_cache_clear(tiny_parse_cache *c)
+{
+  assert(c != NULL);
+  while (c->oldest != NULL)
+    tiny_cache_evict(c, c->oldest);
+}
+
+void tiny_parse_cache_destroy(tiny_parse_cache *c)
+{
+  if (c == NULL)
+    return;
+  tiny_parse_cache_clear(c);
+  TINY_FREE(c->a, c->buckets);
+  TINY_FREE(c->a, c);
+}
+
+// 冻结文档：值原样搬进来，不再拷贝；最后一个引用释放时整棵树随之释放
+struct tiny_document
+{
+  tiny_value v;
+  const tiny_allocator *a;
+  volatile long refs;
+};
+
+tiny_document *tiny_freeze(tiny_value *v)
+{
+  return tiny_freeze_ex(v, tiny_global_allocator);
+}
+
+tiny_document *tiny_freeze_ex(tiny_value *v, const tiny_allocator *a)
+{
+  tiny_document *d;
+  assert(v != NULL && a != NULL);
+  tiny_detach(a, v);
+  d = (tiny_document *) TINY_MALLOC(a, sizeof(tiny_document));
+  memcpy(&d->v, v, sizeof(tiny_value));
+  tiny_init(v);
+  d->a = a;
+  d->refs = 1;
+  return d;
+}
+
+const tiny_value *tiny_document_root(const tiny_document *d)
+{
+  assert(d != NULL);
+  return &d->v;
+}
+
+tiny_document *tiny_document_retain(tiny_document *d)
+{
+  assert(d != NULL);
+  TINY_ATOMIC_INC(&d->refs);
+  return d;
+}
+
+void tiny_document_release(tiny_document *d)
 {
-  assert(v != NULL && v->type == TINY_ARRAY && index + count <= v->u.a.size);
-  /* \todo */
+  if (d == NULL || TINY_ATOMIC_DEC(&d->refs) != 0)
+    return;
+  tiny_free_value(d->a, &d->v);
+  TINY_FREE(d->a, d);
 }
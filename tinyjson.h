@@ -44,10 +44,43 @@ struct tiny_value
       size_t len;
     } s;       // string
     double n;  // number
+    struct
+    {
+      double n;       // same storage as u.n, valid once TINY_FLAG_LAZY_NUMBER is clear
+      const char *p;  // source text, see TINY_FLAG_RAW_NUMBER
+      size_t len;
+    } r;  // number parsed with TINY_PARSER_LAZY_NUMBERS
   } u;
   tiny_type type;
+  unsigned char flags;  // TINY_FLAG_*, storage ownership
 };
 
+// The storage of this value (string chars, elements, members and keys) lives
+// inside an allocation owned by an enclosing value. It is copied out, with
+// every borrowed descendant, before the first structural change and before the
+// value is moved out of its container.
+#define TINY_FLAG_BORROWED 0x01
+// The storage of this value is a single allocation that also holds the
+// storage of all its descendants (see tiny_copy_compact()).
+#define TINY_FLAG_BLOCK 0x02
+// The number still lives as text in u.r; it is converted by the first read.
+#define TINY_FLAG_LAZY_NUMBER 0x04
+// u.r.p points at the number's digits in the parsed input, which must outlive
+// the value (or call tiny_materialize()). Stringify copies them verbatim.
+#define TINY_FLAG_RAW_NUMBER 0x08
+// The string is still the raw text between the quotes in the parsed input,
+// escapes included (always together with TINY_FLAG_BORROWED); it is decoded
+// into its own allocation by the first read.
+#define TINY_FLAG_ESCAPED 0x10
+// The keys of this object point into the parsed input and are not
+// NUL-terminated; the member array itself is owned. Keys are copied out
+// before the first structural change.
+#define TINY_FLAG_KEY_VIEWS 0x20
+// The storage is reference-counted and may be shared with other values (see
+// tiny_persist()); so is the storage of every descendant. It is copied, one
+// level at a time, before the first write.
+#define TINY_FLAG_SHARED 0x40
+
 struct tiny_member
 {
   char *k;       // key
@@ -71,16 +104,320 @@ enum
   TINY_PARSE_MISS_KEY,
   TINY_PARSE_MISS_COLON,
   TINY_PARSE_MISS_COMMA_OR_CURLY_BRACKET,
+  TINY_PARSE_DEPTH_EXCEEDED,  // nesting deeper than the parser's max_depth
+  TINY_PARSE_MSGPACK_TRUNCATED,  // input ends inside a MessagePack value
+  TINY_PARSE_INVALID_MSGPACK,    // unsupported type, non-string key, NaN or infinity
+  TINY_PARSE_SCHEMA_MISMATCH,    // value does not fit the field it is bound to
+  TINY_PATCH_INVALID_OPERATION,  // malformed JSON Patch operation or pointer
+  TINY_PATCH_PATH_NOT_FOUND,
+  TINY_PATCH_TEST_FAILED,
+  TINY_PARSE_INVALID_UTF8,      // malformed UTF-8 in a string (TINY_PARSER_VALIDATE_UTF8)
+  TINY_PARSE_INVALID_SELECTOR,  // tiny_filter_init() could not read a selector
 };
 
+#ifdef TINY_ENABLE_STATS
+// Counters filled in by tiny_parse_with_stats() and tiny_stringify_with_stats().
+// They accumulate across calls, so zero the struct before the first use.
+typedef struct
+{
+  size_t alloc_count;           // allocations made for strings, keys, arrays and objects
+  size_t alloc_bytes;           // bytes requested by those allocations
+  size_t stack_realloc_count;   // growths of the scratch stack
+  size_t stack_peak;            // largest scratch stack size in bytes
+  size_t max_depth;             // deepest array/object nesting
+  size_t type_count[7];         // values seen, indexed by tiny_type
+  size_t string_bytes;          // decoded string and key bytes
+  size_t escape_bytes;          // bytes of escape sequences read or written
+  unsigned long long parse_cycles;
+  unsigned long long string_cycles;  // spent decoding strings and keys
+  unsigned long long number_cycles;  // spent validating and converting numbers
+  unsigned long long stringify_cycles;
+} tiny_parse_stats;
+#endif
+
+// Every allocation the library makes goes through a tiny_allocator.
+// realloc_fn receives the old size so pool allocators need no size headers;
+// free_fn may be called with NULL.
+typedef struct
+{
+  void *(*malloc_fn)(void *ud, size_t size);
+  void *(*realloc_fn)(void *ud, void *ptr, size_t old_size, size_t new_size);
+  void (*free_fn)(void *ud, void *ptr);
+  void *ud;  // user context passed to every call
+} tiny_allocator;
+
+// Installs the allocator used by every function without an _ex suffix.
+// NULL restores malloc/realloc/free. The allocator must outlive all values made with it.
+void tiny_set_allocator(const tiny_allocator *a);
+const tiny_allocator *tiny_get_allocator(void);
+
 #define tiny_init(v)       \
   do                       \
   {                        \
     (v)->type = TINY_NULL; \
+    (v)->flags = 0;        \
   } while (0)
 
 int tiny_parse(tiny_value *v, const char *json);
 char *tiny_stringify(const tiny_value *v, size_t *length);
+// Per-document allocator: a value parsed or copied with an allocator must be
+// released with tiny_free_ex() and mutated with the _ex mutators (see the end
+// of this file), passing the same allocator.
+int tiny_parse_ex(tiny_value *v, const char *json, const tiny_allocator *a);
+char *tiny_stringify_ex(const tiny_value *v, size_t *length, const tiny_allocator *a);
+void tiny_free_ex(tiny_value *v, const tiny_allocator *a);
+void tiny_copy_ex(tiny_value *dst, const tiny_value *src, const tiny_allocator *a);
+
+// Reusable parser: the scratch stack survives between calls, so a hot loop
+// over many small messages stops growing and freeing it on every call.
+typedef struct
+{
+  char *stack;
+  size_t size;
+  const tiny_allocator *a;
+  size_t max_depth;
+  unsigned flags;  // TINY_PARSER_*
+} tiny_parser;
+
+// Numbers are validated but not converted: the value keeps a pointer to the
+// digits and converts them on the first tiny_get_number(), and an untouched
+// number is stringified exactly as it was written. The input text must stay
+// alive and unchanged as long as the values parsed from it.
+#define TINY_PARSER_LAZY_NUMBERS 0x01
+// Strings and keys are not copied: they point into the input (with
+// TINY_FLAG_BORROWED / TINY_FLAG_KEY_VIEWS) and are not NUL-terminated, so
+// always use the _length getters. A string containing escapes keeps its raw
+// text, is stringified from it as is and is decoded by the first
+// tiny_get_string(), with the global allocator; a parser with its own
+// allocator decodes such strings while parsing instead.
+// The input must outlive the values, as with TINY_PARSER_LAZY_NUMBERS.
+#define TINY_PARSER_BORROW_STRINGS 0x02
+// Strings and keys must be well-formed UTF-8 (no overlong forms, surrogates
+// or code points above U+10FFFF, escaped lone surrogates included), checked
+// while they are scanned; otherwise TINY_PARSE_INVALID_UTF8.
+#define TINY_PARSER_VALIDATE_UTF8 0x04
+
+// a == NULL uses the allocator installed at init time.
+void tiny_parser_init(tiny_parser *p, const tiny_allocator *a);
+// Arrays and objects nested deeper than max_depth fail with
+// TINY_PARSE_DEPTH_EXCEEDED. Parsing is iterative, so any limit is safe for
+// the thread stack; the default is TINY_PARSE_MAX_DEPTH (unlimited).
+void tiny_parser_set_max_depth(tiny_parser *p, size_t max_depth);
+void tiny_parser_set_flags(tiny_parser *p, unsigned flags);
+int tiny_parser_parse(tiny_parser *p, tiny_value *v, const char *json);
+// Trims the scratch stack down to at most keep bytes (0 releases it).
+void tiny_parser_reset(tiny_parser *p, size_t keep);
+void tiny_parser_destroy(tiny_parser *p);
+
+// Batch parsing of JSON documents packed back to back in buf (separated by
+// whitespace where needed, as in NDJSON). The callback gets every document in
+// turn with its byte range [begin, end) in buf and the parse result; after an
+// error v is null and parsing resumes after the bad document, found by
+// matching its brackets (so unbalanced brackets can swallow the documents
+// that follow). v is released when the callback returns: move it out with
+// tiny_move() to keep it (tiny_move_ex() with the parser's allocator if it
+// has its own). Documents are parsed in place, so with a borrowing parser
+// they point into buf and must not outlive it; buf needs no terminating
+// '\0', and only the document running up to buf + len is parsed from a
+// copy and materialized. A non-zero return stops the batch. Returns the
+// first error, or TINY_PARSE_OK.
+typedef int (*tiny_parse_many_callback)(void *ud, tiny_value *v, int ret, size_t begin, size_t end);
+
+int tiny_parser_parse_many(tiny_parser *p, const char *buf, size_t len, tiny_parse_many_callback cb, void *ud);
+// Same with a temporary parser and the global allocator.
+int tiny_parse_many(const char *buf, size_t len, tiny_parse_many_callback cb, void *ud);
+
+// Parse cache for inputs that repeat: the input bytes are hashed and, on a
+// hit, the document parsed earlier is returned instead of parsing again.
+// Least recently used documents are evicted once the cached inputs and
+// documents take more than budget bytes (a single larger document is kept
+// until the next miss). Inputs that fail to parse are not cached. A cache is
+// not thread-safe.
+typedef struct tiny_parse_cache tiny_parse_cache;
+
+typedef struct
+{
+  size_t hits, misses, evictions;
+  size_t entries;  // documents currently cached
+  size_t bytes;    // memory they take, compared with the budget
+} tiny_parse_cache_stats;
+
+// a == NULL uses the global allocator.
+tiny_parse_cache *tiny_parse_cache_create(size_t budget, const tiny_allocator *a);
+void tiny_parse_cache_destroy(tiny_parse_cache *c);
+// Returns the cached document, read-only and owned by the cache; it stays
+// valid until the next call on the cache. Returns NULL on a parse error, which
+// is stored in *ret (ret may be NULL).
+const tiny_value *tiny_parse_cache_get(tiny_parse_cache *c, const char *json, int *ret);
+// Like tiny_parse(), but v receives a private compact copy (one allocation,
+// see tiny_copy_compact()) made with the cache's allocator, which v must then
+// be mutated and freed with.
+int tiny_parse_cache_parse(tiny_parse_cache *c, tiny_value *v, const char *json);
+void tiny_parse_cache_get_stats(const tiny_parse_cache *c, tiny_parse_cache_stats *stats);
+// Drops every cached document; the counters are kept.
+void tiny_parse_cache_clear(tiny_parse_cache *c);
+
+// Frozen document: an immutable, reference-counted tree that threads can
+// share without locks. Freezing moves the value in (v is left null) and
+// retaining bumps an atomic counter, so both are O(1) whatever the size; the
+// last release frees the tree. Readers must only use the const accessors
+// (tiny_get_*, tiny_find_object_index, tiny_stringify, tiny_is_equal, ...).
+// Lazy numbers and escaped borrowed strings are converted in place on first
+// access, and borrowed values point into the input, so call
+// tiny_materialize() before freezing a value parsed with those flags.
+typedef struct tiny_document tiny_document;
+
+tiny_document *tiny_freeze(tiny_value *v);
+// The value must have been built with a; the document is allocated with it too.
+tiny_document *tiny_freeze_ex(tiny_value *v, const tiny_allocator *a);
+const tiny_value *tiny_document_root(const tiny_document *d);
+// Returns d, so a publisher can write shared = tiny_document_retain(d).
+tiny_document *tiny_document_retain(tiny_document *d);
+// NULL is ignored.
+void tiny_document_release(tiny_document *d);
+
+// Reusable stringifier: the output buffer is owned by the handle and stays
+// valid until the next run, reset or destroy.
+typedef struct
+{
+  char *buffer;
+  size_t size;
+  const tiny_allocator *a;
+} tiny_stringifier;
+
+void tiny_stringifier_init(tiny_stringifier *s, const tiny_allocator *a);
+const char *tiny_stringifier_run(tiny_stringifier *s, const tiny_value *v, size_t *length);
+void tiny_stringifier_reset(tiny_stringifier *s, size_t keep);
+void tiny_stringifier_destroy(tiny_stringifier *s);
+
+// Exact output length of tiny_stringify(), without the terminating '\0'.
+size_t tiny_stringify_size(const tiny_value *v);
+// Writes the JSON text into buf and returns its length. Nothing is allocated
+// unless the value nests deeper than 32 levels.
+// A '\0' is appended when there is room. If the result is greater than cap
+// the output did not fit and the contents of buf are unspecified.
+size_t tiny_stringify_into(const tiny_value *v, char *buf, size_t cap);
+
+// MessagePack encoding of the same tree. Integral numbers use the shortest
+// integer form and every other number a float64; strings, arrays and maps
+// carry their length so decoding allocates each node exactly once. The
+// returned buffer is not NUL-terminated.
+char *tiny_encode_msgpack(const tiny_value *v, size_t *length);
+char *tiny_encode_msgpack_ex(const tiny_value *v, size_t *length, const tiny_allocator *a);
+// Decodes exactly len bytes; never reads past data + len. Integers and floats
+// become numbers, bin becomes a string, map keys must be strings and ext
+// types are rejected. Returns TINY_PARSE_OK or a TINY_PARSE_* error.
+int tiny_decode_msgpack(tiny_value *v, const char *data, size_t len);
+int tiny_decode_msgpack_ex(tiny_value *v, const char *data, size_t len, const tiny_allocator *a);
+
+// Read-only binary snapshot. tiny_snapshot_write() stores a tree in a
+// position-independent layout (offsets instead of pointers, native byte
+// order); tiny_snapshot_open() maps the file and the tiny_snap_* accessors
+// read it in place, without parsing or allocating. Opening only checks the
+// header, so its cost does not depend on the file size; only open files
+// written by tiny_snapshot_write() on a machine with the same byte order.
+typedef struct tiny_snapshot tiny_snapshot;
+typedef struct tiny_snap_node tiny_snap_node;
+
+// Returns 0 on success and -1 if the file could not be written.
+int tiny_snapshot_write(const tiny_value *v, const char *path);
+// Returns NULL if the file is missing, truncated or not a snapshot.
+tiny_snapshot *tiny_snapshot_open(const char *path);
+// Nodes and strings point into the mapping and die with it.
+void tiny_snapshot_close(tiny_snapshot *s);
+const tiny_snap_node *tiny_snapshot_root(const tiny_snapshot *s);
+
+tiny_type tiny_snap_get_type(const tiny_snap_node *n);
+int tiny_snap_get_boolean(const tiny_snap_node *n);
+double tiny_snap_get_number(const tiny_snap_node *n);
+const char *tiny_snap_get_string(const tiny_snap_node *n);
+size_t tiny_snap_get_string_length(const tiny_snap_node *n);
+size_t tiny_snap_get_array_size(const tiny_snap_node *n);
+const tiny_snap_node *tiny_snap_get_array_element(const tiny_snap_node *n, size_t index);
+size_t tiny_snap_get_object_size(const tiny_snap_node *n);
+const char *tiny_snap_get_object_key(const tiny_snap_node *n, size_t index);
+size_t tiny_snap_get_object_key_length(const tiny_snap_node *n, size_t index);
+const tiny_snap_node *tiny_snap_get_object_value(const tiny_snap_node *n, size_t index);
+size_t tiny_snap_find_object_index(const tiny_snap_node *n, const char *key, size_t klen);
+const tiny_snap_node *tiny_snap_find_object_value(const tiny_snap_node *n, const char *key, size_t klen);
+
+// Schema-bound parsing: a descriptor lists the members of a C struct and
+// tiny_parse_struct() writes the JSON object straight into it, without
+// building a tree. Unknown keys are validated and skipped without allocating.
+typedef enum
+{
+  TINY_FIELD_BOOL,    // int, from true/false
+  TINY_FIELD_INT,     // int, from an integral number in range
+  TINY_FIELD_NUMBER,  // double
+  TINY_FIELD_STRING,  // char *, NUL-terminated; null gives NULL
+  TINY_FIELD_OBJECT,  // nested struct described by schema
+  TINY_FIELD_VALUE    // tiny_value holding any JSON value
+} tiny_field_type;
+
+typedef struct tiny_schema tiny_schema;
+
+typedef struct
+{
+  const char *key;
+  size_t offset;  // offsetof() the member
+  tiny_field_type type;
+  const tiny_schema *schema;  // TINY_FIELD_OBJECT only
+} tiny_field;
+
+#define TINY_FIELD(key, type, member, ftype, schema) {key, offsetof(type, member), ftype, schema}
+
+// Filled in by tiny_schema_init(): a perfect hash of the keys, so each key in
+// the input costs one hash and one compare.
+struct tiny_schema
+{
+  const tiny_field *fields;
+  size_t count;
+  unsigned long long seed;
+  size_t mask;
+  struct tiny_schema_slot *slots;
+};
+
+// Builds the key table once; fields must outlive the schema and keys must be
+// unique. Nested schemas are initialized separately.
+void tiny_schema_init(tiny_schema *s, const tiny_field *fields, size_t count);
+void tiny_schema_destroy(tiny_schema *s);
+// out must start zeroed (a string or value field is released before it is
+// overwritten). Members whose key is absent keep their value. On error every
+// string and value field is released and the other fields may be partly set.
+int tiny_parse_struct(void *out, const tiny_schema *s, const char *json);
+// Releases the strings and values, leaving NULL and null behind.
+void tiny_free_struct(void *out, const tiny_schema *s);
+
+// Filtered parsing: only the parts of the document named by a set of
+// selectors are built; every other subtree is validated and skipped without
+// allocating. A selector is "$" followed by steps: ".key" (member key),
+// ".*" (every member), "[n]" (element n) and "[*]" (every element), e.g.
+// "$.user.id" or "$.events[*].type"; keys cannot contain '.' or '['. The
+// result keeps the shape of the document along the matched paths: objects
+// keep the matching members and arrays the matching elements, in input order
+// (so "[n]" does not keep the position). Containers with nothing selected in
+// them are left out, except the root, and a selector that names a container
+// keeps it whole.
+struct tiny_filter_step;
+
+typedef struct
+{
+  struct tiny_filter_step *steps;  // selector i is steps[first[i]] .. steps[first[i + 1] - 1]
+  size_t *first;
+  size_t count;
+} tiny_filter;
+
+// Compiles the selectors once; their text must outlive the filter. Returns
+// TINY_PARSE_INVALID_SELECTOR (and leaves nothing to destroy) if one of them
+// cannot be read.
+int tiny_filter_init(tiny_filter *f, const char *const *selectors, size_t count);
+void tiny_filter_destroy(tiny_filter *f);
+// Same errors as tiny_parse(), including those in skipped subtrees.
+int tiny_parse_filtered(tiny_value *v, const tiny_filter *f, const char *json);
+#ifdef TINY_ENABLE_STATS
+int tiny_parse_with_stats(tiny_value *v, const char *json, tiny_parse_stats *stats);
+char *tiny_stringify_with_stats(const tiny_value *v, size_t *length, tiny_parse_stats *stats);
+#endif
 
 void tiny_free(tiny_value *v);
 
@@ -91,17 +428,51 @@ tiny_type tiny_get_type(const tiny_value *v);
 int tiny_get_boolean(const tiny_value *v);
 void tiny_set_boolean(tiny_value *v, int b);
 
+// Converts a lazy number in place on the first call, so a value shared
+// between threads must be materialized before they read it.
 double tiny_get_number(const tiny_value *v);
 void tiny_set_number(tiny_value *v, double n);
+// The number exactly as written in the input, or NULL if it was not parsed
+// with TINY_PARSER_LAZY_NUMBERS (or has since been materialized or set).
+const char *tiny_get_number_text(const tiny_value *v, size_t *len);
+// Converts every lazy number, copies every borrowed string and key and so
+// drops all pointers into the input, after which the input may be released.
+void tiny_materialize(tiny_value *v);
+
+// Persistent values: arrays, objects and strings are reference-counted and
+// shared between versions instead of copied. tiny_persist() converts the
+// parts of v that are not shared yet (materializing them on the way);
+// tiny_share() persists src and makes dst another reference to it, so after a
+// few edits a new version costs only the edited paths. Writes stay private to
+// the value written: every call that changes a container (tiny_set_*,
+// tiny_pushback_array_element, tiny_set_object_value, tiny_remove_*, the
+// patch functions, ...) first copies its shared storage, one level deep, and
+// the children keep being shared. Reach a child that is going to be modified
+// through tiny_edit_array_element(), tiny_edit_object_value() or
+// tiny_set_object_value(): tiny_get_array_element(), tiny_get_object_value(),
+// tiny_find_object_value() and tiny_find_pointer() return the shared node,
+// which is read-only. Persistent values use the global allocator. The counts
+// are atomic, so different versions may be used and released on different
+// threads; a single version is not thread-safe.
+void tiny_persist(tiny_value *v);
+void tiny_share(tiny_value *dst, tiny_value *src);
+tiny_value *tiny_edit_array_element(tiny_value *v, size_t index);
+tiny_value *tiny_edit_object_value(tiny_value *v, size_t index);
 
 const char *tiny_get_string(const tiny_value *v);
 size_t tiny_get_string_length(const tiny_value *v);
 void tiny_set_string(tiny_value *v, const char *s, size_t len);
 
 size_t tiny_get_array_size(const tiny_value *v);
+void tiny_reserve_array(tiny_value *v, size_t capacity);
 tiny_value *tiny_get_array_element(const tiny_value *v, size_t index);
 
+void tiny_set_object(tiny_value *v, size_t capacity);
 size_t tiny_get_object_size(const tiny_value *v);
+size_t tiny_get_object_capacity(const tiny_value *v);
+void tiny_reserve_object(tiny_value *v, size_t capacity);
+void tiny_shrink_object(tiny_value *v);
+void tiny_clear_object(tiny_value *v);
 const char *tiny_get_object_key(const tiny_value *v, size_t index);
 size_t tiny_get_object_key_length(const tiny_value *v, size_t index);
 tiny_value *tiny_get_object_value(const tiny_value *v, size_t index);
@@ -109,16 +480,95 @@ size_t tiny_find_object_index(const tiny_value *v, const char *key, size_t klen)
 tiny_value *tiny_find_object_value(tiny_value *v, const char *key, size_t klen);
 tiny_value *tiny_set_object_value(tiny_value *v, const char *key, size_t klen);
 void tiny_remove_object_value(tiny_value *v, size_t index);
+// O(1) removal that moves the last member into index; member order changes.
+void tiny_swap_remove_object_value(tiny_value *v, size_t index);
 void tiny_erase_array_element(tiny_value *v, size_t index, size_t count);
+// Objects compare as multisets of members: order does not matter and each
+// member of one side is matched by exactly one of the other, so duplicate
+// keys count as many times as they appear.
 int tiny_is_equal(const tiny_value *lhs, const tiny_value *rhs);
+// 64-bit structural hash consistent with tiny_is_equal(): equal values hash
+// equally (0 and -0 included). The result depends on the byte order, so do
+// not persist it across platforms.
+unsigned long long tiny_hash(const tiny_value *v);
 size_t tiny_get_array_capacity(const tiny_value *v);
 void tiny_shrink_array(tiny_value *v);
 void tiny_move(tiny_value *dst, tiny_value *src);
 tiny_value *tiny_pushback_array_element(tiny_value *v);
+tiny_value *tiny_insert_array_element(tiny_value *v, size_t index);
+// Batch insertion: one reallocation and one memmove per call.
+// Opens count null elements at index and returns the first one.
+tiny_value *tiny_insert_array_elements(tiny_value *v, size_t index, size_t count);
+// Moves count values into the array at index; the sources are left null.
+void tiny_insert_array_values(tiny_value *v, size_t index, tiny_value *values, size_t count);
+void tiny_append_array_values(tiny_value *v, tiny_value *values, size_t count);
+// Moves every element of src into dst at index; src is left an empty array.
+void tiny_splice_array(tiny_value *dst, size_t index, tiny_value *src);
 void tiny_clear_array(tiny_value *v);
 void tiny_copy(tiny_value *dst, const tiny_value *src);
+// Deep copy into one contiguous allocation: nodes, keys and strings are laid
+// out together and released by a single free. The clone stays fully mutable;
+// a node is copied out of the block, together with the rest of its subtree
+// still in there, the first time its storage has to grow, shrink or lose
+// members, or when it is moved out (tiny_move(), tiny_swap(),
+// tiny_splice_array(), tiny_insert_array_values()), so it outlives the clone.
+void tiny_copy_compact(tiny_value *dst, const tiny_value *src);
+void tiny_copy_compact_ex(tiny_value *dst, const tiny_value *src, const tiny_allocator *a);
 void tiny_set_array(tiny_value *v, size_t capacity);
 void tiny_swap(tiny_value *lhs, tiny_value *rhs);
 void tiny_popback_array_element(tiny_value *v);
 
+// RFC 6901 JSON Pointer ("" is v itself, "/a/0" ...); NULL if nothing is there.
+tiny_value *tiny_find_pointer(tiny_value *v, const char *pointer, size_t len);
+// RFC 7386 JSON Merge Patch, applied in place: only the members named by the
+// patch are touched, values are copied out of the patch.
+void tiny_apply_merge_patch(tiny_value *target, const tiny_value *patch);
+// RFC 6902 JSON Patch, applied in place. Untouched nodes are never copied and
+// "move" relinks the subtree. The patch is atomic: every step is recorded in
+// an undo log and a failing operation rolls the earlier ones back, so target
+// is unchanged unless TINY_PARSE_OK is returned.
+int tiny_apply_patch(tiny_value *target, const tiny_value *patch);
+// Writes into patch an RFC 6902 patch that turns a into b. Only subtrees that
+// differ are visited; object members are matched by key and array elements
+// by a longest common subsequence (positionally for very large arrays).
+// A patch cannot create duplicate keys: duplicates in a are removed down to
+// the last one, which is then diffed against the first of the same key in
+// b; later duplicates in b are ignored.
+void tiny_diff(tiny_value *patch, const tiny_value *a, const tiny_value *b);
+
+// Mutation of a value made with an allocator (tiny_parse_ex(), tiny_copy_ex(),
+// tiny_copy_compact_ex(), a tiny_parser or a tiny_parse_cache): the same as
+// the functions without the suffix, but storage is allocated and freed with a.
+// Parsers with their own allocator decode escaped borrowed strings up front,
+// so reading such a value never allocates. Persistent values (tiny_persist())
+// always use the global allocator.
+void tiny_set_boolean_ex(tiny_value *v, int b, const tiny_allocator *a);
+void tiny_set_number_ex(tiny_value *v, double n, const tiny_allocator *a);
+void tiny_set_string_ex(tiny_value *v, const char *s, size_t len, const tiny_allocator *a);
+void tiny_set_array_ex(tiny_value *v, size_t capacity, const tiny_allocator *a);
+void tiny_reserve_array_ex(tiny_value *v, size_t capacity, const tiny_allocator *a);
+void tiny_shrink_array_ex(tiny_value *v, const tiny_allocator *a);
+void tiny_clear_array_ex(tiny_value *v, const tiny_allocator *a);
+tiny_value *tiny_pushback_array_element_ex(tiny_value *v, const tiny_allocator *a);
+void tiny_popback_array_element_ex(tiny_value *v, const tiny_allocator *a);
+tiny_value *tiny_insert_array_element_ex(tiny_value *v, size_t index, const tiny_allocator *a);
+tiny_value *tiny_insert_array_elements_ex(tiny_value *v, size_t index, size_t count, const tiny_allocator *a);
+void tiny_insert_array_values_ex(tiny_value *v, size_t index, tiny_value *values, size_t count, const tiny_allocator *a);
+void tiny_append_array_values_ex(tiny_value *v, tiny_value *values, size_t count, const tiny_allocator *a);
+void tiny_splice_array_ex(tiny_value *dst, size_t index, tiny_value *src, const tiny_allocator *a);
+void tiny_erase_array_element_ex(tiny_value *v, size_t index, size_t count, const tiny_allocator *a);
+void tiny_set_object_ex(tiny_value *v, size_t capacity, const tiny_allocator *a);
+void tiny_reserve_object_ex(tiny_value *v, size_t capacity, const tiny_allocator *a);
+void tiny_shrink_object_ex(tiny_value *v, const tiny_allocator *a);
+void tiny_clear_object_ex(tiny_value *v, const tiny_allocator *a);
+tiny_value *tiny_set_object_value_ex(tiny_value *v, const char *key, size_t klen, const tiny_allocator *a);
+void tiny_remove_object_value_ex(tiny_value *v, size_t index, const tiny_allocator *a);
+void tiny_swap_remove_object_value_ex(tiny_value *v, size_t index, const tiny_allocator *a);
+void tiny_move_ex(tiny_value *dst, tiny_value *src, const tiny_allocator *a);
+void tiny_swap_ex(tiny_value *lhs, tiny_value *rhs, const tiny_allocator *a);
+void tiny_materialize_ex(tiny_value *v, const tiny_allocator *a);
+void tiny_apply_merge_patch_ex(tiny_value *target, const tiny_value *patch, const tiny_allocator *a);
+int tiny_apply_patch_ex(tiny_value *target, const tiny_value *patch, const tiny_allocator *a);
+void tiny_diff_ex(tiny_value *patch, const tiny_value *a, const tiny_value *b, const tiny_allocator *alloc);
+
 #endif